@@ -4,7 +4,8 @@
 
 // UDP CLIENT
 // runs senderThread
-// get message from inputList and send message over network
+// get message from inputQueue and send message over network
+// on shutdown, sends whatever is left in inputQueue before returning
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,21 +18,274 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <poll.h>
  
-#include "list.h"
 #include "threadManager.h"
 #include "UDPClient.h"
 #include "freeManager.h"
+#include "frame.h"
+#include "compression.h"
+#include "history.h"
+#include "threadOptions.h"
+#include "timerWheel.h"
+#include "config.h"
+#include "localTransport.h"
+#include "offload.h"
+#include "zerocopy.h"
+#include "rooms.h"
+#include "receipts.h"
+#include "transport.h"
  
 static int sockfd;
 static struct addrinfo *servinfo;
 static char *remoteHostName, *remotePortNumber, *message;
-static List* inputList;
+static MessageQueue* inputQueue;
 static pthread_t senderThread;
+static char frameBuffer[MAX_LEN_DATAGRAM];
+
+// same-host remote client: messages go to its local socket (localfd) while it has one
+static int remoteIsLocal = 0;
+static int localfd = -1;
+static uint64_t nextLocalAttempt = 0;
+
+// datagrams of one length (the last one may be shorter) waiting to be sent together: with UDP segmentation
+// offload, or as one datagram on the local socket
+static char batchBuffer[GSO_MAX_BYTES];
+static int batchLen = 0;
+static int batchCount = 0;
+static int batchSegmentSize = 0;
+
+// senderThread's timers (idle timeout), run whenever it wakes up
+static TimerWheel senderTimers;
+static Timer idleTimer;
+static uint64_t idleTimeout = 0; // 0 = never
+static uint64_t lastSent;
+static int idleExpired = 0;
+// the "!\n" that ends the session is being sent
+static int endingSession = 0;
+
+// 1 if the remote client is on this host and has a local socket (looked for again while it does not)
+static int hasLocalPeer(struct addrinfo* p) {
+    if (remoteIsLocal && localfd == -1 && timerNow() >= nextLocalAttempt) {
+        localfd = connectLocalPeer(p->ai_addr);
+        nextLocalAttempt = timerNow() + LOCAL_RETRY_NS;
+        if (localfd != -1 && getConfig()->sendBufferSize != 0) {
+            setSocketBufferSize(localfd, SO_SNDBUF, getConfig()->sendBufferSize);
+        }
+    }
+    return localfd != -1;
+}
+
+// send buffer (datagrams of segmentSize bytes) to the remote client's local socket, waiting for room while its receive
+// queue is full (up to LOCAL_END_WAIT_MS for the end of the session, else LOCAL_SEND_WAIT_MS), so they stay in order
+// returns 1 if it was sent, 0 if it has to go over UDP
+static int sendLocalInOrder(const char* buffer, int length, int segmentSize, struct addrinfo* p) {
+    uint64_t deadline = timerNow() + (endingSession ? LOCAL_END_WAIT_MS : LOCAL_SEND_WAIT_MS) * 1000000ULL;
+
+    while (hasLocalPeer(p)) {
+        int sent = sendLocal(localfd, buffer, length, segmentSize);
+        if (sent == length) {
+            return 1;
+        }
+
+        // case: the remote client closed its local socket (ended or restarted), use UDP until it is back
+        if (sent == -1) {
+            close(localfd);
+            localfd = -1;
+            return 0;
+        }
+
+        // case: its receive queue is full, wait until it reads (a remote client that stopped reading gets UDP)
+        uint64_t now = timerNow();
+        if (now >= deadline) {
+            return 0;
+        }
+        struct pollfd fds = { .fd = localfd, .events = POLLOUT };
+        if (poll(&fds, 1, (deadline - now) / 1000000 + 1) == -1 && errno != EINTR) {
+            perror("UDPClient: poll() error");
+            exit(-1);
+        }
+    }
+    return 0;
+}
+
+// send a datagram to the remote client: to its local socket if it is on this host and has one, else over UDP
+static int sendDatagram(const char* datagram, int length, struct addrinfo* p) {
+    if (sendLocalInOrder(datagram, length, length, p)) {
+        return length;
+    }
+    return getTransport()->send(sockfd, datagram, length, 0, p->ai_addr, p->ai_addrlen);
+}
+
+static void sendDatagramOrExit(const char* datagram, int length, struct addrinfo* p) {
+    if (sendDatagram(datagram, length, p) == -1) {
+        perror("UDPClient: sendto() error\n");
+        exit(-1);
+    }
+}
+
+// send the batched datagrams with one syscall if the local socket or the kernel's segmentation offload takes them
+// (else one by one)
+static void flushBatch(struct addrinfo* p) {
+    if (batchCount == 0) {
+        return;
+    }
+
+    if (sendLocalInOrder(batchBuffer, batchLen, batchSegmentSize, p)) {
+        batchLen = 0;
+        batchCount = 0;
+        return;
+    }
+
+    if (batchCount == 1 || sendSegments(sockfd, batchBuffer, batchLen, batchSegmentSize, p->ai_addr, p->ai_addrlen) == -1) {
+        for (int pos = 0; pos < batchLen; pos += batchSegmentSize) {
+            int length = batchLen - pos < batchSegmentSize ? batchLen - pos : batchSegmentSize;
+            sendDatagramOrExit(batchBuffer + pos, length, p);
+        }
+    }
+
+    batchLen = 0;
+    batchCount = 0;
+}
+
+// send a datagram as part of a batch where possible, flushBatch sends what is left
+static void queueDatagram(const char* datagram, int length, struct addrinfo* p) {
+    // case: a datagram that cannot be batched goes out on its own (after the ones before it)
+    if (!isSegmentOffloadUsable(length)) {
+        flushBatch(p);
+        sendDatagramOrExit(datagram, length, p);
+        return;
+    }
+
+    // a batch is full, or ends with the first datagram shorter than the ones before it
+    if (batchCount > 0 && (length > batchSegmentSize || batchLen % batchSegmentSize != 0
+        || batchCount == GSO_MAX_SEGMENTS || batchLen + length > GSO_MAX_BYTES)) {
+        flushBatch(p);
+    }
+
+    if (batchCount == 0) {
+        batchSegmentSize = length;
+    }
+    memcpy(batchBuffer + batchLen, datagram, length);
+    batchLen += length;
+    batchCount++;
+}
+
+// frame a message to the remote client, asking for a receipt with --receipts
+static int encodeMessage(const char* message, int length, char* frame, int frameCapacity) {
+    if (isReceiptsEnabled()) {
+        return encodeReceiptFrame(message, length, trackMessage(message, length), frame, frameCapacity);
+    }
+    return encodeFrame(message, length, frame, frameCapacity);
+}
+
+// large message over UDP: send it with MSG_ZEROCOPY, framed into a buffer of its own if framing is enabled
+// (zerocopy.c holds a reference on the datagram until the kernel is done with it)
+static void sendMessageZerocopy(char* message, int length, struct addrinfo* p) {
+    char* datagram = message;
+    int datagramLen = length;
+
+    flushBatch(p);
+
+    if (isMessageFramed(message, length)) {
+        datagram = allocMessage(length + FRAME_OVERHEAD);
+        datagramLen = encodeMessage(message, length, datagram, length + FRAME_OVERHEAD);
+        if (datagramLen == -1) {
+            fprintf(stderr, "UDPClient: message too large to frame\n");
+            exit(-1);
+        }
+    }
+
+    // case: the kernel did not take it (e.g. too many sends waiting for completions), send a copy
+    if (sendZerocopy(sockfd, datagram, datagramLen, p->ai_addr, p->ai_addrlen) == -1) {
+        sendDatagramOrExit(datagram, datagramLen, p);
+    }
+
+    if (datagram != message) {
+        releaseMessage(datagram);
+    }
+}
+
+// room message: framed once and sent to every subscriber of room over UDP (see rooms.c)
+static void sendRoomMessage(const char* message, int length, Room* room, struct addrinfo* p) {
+    const char* datagram = message;
+    int datagramLen = length;
+
+    flushBatch(p);
+
+    if (isMessageFramed(message, length)) {
+        datagramLen = encodeFrame(message, length, frameBuffer, MAX_LEN_DATAGRAM);
+        if (datagramLen == -1) {
+            fprintf(stderr, "UDPClient: message too large to frame\n");
+            exit(-1);
+        }
+        datagram = frameBuffer;
+    }
+
+    if (sendToRoom(sockfd, room, datagram, datagramLen) == 0) {
+        fprintf(stderr, "UDPClient: the room has no subscribers, message was not sent\n");
+    }
+}
+
+// --compress: advertise compression to the remote client when compression.c asks for it
+static void sendHelloIfDue(struct addrinfo* p) {
+    char hello[FRAME_OVERHEAD];
+
+    if (takeHelloDue()) {
+        queueDatagram(hello, encodeHelloFrame(hello, sizeof(hello)), p);
+    }
+}
+
+// send the "!\n" that ends the session (see encodeEndOfSessionFrame)
+static void sendEndOfSession(struct addrinfo* p) {
+    int frameLen = encodeEndOfSessionFrame(frameBuffer, MAX_LEN_DATAGRAM);
+
+    endingSession = 1;
+    queueDatagram(frameBuffer, frameLen, p);
+    flushBatch(p);
+}
+
+// send message to the remote client (or the subscribers of its room), wrapped in a frame if isMessageFramed
+// (it may wait in the batch until flushBatch)
+static void sendMessage(char* message, struct addrinfo* p) {
+    int length = getMessageInfo(message)->length;
+    int frameLen;
+    Room* room = findMessageRoom(message);
+
+    sendHelloIfDue(p);
+
+    if (room != NULL) {
+        sendRoomMessage(message, length, room, p);
+    } else if (useZerocopy(length) && !hasLocalPeer(p)) {
+        sendMessageZerocopy(message, length, p);
+    } else if (isMessageFramed(message, length)) {
+        frameLen = encodeMessage(message, length, frameBuffer, MAX_LEN_DATAGRAM);
+        if (frameLen == -1) {
+            fprintf(stderr, "UDPClient: message too large to frame\n");
+            exit(-1);
+        }
+        queueDatagram(frameBuffer, frameLen, p);
+    } else {
+        queueDatagram(message, length, p);
+    }
+
+    if (idleTimeout != 0) {
+        lastSent = timerNow();
+    }
+}
+
+// idle timeout: the timer is only moved when it fires, not for every message sent
+static void checkIdle(void* arg, uint64_t now) {
+    if (now - lastSent < idleTimeout) {
+        addTimer(&senderTimers, &idleTimer, lastSent + idleTimeout, checkIdle, NULL);
+        return;
+    }
+    idleExpired = 1;
+}
  
 void *sendMessages() {
     struct addrinfo hints, *p;
-    int gaiVal, numbytes;
+    int gaiVal;
 
     // clear hints to store values
     memset(&hints, 0 ,sizeof(hints));
@@ -62,76 +316,119 @@ void *sendMessages() {
         fprintf(stderr, "UDPClient: failed to create socket");
         exit(-1);
     }
+
+    remoteIsLocal = isLocalTransportEnabled() && isLocalAddress(p->ai_addr);
+    if (remoteIsLocal) {
+        bindSourcePort(sockfd);
+    }
+    setRemotePeer(p->ai_addr, p->ai_addrlen);
+
+    if (getConfig()->sendBufferSize != 0) {
+        setSocketBufferSize(sockfd, SO_SNDBUF, getConfig()->sendBufferSize);
+    }
     
+    startZerocopy(sockfd);
+
+    initTimerWheel(&senderTimers, TIMER_TICK_NS);
+    if (idleTimeout != 0) {
+        lastSent = timerNow();
+        addTimer(&senderTimers, &idleTimer, lastSent + idleTimeout, checkIdle, NULL);
+    }
+
+    sendHelloIfDue(p);
+    flushBatch(p);
+
     while (1) {
-        // wait for signal that messages are available to be sent over the network
-        waitUDPClient();
+        // wait for signal that messages are available to be sent over the network (or for a timer)
+        waitUDPClient(inputQueue, &senderTimers);
+        runTimers(&senderTimers, timerNow());
+
+        if (countMessages(inputQueue) == 0) {
+            // case: session is ending and every message has been sent
+            if (isShuttingDown()) {
+                return NULL;
+            }
+
+            // case: nothing was sent for the idle timeout, end the session as if the user had typed "!"
+            if (idleExpired) {
+                sendEndOfSession(p);
+                fprintf(stderr, "No message was sent for %llu s, ending the session\n", (unsigned long long)(idleTimeout / 1000000000ULL));
+                requestShutdown();
+                return NULL;
+            }
+            continue;
+        }
 
         do {
-            // get message from the inputList to send
-            message = getMessage(inputList);
+            // get message from the inputQueue to send
+            message = getMessage(inputQueue);
 
             if (message == NULL) {
                 fprintf(stderr, "UDPClient: failed to get message, message is NULL\n");
                 break;
             }
 
-            // send the message
-            numbytes = sendto(sockfd, message, strlen(message), 0, p->ai_addr, p->ai_addrlen);
-            if (numbytes == -1) {
-                perror("UDPClient: sendto() error\n");
-                exit(-1);
-            }
-            
-            // if user enters "!\n", free message and stop sending messages
-            if (!strcmp(message,"!\n")) {
-                freeMessage(message);
+            // if user enters "!\n" (or the input ends), send it, release message and stop sending messages
+            if (getMessageInfo(message)->endOfSession) {
+                sendEndOfSession(p);
+                releaseMessage(message);
                 return NULL;
             }
+
+            // send the message, wrapped in a frame if framing is enabled
+            sendMessage(message, p);
+
+            // keep a copy of the sent message in the chat history
+            recordHistory(message, getMessageInfo(message)->length, HISTORY_SENT, NULL);
             
-            // else free message and continue sending
-            freeMessage(message);
+            // else release message (zerocopy.c keeps its own reference while the kernel sends from it) and continue
+            releaseMessage(message);
+
+            // continue sending messages if there are still messages in the queue
+        } while (countMessages(inputQueue) != 0);
 
-            // continue sending messages if there are still messages in the list
-        } while (countList(inputList) != 0);
+        // the queue is empty, send the last batch and release the messages whose zerocopy sends completed
+        flushBatch(p);
+        reapZerocopy(sockfd);
     }
 
     return NULL;
 }
 
-void initUDPClient(char* remoteName, char* remotePort, List* list) {
+// end the session when no message has been sent for seconds (0 = never), call before initUDPClient
+void setIdleTimeout(int seconds) {
+    idleTimeout = (uint64_t)seconds * 1000000000ULL;
+}
+
+void initUDPClient(char* remoteName, char* remotePort, MessageQueue* queue) {
     remoteHostName=remoteName;
     remotePortNumber = remotePort;
-    inputList = list;
+    inputQueue = queue;
     
     // create senderThread - sends data to the remote UNIX process over the network using UDP
-    int res = pthread_create(&senderThread, NULL, sendMessages, NULL);
+    int res = createPipelineThread(THREAD_SENDER, &senderThread, sendMessages);
     if(res != 0) {
         perror("UDPClient: senderThread could not be created\n");
         exit(-1);
     }
 }
 
-void cancelUDPClient() {
-    int res = pthread_cancel(senderThread);
+void closeUDPClient() {
+    // join (wait for and detach) senderThread - it returns once the remaining messages are sent
+    int res = pthread_join(senderThread, NULL); 
     if (res != 0) {
-        perror("UDPClient: thread could not be cancelled\n");
+        perror("UDPClient: thread could not be joined\n");
         exit(-1);
     }
-}
- 
-void closeUDPClient() {
+
     // free the linked list of results
     freeaddrinfo(servinfo);
 
-    // close the socket
+    // wait for the kernel to finish the last zerocopy sends, then close the sockets
+    drainZerocopy(sockfd);
     close(sockfd);
-
-    // join (wait for and detach) senderThread
-    int res = pthread_join(senderThread, NULL); 
-    if (res != 0) {
-        perror("UDPClient: thread could not be joined\n");
-        exit(-1);
+    if (localfd != -1) {
+        close(localfd);
     }
 }
 
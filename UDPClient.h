@@ -1,12 +1,12 @@
 #ifndef _UDP_CLIENT_H
 #define _UDP_CLIENT_H
 
-#include "list.h"
+#include "freeManager.h"
 
 void *sendMessages();
-void initUDPClient(char* remoteName, char* remotePort, List* list);
+void setIdleTimeout(int seconds);
+void initUDPClient(char* remoteName, char* remotePort, MessageQueue* queue);
 void signalUDPClient();
-void cancelUDPClient();
 void closeUDPClient();
 
 #endif
\ No newline at end of file
@@ -4,7 +4,8 @@
 
 // UDP SERVER
 // runs listenerThread
-// await UDP datagram and add message to outputList
+// await UDP datagram and add message to outputQueue
+// returns when a "!" message is received (and requests shutdown) or when shutdown is requested
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,30 +18,221 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/un.h>
 
-#include "list.h"
 #include "threadManager.h"
 #include "outputWriter.h"
 #include "UDPServer.h"
 #include "inputReader.h"
 #include "UDPClient.h"
+#include "frame.h"
+#include "cipher.h"
+#include "history.h"
+#include "pipeMode.h"
+#include "freeManager.h"
+#include "echo.h"
+#include "receipts.h"
+#include "threadOptions.h"
+#include "latencyReport.h"
+#include "heartbeat.h"
+#include "timerWheel.h"
+#include "rateLimit.h"
+#include "config.h"
+#include "localTransport.h"
+#include "offload.h"
+#include "transport.h"
+#include "networkSimulator.h"
  
-// limit for UDP datagram under IPv4 is 65507
-#define MAX_LEN_BUFFER 65491  // 65507 - 15 (for header) - 1 (for '\0')
-
 static int sockfd;
-static struct addrinfo *servinfo;
+static int localfd = -1; // same-host remote clients send here (see localTransport.c), -1 if there is none
 static char* myPortNumber;
-static List* outputList;
+static MessageQueue* outputQueue;
 static pthread_t listenerThread;
 
+// framed messages are decoded into messageBuffer (--max-message-length + 1 bytes)
+static char* messageBuffer;
+// datagrams are received into datagramBuffer (on the heap, so --thread listener:stack= does not have to make room for it)
+static char* datagramBuffer;
+
+// listenerThread's timers (heartbeats, receipts, simulated deliveries), run whenever it wakes up
+static TimerWheel listenerTimers;
+
+// control messages of a received datagram: kernel timestamp and UDP_GRO segment size
+#define RECEIVE_CONTROL_SPACE (CMSG_SPACE(sizeof(struct timespec)) + OFFLOAD_CONTROL_SPACE)
+
+// coalesced datagrams (UDP_GRO) still to be handed out: pendingOffset..pendingEnd of the receive buffer
+static int pendingOffset = 0;
+static int pendingEnd = 0;
+static int pendingSegmentSize;
+
+// kernel receive time of the datagram from its SCM_TIMESTAMPNS control message (0 if there is none)
+static uint64_t getKernelTime(struct msghdr* msg) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            return (uint64_t)stamp.tv_sec * 1000000000ULL + stamp.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+// receive a datagram from fd without waiting, returns the number of bytes received or -1 if there is none
+static int tryReceive(int fd, struct msghdr* msg, uint64_t* kernelTime) {
+    msg->msg_controllen = RECEIVE_CONTROL_SPACE;
+
+    int numbytes = getTransport()->receive(fd, msg);
+    if (numbytes == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("UDPServer recvmsg error");
+            exit(-1);
+        }
+        return -1;
+    }
+
+    *kernelTime = isLatencyReportEnabled() ? getKernelTime(msg) : 0;
+    return numbytes;
+}
+
+// numbytes received: the first datagram's length, the rest are handed out by the next receiveDatagram calls
+// (segmentSize = length of each datagram, the last one may be shorter; 0 = a single datagram)
+static int splitSegments(int numbytes, int segmentSize) {
+    if (segmentSize > 0 && numbytes > segmentSize) {
+        pendingSegmentSize = segmentSize;
+        pendingOffset = segmentSize;
+        pendingEnd = numbytes;
+        return segmentSize;
+    }
+    return numbytes;
+}
+
+// wait until a datagram has been received into buffer or the session is ending, running the heartbeat timers meanwhile
+// kernelTime is set to when the kernel received it if the latency report is enabled
+// datagrams from the local socket are given the address 127.0.0.1 and their sender's UDP port (for the rate limit and
+// the history)
+// a buffer of coalesced datagrams (UDP_GRO, or a batch on the local socket) is handed out one datagram per call, without a syscall: datagram is
+// set to where it starts, and remoteAddr and kernelTime are left as they were set for the first one
+// returns the number of bytes received, or -1 on shutdown
+static int receiveDatagram(char* buffer, char** datagram, struct sockaddr_in* remoteAddr, socklen_t* remoteAddrLen, uint64_t* kernelTime) {
+    struct pollfd fds[3] = {
+        { .fd = getShutdownFd(), .events = POLLIN },
+        { .fd = sockfd, .events = POLLIN },
+        { .fd = localfd, .events = POLLIN } // ignored by poll when it is -1
+    };
+    struct sockaddr_un localSender;
+    LocalHeader localHeader;
+    struct iovec localIov[2] = {
+        { .iov_base = &localHeader, .iov_len = sizeof(localHeader) },
+        { .iov_base = buffer, .iov_len = MAX_LEN_DATAGRAM }
+    };
+    uint64_t spinDeadline = 0;
+    char control[RECEIVE_CONTROL_SPACE];
+    struct iovec iov = { .iov_base = buffer, .iov_len = MAX_LEN_DATAGRAM };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control };
+
+    // case: the rest of a coalesced buffer
+    if (pendingOffset < pendingEnd) {
+        int numbytes = pendingEnd - pendingOffset < pendingSegmentSize ? pendingEnd - pendingOffset : pendingSegmentSize;
+        *datagram = buffer + pendingOffset;
+        pendingOffset += numbytes;
+        return numbytes;
+    }
+    *datagram = buffer;
+
+    while (!isShuttingDown()) {
+        // run the timers that are due, then sleep no longer than until the next one
+        runTimers(&listenerTimers, timerNow());
+
+        // try to receive first: while datagrams are queued this costs one syscall per message
+        // (UDP first, so messages sent before the remote client switched to the local socket come first)
+        msg.msg_name = remoteAddr;
+        msg.msg_namelen = sizeof(*remoteAddr);
+        int numbytes = tryReceive(sockfd, &msg, kernelTime);
+        if (numbytes != -1) {
+            *remoteAddrLen = msg.msg_namelen;
+            return splitSegments(numbytes, getReceivedSegmentSize(&msg));
+        }
+
+        if (localfd != -1) {
+            // the LocalHeader is read apart from the datagrams
+            msg.msg_name = &localSender;
+            msg.msg_namelen = sizeof(localSender);
+            msg.msg_iov = localIov;
+            msg.msg_iovlen = 2;
+            numbytes = tryReceive(localfd, &msg, kernelTime);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+
+            if (numbytes >= (int)sizeof(localHeader)) {
+                memset(remoteAddr, 0, sizeof(*remoteAddr));
+                remoteAddr->sin_family = AF_INET;
+                remoteAddr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                remoteAddr->sin_port = localHeader.port;
+                *remoteAddrLen = sizeof(*remoteAddr);
+                return splitSegments(numbytes - sizeof(localHeader), localHeader.segmentSize);
+            }
+            if (numbytes != -1) {
+                continue; // too short to be from s-talk
+            }
+        }
+
+        // busy poll mode: keep retrying for the spin time before going to sleep
+        if (getBusyPollMicros() != 0 && keepSpinning(&spinDeadline)) {
+            continue;
+        }
+
+        // nothing queued, sleep until the socket or the shutdown channel is readable (or a timer is due,
+        // including one the receive just added, see networkSimulator.c)
+        int timeoutMs = getTimerTimeoutMs(&listenerTimers);
+        if (poll(fds, 3, timeoutMs) == -1 && errno != EINTR) {
+            perror("UDPServer poll error");
+            exit(-1);
+        }
+    }
+
+    return -1;
+}
+
+// framed datagrams are unwrapped (and decompressed) into messageBuffer (messageCapacity + 1 bytes), plain text is used as is
+// payload is set to the message and info to the frame's flags and send time (both 0 for plain text)
+// returns the message length (0 for a hello frame or an empty message from --pipe), or -1 if the datagram is dropped (a malformed, forged or replayed frame,
+// a message longer than messageCapacity, or plain text while encryption is enabled)
+int unwrapDatagram(char* datagram, int numbytes, const struct sockaddr_in* source, char* messageBuffer, int messageCapacity, char** payload, FrameInfo* info) {
+    info->flags = 0;
+    info->control = 0;
+    info->sendTime = 0;
+
+    if (isFrame(datagram, numbytes)) {
+        int length = decodeFrame(datagram, numbytes, source, messageBuffer, messageCapacity, info);
+        if (length < 0) {
+            return -1;
+        }
+        messageBuffer[length] = '\0';
+        *payload = messageBuffer;
+        return length;
+    }
+
+    // unauthenticated plain text is not trusted when encryption is enabled
+    if (isEncryptionEnabled() || numbytes > messageCapacity) {
+        return -1;
+    }
+
+    *payload = datagram;
+    return numbytes;
+}
+
 void* listenForMessages() {
-    int sockfd, gaiVal, bindVal, numbytes;
+    int gaiVal, bindVal, numbytes;
     struct addrinfo hints, *servinfo, *p;
-    char messageBuffer[MAX_LEN_BUFFER];
+    char* datagram;
     char* message;
+    char* payload;
+    int payloadLen;
     struct sockaddr_in remoteAddr;
     socklen_t remoteAddrLen;
+    uint64_t kernelTime, receiveTime;
+    FrameInfo frameInfo;
 
     // clear hints to store values
     memset(&hints, 0 ,sizeof (hints));
@@ -87,39 +279,159 @@ void* listenForMessages() {
     // free the linked list of results
     freeaddrinfo(servinfo);
 
+    initTimerWheel(&listenerTimers, TIMER_TICK_NS);
+
+    // heartbeats are sent from this socket, so the remote client's pongs arrive here
+    if (isHeartbeatEnabled()) {
+        startHeartbeat(sockfd, &listenerTimers);
+    }
+
+    // receipts go out from this socket too, and the remote client's receipts for sent messages arrive here
+    if (isReceiptsEnabled()) {
+        startReceipts(sockfd, &listenerTimers, outputQueue);
+    }
+
+    // --simulate: received datagrams are held back until the simulated link delivers them
+    if (isNetworkSimulatorEnabled()) {
+        startNetworkSimulator(&listenerTimers);
+    }
+
+    // same-host remote clients send to the local socket instead of the UDP port
+    localfd = openLocalListener(sockfd);
+
+    // bulk traffic may arrive as a buffer of several datagrams, split by receiveDatagram
+    enableReceiveOffload(sockfd);
+
+    if (getConfig()->receiveBufferSize != 0) {
+        setSocketBufferSize(sockfd, SO_RCVBUF, getConfig()->receiveBufferSize);
+        if (localfd != -1) {
+            setSocketBufferSize(localfd, SO_RCVBUF, getConfig()->receiveBufferSize);
+        }
+    }
+
+    // latency report: have the kernel timestamp every datagram as it arrives
+    if (isLatencyReportEnabled()) {
+        int enable = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == -1) {
+            perror("UDPServer: could not enable SO_TIMESTAMPNS");
+        }
+        if (localfd != -1 && setsockopt(localfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == -1) {
+            perror("UDPServer: could not enable SO_TIMESTAMPNS on the local socket");
+        }
+    }
+
+    // busy poll mode: let the kernel poll the device queue for the spin time when the socket is empty
+    // (raising it above net.core.busy_read needs CAP_NET_ADMIN, spinning in recvfrom still works without it)
+    if (getBusyPollMicros() != 0) {
+        int busyPoll = getBusyPollMicros();
+        if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) == -1) {
+            perror("UDPServer: could not enable SO_BUSY_POLL");
+        }
+    }
+
     while (1) {
         do {
-            // clear the messageBuffer to store the message
-            memset(&messageBuffer, 0, MAX_LEN_BUFFER);
-
             // receive the message
-            remoteAddrLen = sizeof(remoteAddr);
-            numbytes = recvfrom(sockfd, messageBuffer, MAX_LEN_BUFFER, 0, (struct sockaddr* ) &remoteAddr, &remoteAddrLen);
-            
-            if(numbytes ==-1) {
-                perror("UDPServer recvfrom error");
-                exit(-1);
+            numbytes = receiveDatagram(datagramBuffer, &datagram, &remoteAddr, &remoteAddrLen, &kernelTime);
+            receiveTime = isLatencyReportEnabled() ? realtimeNanoseconds() : 0;
+
+            // case: session is ending, let outputWriter write what has been received so far
+            if(numbytes == -1) {
+                flushReceipts();
+                signalOutputWriter();
+                return NULL;
             }
 
-            // add the message header and store the message
-            message = addHeader(messageBuffer, numbytes);
+            // over its source's rate limit: dropped before it is decoded or copied
+            // (the datagram is only used up to numbytes from here on, so the buffer is not cleared first)
+            if (isRateLimitEnabled() && !acceptDatagram(&remoteAddr, datagram, numbytes)) {
+                payloadLen = 0;
+                continue;
+            }
 
-            // add the message to the outputList
-            int res = addMessage(outputList, message);
-            if(res == -1) {
-                fprintf(stderr,"UDPServer: could not add message to list\n");
+            payloadLen = unwrapDatagram(datagram, numbytes, &remoteAddr, messageBuffer, getConfig()->maxMessageLen, &payload, &frameInfo);
+            if (payloadLen == -1) {
+                if (isFrame(datagram, numbytes)) {
+                    fprintf(stderr, "UDPServer: dropped malformed, forged or replayed frame\n");
+                } else if (isEncryptionEnabled()) {
+                    fprintf(stderr, "UDPServer: dropped unencrypted message\n");
+                } else {
+                    fprintf(stderr, "UDPServer: dropped message longer than --max-message-length\n");
+                }
+                payloadLen = 0;
+                continue;
             }
 
-            // if the message is "!\n" (local) or "Remote Client: !\n" (remote), stop listening for messages
-            if(!strcmp(message, "!\n") || !strcmp(message, "Remote Client: !\n")) {
+            // any authentic datagram from the remote client shows it is alive, heartbeats are answered here instead of being shown
+            if (isHeartbeatEnabled()) {
+                heardFromPeer(&remoteAddr);
+            }
+            if (frameInfo.flags & FRAME_HEARTBEAT) {
+                if (isHeartbeatEnabled()) {
+                    handleHeartbeat(payload, payloadLen, &remoteAddr);
+                }
+                payloadLen = 0;
+                continue;
+            }
+            if (frameInfo.flags & FRAME_RECEIPTS) {
+                if (isReceiptsEnabled()) {
+                    handleReceipts(payload, payloadLen);
+                }
+                payloadLen = 0;
+                continue;
+            }
+            if (frameInfo.flags & FRAME_HELLO) {
+                payloadLen = 0; // decodeFrame has taken note of its flags
+                continue;
+            }
+
+            // the remote client's "!\n" ends the session (a "!\n" sent as text in pipe mode does not, see isEndOfSession)
+            int endOfSession = isEndOfSession(datagram, numbytes, payload, payloadLen, &frameInfo);
+
+            // add the message header and store the message (pipe mode passes the message through as is)
+            if (isPipeMode()) {
+                message = allocMessage(payloadLen);
+                memcpy(message, payload, payloadLen);
+                message[payloadLen] = '\0';
+            } else {
+                message = addHeader(payload, payloadLen);
+            }
+            getMessageInfo(message)->endOfSession = endOfSession;
+
+            // latency report: keep the timestamps with the message until outputWriter has written it
+            if (isLatencyReportEnabled()) {
+                MessageInfo* info = getMessageInfo(message);
+                info->sendTime = frameInfo.sendTime;
+                info->kernelTime = kernelTime;
+                info->receiveTime = receiveTime;
+                info->enqueueTime = realtimeNanoseconds();
+            } else if (isEchoEnabled()) {
+                getMessageInfo(message)->enqueueTime = realtimeNanoseconds(); // merged with echoed messages by time
+            }
+
+            // add the message to the outputQueue
+            int res = addMessage(outputQueue, message);
+            if(res == MESSAGE_QUEUE_FAIL) {
+                fprintf(stderr,"UDPServer: dropped message, outputQueue is full\n");
+                releaseMessage(message);
+            } else if ((frameInfo.flags & FRAME_RECEIPT_ID) && isReceiptsEnabled()) {
+                acknowledgeMessage(frameInfo.receiptId); // only messages that will be shown count as delivered
+            }
+
+            // stop listening for messages at the end of the session
+            if(endOfSession) {
+                flushReceipts();
                 signalOutputWriter(); // outputWriter can write the message, then stop
-                cancelInputReader();
-                cancelUDPClient();
+                requestShutdown(); // inputReader and UDPClient stop too
                 return NULL;
             }
 
-            // continue listening for messages if user has not pressed enter (added '\n' to end of message)
-        } while (messageBuffer[numbytes - 1] != '\n');
+            // keep a copy of the received message in the chat history
+            recordHistory(payload, payloadLen, HISTORY_RECEIVED, &remoteAddr);
+
+            // continue listening for messages if user has not pressed enter (added '\n' to end of message),
+            // in pipe mode every datagram is a whole message
+        } while (!isPipeMode() && (payloadLen == 0 || payload[payloadLen - 1] != '\n'));
 
         // once user enters, then signal outputWriter to print the message
         signalOutputWriter();
@@ -128,39 +440,41 @@ void* listenForMessages() {
     return NULL;
 }
 
-void initUDPServer(char* myPort, List* list) {
+void initUDPServer(char* myPort, MessageQueue* queue) {
     myPortNumber = myPort;
-    outputList = list;
+    outputQueue = queue;
 
-    // create listenerThread - does nothing other than await a UDP datagram 
-    int res = pthread_create(&listenerThread, NULL, listenForMessages, NULL);
-    if(res != 0) {
-        perror("UDPServer: listenerThread could not be created\n");
+    messageBuffer = malloc(getConfig()->maxMessageLen + 1);
+    datagramBuffer = malloc(MAX_LEN_DATAGRAM);
+    if (messageBuffer == NULL || datagramBuffer == NULL) {
+        fprintf(stderr, "UDPServer: could not allocate message buffers\n");
         exit(-1);
     }
-}
 
-void cancelUDPServer() {
-    int res = pthread_cancel(listenerThread);
-    if (res != 0) {
-        perror("UDPServer: thread could not be cancelled\n");
+    // create listenerThread - does nothing other than await a UDP datagram 
+    int res = createPipelineThread(THREAD_LISTENER, &listenerThread, listenForMessages);
+    if(res != 0) {
+        perror("UDPServer: listenerThread could not be created\n");
         exit(-1);
     }
 }
 
 void closeUDPServer() {
-    // free the linked list of results
-    freeaddrinfo(servinfo);
-
-    // close the socket
-    close(sockfd);
-
-    // join (wait for and detach) senderThread
+    // join (wait for and detach) listenerThread
     int res = pthread_join(listenerThread, NULL);
     if (res != 0) {
         perror("UDPServer: thread could not be joined\n");
         exit(-1);
     }
+
+    // close the sockets
+    close(sockfd);
+    if (localfd != -1) {
+        closeLocalListener(localfd);
+    }
+    free(messageBuffer);
+    free(datagramBuffer);
+    closeNetworkSimulator();
 }
 
 char *addHeader(char messageBuffer[], int numbytes) {
@@ -168,13 +482,13 @@ char *addHeader(char messageBuffer[], int numbytes) {
     char *header = "Remote Client: ";
 
     // dynamically allocate memory to store the full message
-    char *res = (char *)malloc(sizeof(char) * (numbytes + strlen(header) + 1));
+    char *res = allocMessage(numbytes + strlen(header));
 
     // copy the header to res (at start)
     memcpy(res, header, strlen(header));
 
-    // copy the message to res (after the header)
-    memcpy(res + strlen(header), messageBuffer, numbytes + 1);
+    // copy the message to res (after the header), messageBuffer is not terminated when the datagram filled it
+    memcpy(res + strlen(header), messageBuffer, numbytes);
 
     // add '\0' to end of res
     res[numbytes + strlen(header)] = '\0';
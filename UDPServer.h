@@ -1,12 +1,13 @@
 #ifndef _UDP_SERVER_H
 #define _UDP_SERVER_H
 
-#include "list.h"
+#include "freeManager.h"
+#include "frame.h"
 
 void* listenForMessages();
-void initUDPServer(char* myPort, List* list);
-void cancelUDPServer();
+void initUDPServer(char* myPort, MessageQueue* queue);
 void closeUDPServer();
+int unwrapDatagram(char* datagram, int numbytes, const struct sockaddr_in* source, char* messageBuffer, int messageCapacity, char** payload, FrameInfo* info);
 char *addHeader(char messageBuffer[], int numbytes);
 
 #endif
\ No newline at end of file
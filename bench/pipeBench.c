@@ -0,0 +1,235 @@
+// PIPE BENCH
+// throughput/latency benchmark (and PGO training workload) for s-talk
+// starts two s-talk --pipe processes on loopback, streams messages into one and reads them back from the other
+//
+// usage: ./pipeBench [s-talk binary] [message count] [message size] [base port] [s-talk options...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+
+#define PREFIX_LEN 4
+#define TIMESTAMP_LEN 20
+#define READ_BUFFER_SIZE (256 * 1024)
+#define IDLE_TIMEOUT_MS 2000
+#define MAX_ARGS 32
+
+// extra options passed to both clients
+static char** clientOptions;
+static int clientOptionCount;
+
+static uint64_t nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// start binary in pipe mode with its stdin/stdout connected to the returned pipe ends
+static pid_t startClient(const char* binary, int localPort, int remotePort, int* stdinFd, int* stdoutFd) {
+    int in[2], out[2];
+    char local[16], remote[16];
+
+    if (pipe(in) == -1 || pipe(out) == -1) {
+        perror("pipeBench: pipe() error");
+        exit(-1);
+    }
+    snprintf(local, sizeof(local), "%d", localPort);
+    snprintf(remote, sizeof(remote), "%d", remotePort);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("pipeBench: fork() error");
+        exit(-1);
+    }
+
+    if (pid == 0) {
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        char* args[MAX_ARGS + 6];
+        int argCount = 0;
+        args[argCount++] = (char*)binary;
+        args[argCount++] = "--pipe";
+        for (int i = 0; i < clientOptionCount; i++) {
+            args[argCount++] = clientOptions[i];
+        }
+        args[argCount++] = local;
+        args[argCount++] = "127.0.0.1";
+        args[argCount++] = remote;
+        args[argCount] = NULL;
+        execv(binary, args);
+        perror("pipeBench: exec() error");
+        _exit(-1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    *stdinFd = in[1];
+    *stdoutFd = out[0];
+    return pid;
+}
+
+// give the client time to end its session (and write its profile in PGO builds) before terminating it
+static void stopClient(pid_t pid) {
+    for (int i = 0; i < IDLE_TIMEOUT_MS / 10; i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return;
+        }
+        usleep(10 * 1000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int compareLatency(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[]) {
+    const char* binary = argc > 1 ? argv[1] : "./s-talk";
+    int count = argc > 2 ? atoi(argv[2]) : 100000;
+    int size = argc > 3 ? atoi(argv[3]) : 64;
+    int basePort = argc > 4 ? atoi(argv[4]) : 47101;
+    int senderIn, senderOut, receiverIn, receiverOut;
+
+    clientOptions = argv + 5;
+    clientOptionCount = argc > 5 ? argc - 5 : 0;
+
+    if (count <= 0 || size < TIMESTAMP_LEN + 1 || clientOptionCount > MAX_ARGS) {
+        fprintf(stderr, "usage: %s [s-talk binary] [message count] [message size >= %d] [base port] [s-talk options...]\n", argv[0], TIMESTAMP_LEN + 1);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t receiver = startClient(binary, basePort + 1, basePort, &receiverIn, &receiverOut);
+    pid_t sender = startClient(binary, basePort, basePort + 1, &senderIn, &senderOut);
+
+    // give both clients time to bind their sockets
+    usleep(200 * 1000);
+
+    fcntl(senderIn, F_SETFL, O_NONBLOCK);
+    char* message = malloc(PREFIX_LEN + size);
+    char* readBuffer = malloc(READ_BUFFER_SIZE);
+    uint64_t* latencies = malloc(sizeof(uint64_t) * count);
+    int messageOffset = PREFIX_LEN + size; // nothing pending
+    int sent = 0, received = 0, readLen = 0;
+    uint32_t length = htonl(size);
+
+    memcpy(message, &length, PREFIX_LEN);
+    memset(message + PREFIX_LEN, 'x', size);
+    message[PREFIX_LEN + size - 1] = '\n';
+
+    uint64_t start = nowNanoseconds();
+
+    while (1) {
+        struct pollfd fds[2] = {
+            { .fd = receiverOut, .events = POLLIN },
+            { .fd = senderIn, .events = sent < count || messageOffset < PREFIX_LEN + size ? POLLOUT : 0 }
+        };
+
+        int ready = poll(fds, senderIn == -1 ? 1 : 2, IDLE_TIMEOUT_MS);
+        if (ready == -1 && errno != EINTR) {
+            perror("pipeBench: poll() error");
+            break;
+        }
+
+        // case: nothing arrived for a while, the remaining messages were lost
+        if (ready == 0) {
+            break;
+        }
+
+        // stream messages into the sending client, each stamped with its send time
+        if (senderIn != -1 && (fds[1].revents & (POLLOUT | POLLERR))) {
+            while (1) {
+                if (messageOffset == PREFIX_LEN + size) {
+                    if (sent == count) {
+                        // end of input ends the session
+                        close(senderIn);
+                        senderIn = -1;
+                        break;
+                    }
+                    char stamp[TIMESTAMP_LEN + 1];
+                    snprintf(stamp, sizeof(stamp), "%020llu", (unsigned long long)nowNanoseconds());
+                    memcpy(message + PREFIX_LEN, stamp, TIMESTAMP_LEN);
+                    messageOffset = 0;
+                    sent++;
+                }
+
+                int res = write(senderIn, message + messageOffset, PREFIX_LEN + size - messageOffset);
+                if (res == -1) {
+                    break;
+                }
+                messageOffset += res;
+            }
+        }
+
+        // read messages back from the receiving client
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            int res = read(receiverOut, readBuffer + readLen, READ_BUFFER_SIZE - readLen);
+            // case: the session ended, the receiving client closed its stdout
+            if (res <= 0) {
+                break;
+            }
+            readLen += res;
+
+            uint64_t now = nowNanoseconds();
+            int pos = 0;
+            while (readLen - pos >= PREFIX_LEN) {
+                uint32_t messageLen;
+                memcpy(&messageLen, readBuffer + pos, PREFIX_LEN);
+                messageLen = ntohl(messageLen);
+                if ((uint32_t)(readLen - pos - PREFIX_LEN) < messageLen) {
+                    break;
+                }
+
+                char* payload = readBuffer + pos + PREFIX_LEN;
+                if (messageLen >= TIMESTAMP_LEN && received < count) {
+                    latencies[received++] = now - strtoull(payload, NULL, 10);
+                }
+                pos += PREFIX_LEN + messageLen;
+            }
+            memmove(readBuffer, readBuffer + pos, readLen - pos);
+            readLen -= pos;
+        }
+    }
+
+    uint64_t elapsed = nowNanoseconds() - start;
+
+    if (senderIn != -1) {
+        close(senderIn);
+    }
+    close(receiverIn);
+    close(receiverOut);
+    close(senderOut);
+    stopClient(sender);
+    stopClient(receiver);
+
+    printf("messages: %d sent, %d received (%.2f%% lost)\n", sent, received, 100.0 * (sent - received) / sent);
+    printf("throughput: %.0f msgs/s, %.1f MB/s\n", received / (elapsed / 1e9), (double)received * size / (elapsed / 1e9) / 1e6);
+
+    if (received > 0) {
+        qsort(latencies, received, sizeof(uint64_t), compareLatency);
+        printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            latencies[received / 2] / 1e3, latencies[(int)(received * 0.99)] / 1e3, latencies[received - 1] / 1e3);
+    }
+
+    free(message);
+    free(readBuffer);
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,278 @@
+// References:
+// RFC 8439 - ChaCha20 and Poly1305 for IETF Protocols
+// RFC 4303 - IP Encapsulating Security Payload, 3.4.3 Sequence Number Verification
+
+// CIPHER
+// authenticated encryption (ChaCha20-Poly1305) of frame payloads with a pre-shared key
+// encryptPayload is called from senderThread (messages) and listenerThread (heartbeats), so it is serialized by encryptMutex,
+// decryptPayload/acceptSequence are only called from listenerThread
+// replay protection: every sender (session id) has its own sliding window, and a sender not seen before is only
+// accepted above a floor, as its sequence numbers start at its start time (see frame.c):
+// - per address: the highest sequence seen from that address, so once a restarted client has been heard from,
+//   frames recorded from its earlier runs are rejected (its new session takes over the old one's window)
+// - for all addresses: REPLAY_MAX_SESSION_AGE before this client's start or the newest sequence seen, so frames
+//   recorded longer ago than that are rejected from any address
+// windows are never evicted: once MAX_PEERS senders are known, new ones are refused
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+
+#include "cipher.h"
+#include "rooms.h"
+
+// size of the anti-replay window (in messages)
+#define REPLAY_WINDOW 64
+// senders that have their own replay window (the remote client and the subscribers of rooms)
+#define REPLAY_SESSIONS MAX_PEERS
+// addresses with a floor (a client sends from its listener socket and its sender socket)
+#define REPLAY_ADDRESSES (2 * MAX_PEERS)
+
+// key contexts are set up once, then only the nonce changes per message
+static EVP_CIPHER_CTX* encryptContext;
+static pthread_mutex_t encryptMutex = PTHREAD_MUTEX_INITIALIZER;
+static EVP_CIPHER_CTX* decryptContext;
+static int encryptionEnabled = 0;
+
+// replay window of one sender (session id): highest authenticated sequence number and bitmap of the ones seen below it
+// every sender numbers its frames from its own start time, so they cannot share a window
+typedef struct ReplayWindow_s ReplayWindow;
+struct ReplayWindow_s {
+    int inUse;
+    uint32_t sessionId;
+    uint64_t highestSequence;
+    uint64_t replayBitmap;
+};
+
+// floor of one address: the highest sequence seen from it, and the session that sent it
+typedef struct ReplayFloor_s ReplayFloor;
+struct ReplayFloor_s {
+    uint32_t addr;
+    uint16_t port;
+    uint32_t sessionId;
+    uint64_t highestSequence;
+};
+
+// listenerThread only
+static ReplayWindow replayWindows[REPLAY_SESSIONS];
+static ReplayFloor replayFloors[REPLAY_ADDRESSES];
+static int floorCount = 0;
+static uint64_t startFloor = 0;      // lowest first sequence of a new sender, from this client's start
+static uint64_t newestSequence = 0;  // highest sequence accepted from any sender
+
+// start up: derive the key from the contents of keyFile and precompute the cipher contexts
+void initCipher(char* keyFile) {
+    unsigned char keyMaterial[4096];
+    unsigned char key[CIPHER_KEY_LEN];
+    unsigned int keyLen;
+
+    FILE* file = fopen(keyFile, "rb");
+    if (file == NULL) {
+        perror("cipher: could not open key file");
+        exit(-1);
+    }
+
+    size_t materialLen = fread(keyMaterial, 1, sizeof(keyMaterial), file);
+    fclose(file);
+
+    if (materialLen == 0) {
+        fprintf(stderr, "cipher: key file is empty\n");
+        exit(-1);
+    }
+
+    // key = SHA-256(key file contents)
+    if (!EVP_Digest(keyMaterial, materialLen, key, &keyLen, EVP_sha256(), NULL)) {
+        fprintf(stderr, "cipher: could not derive key\n");
+        exit(-1);
+    }
+
+    encryptContext = EVP_CIPHER_CTX_new();
+    decryptContext = EVP_CIPHER_CTX_new();
+
+    if (encryptContext == NULL || decryptContext == NULL
+        || !EVP_EncryptInit_ex(encryptContext, EVP_chacha20_poly1305(), NULL, key, NULL)
+        || !EVP_DecryptInit_ex(decryptContext, EVP_chacha20_poly1305(), NULL, key, NULL)) {
+        fprintf(stderr, "cipher: could not create cipher contexts\n");
+        exit(-1);
+    }
+
+    // clear the key from the stack, the contexts keep their own copy
+    memset(key, 0, sizeof(key));
+    memset(keyMaterial, 0, sizeof(keyMaterial));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    resetReplayWindows((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+
+    encryptionEnabled = 1;
+}
+
+// clean up: free the cipher contexts before ending program
+void destroyCipher() {
+    if (!encryptionEnabled) {
+        return;
+    }
+
+    EVP_CIPHER_CTX_free(encryptContext);
+    EVP_CIPHER_CTX_free(decryptContext);
+    encryptionEnabled = 0;
+}
+
+int isEncryptionEnabled() {
+    return encryptionEnabled;
+}
+
+// encrypt payload in place and write the authentication tag (covering aad and payload) to tag
+// returns 0 on success, -1 on failure
+int encryptPayload(const uint8_t nonce[CIPHER_NONCE_LEN], const char* aad, int aadLen, char* payload, int payloadLen, char* tag) {
+    int outLen;
+    int res = 0;
+
+    pthread_mutex_lock(&encryptMutex);
+    if (!EVP_EncryptInit_ex(encryptContext, NULL, NULL, NULL, nonce)
+        || !EVP_EncryptUpdate(encryptContext, NULL, &outLen, (const unsigned char*)aad, aadLen)
+        || !EVP_EncryptUpdate(encryptContext, (unsigned char*)payload, &outLen, (const unsigned char*)payload, payloadLen)
+        || !EVP_EncryptFinal_ex(encryptContext, (unsigned char*)payload + outLen, &outLen)
+        || !EVP_CIPHER_CTX_ctrl(encryptContext, EVP_CTRL_AEAD_GET_TAG, CIPHER_TAG_LEN, tag)) {
+        res = -1;
+    }
+    pthread_mutex_unlock(&encryptMutex);
+
+    return res;
+}
+
+// decrypt payload in place after checking its authentication tag
+// returns 0 on success, -1 if the message was forged or corrupted
+int decryptPayload(const uint8_t nonce[CIPHER_NONCE_LEN], const char* aad, int aadLen, char* payload, int payloadLen, const char* tag) {
+    int outLen;
+
+    if (!EVP_DecryptInit_ex(decryptContext, NULL, NULL, NULL, nonce)
+        || !EVP_CIPHER_CTX_ctrl(decryptContext, EVP_CTRL_AEAD_SET_TAG, CIPHER_TAG_LEN, (void*)tag)
+        || !EVP_DecryptUpdate(decryptContext, NULL, &outLen, (const unsigned char*)aad, aadLen)
+        || !EVP_DecryptUpdate(decryptContext, (unsigned char*)payload, &outLen, (const unsigned char*)payload, payloadLen)
+        || EVP_DecryptFinal_ex(decryptContext, (unsigned char*)payload + outLen, &outLen) <= 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// forget every sender, new ones are accepted from REPLAY_MAX_SESSION_AGE before start on
+// (start up, and every input of the replay fuzz target)
+void resetReplayWindows(uint64_t start) {
+    memset(replayWindows, 0, sizeof(replayWindows));
+    floorCount = 0;
+    startFloor = start > REPLAY_MAX_SESSION_AGE ? start - REPLAY_MAX_SESSION_AGE : 0;
+    newestSequence = 0;
+}
+
+static ReplayWindow* findReplayWindow(uint32_t sessionId) {
+    for (int i = 0; i < REPLAY_SESSIONS; i++) {
+        if (replayWindows[i].inUse && replayWindows[i].sessionId == sessionId) {
+            return &replayWindows[i];
+        }
+    }
+    return NULL;
+}
+
+static ReplayFloor* findReplayFloor(const struct sockaddr_in* source) {
+    for (int i = 0; i < floorCount; i++) {
+        if (replayFloors[i].addr == source->sin_addr.s_addr && replayFloors[i].port == source->sin_port) {
+            return &replayFloors[i];
+        }
+    }
+    return NULL;
+}
+
+// window for a sender not seen before, NULL if it is refused (below a floor, or no window is free)
+static ReplayWindow* newReplayWindow(ReplayFloor* floor, uint32_t sessionId, uint64_t sequence) {
+    uint64_t globalFloor = newestSequence > REPLAY_MAX_SESSION_AGE ? newestSequence - REPLAY_MAX_SESSION_AGE : 0;
+    ReplayWindow* w = NULL;
+
+    if (sequence < startFloor || sequence < globalFloor || (floor != NULL && sequence <= floor->highestSequence)) {
+        return NULL;
+    }
+
+    // case: a restarted client, its old session is over
+    if (floor != NULL && floor->sessionId != sessionId) {
+        w = findReplayWindow(floor->sessionId);
+    }
+    for (int i = 0; w == NULL && i < REPLAY_SESSIONS; i++) {
+        if (!replayWindows[i].inUse) {
+            w = &replayWindows[i];
+        }
+    }
+    if (w == NULL) {
+        return NULL;
+    }
+
+    w->inUse = 1;
+    w->sessionId = sessionId;
+    w->highestSequence = 0;
+    w->replayBitmap = 0;
+    return w;
+}
+
+// raise the floor of source (a new address gets one while there is room)
+static void raiseReplayFloor(ReplayFloor* floor, const struct sockaddr_in* source, uint32_t sessionId, uint64_t sequence) {
+    if (floor == NULL) {
+        if (floorCount == REPLAY_ADDRESSES) {
+            return;
+        }
+        floor = &replayFloors[floorCount++];
+        floor->addr = source->sin_addr.s_addr;
+        floor->port = source->sin_port;
+        floor->highestSequence = 0;
+    }
+    if (sequence > floor->highestSequence) {
+        floor->highestSequence = sequence;
+        floor->sessionId = sessionId;
+    }
+    if (sequence > newestSequence) {
+        newestSequence = sequence;
+    }
+}
+
+// sliding window replay check per sender, only call once the message has been authenticated
+// (sessionId is authenticated with it, as part of the nonce, source is where the datagram came from)
+// returns 1 if sequence has not been seen before from sessionId, 0 if it is a replay, too old, or from a sender
+// that is refused
+int acceptSequence(const struct sockaddr_in* source, uint32_t sessionId, uint64_t sequence) {
+    ReplayFloor* floor = findReplayFloor(source);
+    ReplayWindow* w = findReplayWindow(sessionId);
+
+    if (w == NULL) {
+        w = newReplayWindow(floor, sessionId, sequence);
+        if (w == NULL) {
+            return 0;
+        }
+    }
+
+    // case: newest message so far, slide the window forward
+    if (sequence > w->highestSequence) {
+        uint64_t shift = sequence - w->highestSequence;
+        w->replayBitmap = shift >= REPLAY_WINDOW ? 0 : w->replayBitmap << shift;
+        w->replayBitmap |= 1;
+        w->highestSequence = sequence;
+    } else {
+        // case: older than the window
+        uint64_t age = w->highestSequence - sequence;
+        if (age >= REPLAY_WINDOW) {
+            return 0;
+        }
+
+        // case: inside the window, accept once
+        if (w->replayBitmap & ((uint64_t)1 << age)) {
+            return 0;
+        }
+        w->replayBitmap |= (uint64_t)1 << age;
+    }
+
+    raiseReplayFloor(floor, source, sessionId, sequence);
+    return 1;
+}
@@ -0,0 +1,23 @@
+#ifndef _CIPHER_H
+#define _CIPHER_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define CIPHER_KEY_LEN 32
+#define CIPHER_NONCE_LEN 12
+#define CIPHER_TAG_LEN 16
+
+// frames of a sender not seen before are rejected if it started (by its sequence numbers) longer ago than this
+#define REPLAY_MAX_SESSION_AGE (24 * 3600 * 1000000000ULL)
+
+void initCipher(char* keyFile);
+void destroyCipher();
+int isEncryptionEnabled();
+
+int encryptPayload(const uint8_t nonce[CIPHER_NONCE_LEN], const char* aad, int aadLen, char* payload, int payloadLen, char* tag);
+int decryptPayload(const uint8_t nonce[CIPHER_NONCE_LEN], const char* aad, int aadLen, char* payload, int payloadLen, const char* tag);
+void resetReplayWindows(uint64_t start);
+int acceptSequence(const struct sockaddr_in* source, uint32_t sessionId, uint64_t sequence);
+
+#endif
@@ -0,0 +1,281 @@
+// References:
+// LZ4 Block Format Description (lz4/doc/lz4_Block_format.md)
+
+// COMPRESSION
+// LZ4 block format compressor/decompressor for large messages
+// compressBlock is only called from senderThread, decompressBlock only from listenerThread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "compression.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5  // the last 5 bytes of a block are always literals
+#define MF_LIMIT 12      // the last match must start at least 12 bytes before the end of the block
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+
+// the compression context is reused across messages: positions are stored relative to
+// contextBase, which moves forward after every block so old entries become stale
+// instead of having to clear the whole table for every message
+static uint32_t hashTable[1 << HASH_LOG];
+static uint32_t contextBase = 1;
+
+static int compressionEnabled = 0;
+static int compressionThreshold = DEFAULT_COMPRESSION_THRESHOLD;
+
+// set by listenerThread once the remote client advertises that it accepts compressed frames
+static atomic_int peerCompression = 0;
+// senderThread sends a hello frame (advertising compression) before its next datagram: at start up, and again
+// when the remote client first advertises compression, as it may have missed the first hello
+static atomic_int helloDue = 0;
+
+void initCompression(int threshold) {
+    compressionEnabled = 1;
+    compressionThreshold = threshold;
+    atomic_store(&helloDue, 1);
+
+    memset(hashTable, 0, sizeof(hashTable));
+    contextBase = 1;
+}
+
+int isCompressionEnabled() {
+    return compressionEnabled;
+}
+
+int getCompressionThreshold() {
+    return compressionThreshold;
+}
+
+void setPeerCompression(int enabled) {
+    if (atomic_exchange(&peerCompression, enabled) == 0 && enabled) {
+        atomic_store(&helloDue, 1);
+    }
+}
+
+int peerAcceptsCompression() {
+    return atomic_load(&peerCompression);
+}
+
+// senderThread: whether a hello frame should be sent now (only answers yes once per request)
+int takeHelloDue() {
+    return compressionEnabled && atomic_exchange(&helloDue, 0);
+}
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// write an LZ4 length continuation (255, 255, ..., remainder)
+static uint8_t* writeLength(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// LZ4 sequences of src into dst, with the hash table entries of this block stored relative to contextBase
+// returns the compressed size, or -1 if the result does not fit in dstCapacity
+static int encodeBlock(const char* src, int srcLen, char* dst, int dstCapacity) {
+    const uint8_t* base = (const uint8_t*)src;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    const uint8_t* end = base + srcLen;
+    const uint8_t* mfLimit = end - MF_LIMIT;
+    const uint8_t* matchLimit = end - LAST_LITERALS;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + dstCapacity;
+
+    // blocks too small to contain a match are stored as literals only
+    if (srcLen >= MF_LIMIT + 1) {
+        while (ip < mfLimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t hash = hashSequence(sequence);
+            uint32_t stored = hashTable[hash];
+            hashTable[hash] = contextBase + (uint32_t)(ip - base);
+
+            // skip stale entries from previous messages, far matches and hash collisions
+            if (stored < contextBase) {
+                ip++;
+                continue;
+            }
+
+            // case: not a position before ip in this block (never read past the input)
+            if (stored - contextBase >= (uint32_t)(ip - base)) {
+                ip++;
+                continue;
+            }
+
+            const uint8_t* ref = base + (stored - contextBase);
+            if (ip - ref > MAX_OFFSET || read32(ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            // extend the match backwards into the pending literals
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            // extend the match forwards
+            const uint8_t* matchEnd = ip + MIN_MATCH;
+            const uint8_t* refEnd = ref + MIN_MATCH;
+            while (matchEnd < matchLimit && *matchEnd == *refEnd) {
+                matchEnd++;
+                refEnd++;
+            }
+
+            size_t literalLen = ip - anchor;
+            size_t matchLen = matchEnd - ip - MIN_MATCH;
+
+            // case: sequence does not fit in dst
+            if (op + 1 + literalLen / 255 + 1 + literalLen + 2 + matchLen / 255 + 1 > oend) {
+                return -1;
+            }
+
+            // token: high nibble = literal length, low nibble = match length
+            uint8_t* token = op++;
+            *token = (uint8_t)((literalLen >= 15 ? 15 : literalLen) << 4);
+            if (literalLen >= 15) {
+                op = writeLength(op, literalLen - 15);
+            }
+            memcpy(op, anchor, literalLen);
+            op += literalLen;
+
+            // little endian match offset
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)(matchLen >= 15 ? 15 : matchLen);
+            if (matchLen >= 15) {
+                op = writeLength(op, matchLen - 15);
+            }
+
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+
+    // last sequence: remaining literals only
+    size_t literalLen = end - anchor;
+    if (op + 1 + literalLen / 255 + 1 + literalLen > oend) {
+        return -1;
+    }
+
+    uint8_t* token = op++;
+    *token = (uint8_t)((literalLen >= 15 ? 15 : literalLen) << 4);
+    if (literalLen >= 15) {
+        op = writeLength(op, literalLen - 15);
+    }
+    memcpy(op, anchor, literalLen);
+    op += literalLen;
+
+    return (int)(op - (uint8_t*)dst);
+}
+
+// compress src into dst using the LZ4 block format
+// returns the compressed size, or -1 if the result does not fit in dstCapacity
+int compressBlock(const char* src, int srcLen, char* dst, int dstCapacity) {
+    // reset the context if the next block could overflow the stored positions
+    if (contextBase > UINT32_MAX - (uint32_t)srcLen - 2 * (MAX_OFFSET + 1)) {
+        memset(hashTable, 0, sizeof(hashTable));
+        contextBase = 1;
+    }
+
+    int res = encodeBlock(src, srcLen, dst, dstCapacity);
+
+    // move the context forward so entries from this block are stale for the next one
+    // (also when the block did not fit: its entries are in the table all the same)
+    contextBase += (uint32_t)srcLen + MAX_OFFSET + 1;
+
+    return res;
+}
+
+// decompress an LZ4 block from src into dst
+// returns the decompressed size, or -1 if the block is malformed or does not fit in dstCapacity
+int decompressBlock(const char* src, int srcLen, char* dst, int dstCapacity) {
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* iend = ip + srcLen;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* oend = op + dstCapacity;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        // literal length
+        size_t literalLen = token >> 4;
+        if (literalLen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                literalLen += b;
+            } while (b == 255);
+        }
+
+        if (literalLen > (size_t)(iend - ip) || literalLen > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+
+        // the last sequence has no match
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)) {
+            return -1;
+        }
+
+        // match length
+        size_t matchLen = token & 15;
+        if (matchLen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += MIN_MATCH;
+
+        if (matchLen > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        // byte by byte copy since the match may overlap the bytes being written
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+
+    return (int)(op - (uint8_t*)dst);
+}
@@ -0,0 +1,21 @@
+#ifndef _COMPRESSION_H
+#define _COMPRESSION_H
+
+// default size (in bytes) below which messages are sent uncompressed
+#define DEFAULT_COMPRESSION_THRESHOLD 512
+
+// worst case size of a compressed block of srcLen bytes
+#define COMPRESS_BOUND(srcLen) ((srcLen) + ((srcLen) / 255) + 16)
+
+void initCompression(int threshold);
+int isCompressionEnabled();
+int getCompressionThreshold();
+
+void setPeerCompression(int enabled);
+int peerAcceptsCompression();
+int takeHelloDue();
+
+int compressBlock(const char* src, int srcLen, char* dst, int dstCapacity);
+int decompressBlock(const char* src, int srcLen, char* dst, int dstCapacity);
+
+#endif
@@ -0,0 +1,170 @@
+// CONFIG
+// tunable sizes, read by the modules when they start, and the configuration file reader
+// a configuration file holds one long option per line, without the dashes: "compress-threshold = 1024", "pipe" or
+// "thread = listener:cpu=1", '#' starts a comment
+// its settings are applied where --config appears on the command line, so options after it override them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "threadManager.h"
+#include "pipeMode.h"
+#include "frame.h"
+
+#define MAX_CONFIG_LINE 1024
+
+static Config config = {
+    .maxMessageLen = MAX_MESSAGE_LEN,
+    .inputQueueCapacity = DEFAULT_INPUT_QUEUE_CAPACITY,
+    .outputQueueCapacity = DEFAULT_OUTPUT_QUEUE_CAPACITY,
+    .receiveBufferSize = 0,
+    .sendBufferSize = 0,
+    .pipeBufferSize = DEFAULT_PIPE_BUFFER_SIZE
+};
+
+Config* getConfig() {
+    return &config;
+}
+
+// parse BYTES[k|m] into value, returns -1 if it is not a number between min and max
+int parseSize(const char* text, long min, long max, int* value) {
+    char* end;
+    long long size;
+
+    errno = 0;
+    size = strtoll(text, &end, 10);
+    if (end == text || errno == ERANGE || size < 0 || size > max) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+
+    if (*end != '\0' || size < min || size > max) {
+        return -1;
+    }
+    *value = size;
+    return 0;
+}
+
+// parse a plain number (a count or a time) into value, returns -1 if it is not a number between min and max
+int parseNumber(const char* text, long min, long max, int* value) {
+    char* end;
+    long number;
+
+    errno = 0;
+    number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || number < min || number > max) {
+        return -1;
+    }
+    *value = number;
+    return 0;
+}
+
+// start up: check the settings against each other, returns -1 (after printing the problem) if they do not fit
+int validateConfig() {
+    if (config.pipeBufferSize < PIPE_LENGTH_PREFIX + config.maxMessageLen) {
+        fprintf(stderr, "config: pipe-buffer (%d bytes) must hold a message of max-message-length (%d bytes) and its length prefix\n",
+            config.pipeBufferSize, config.maxMessageLen);
+        return -1;
+    }
+    return 0;
+}
+
+// set SO_RCVBUF or SO_SNDBUF, and say so if the kernel gave less than asked for
+// (it doubles the value for its own bookkeeping and caps it at net.core.rmem_max / wmem_max)
+void setSocketBufferSize(int sockfd, int option, int size) {
+    const char* name = option == SO_RCVBUF ? "receive" : "send";
+    int actual;
+    socklen_t actualLen = sizeof(actual);
+
+    if (setsockopt(sockfd, SOL_SOCKET, option, &size, sizeof(size)) == -1) {
+        fprintf(stderr, "config: could not set the socket %s buffer size: ", name);
+        perror(NULL);
+        return;
+    }
+
+    if (getsockopt(sockfd, SOL_SOCKET, option, &actual, &actualLen) == 0 && actual / 2 < size) {
+        fprintf(stderr, "config: socket %s buffer is %d bytes instead of %d (raise net.core.%cmem_max)\n",
+            name, actual / 2, size, option == SO_RCVBUF ? 'r' : 'w');
+    }
+}
+
+static char* trim(char* text) {
+    char* end = text + strlen(text);
+
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    while (end > text && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return text;
+}
+
+// apply every setting in path through applyOption, options = the long options that may be set
+// returns -1 (after printing the problem and its line) if the file cannot be read or holds an invalid setting
+int readConfigFile(const char* path, const struct option* options, APPLY_OPTION_FN applyOption) {
+    char line[MAX_CONFIG_LINE];
+    int lineNumber = 0;
+    int res = 0;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror("config: could not open configuration file");
+        return -1;
+    }
+
+    while (res == 0 && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+
+        char* comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        // name, or name = value (the value may contain '=' itself)
+        char* value = strchr(line, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+            value = trim(value);
+        }
+        char* name = trim(line);
+        if (*name == '\0' && value == NULL) {
+            continue;
+        }
+
+        const struct option* option = options;
+        while (option->name != NULL && strcmp(option->name, name) != 0) {
+            option++;
+        }
+
+        if (option->name == NULL) {
+            fprintf(stderr, "config: %s:%d: unknown setting '%s'\n", path, lineNumber, name);
+            res = -1;
+        } else if (option->has_arg == required_argument && (value == NULL || *value == '\0')) {
+            fprintf(stderr, "config: %s:%d: '%s' needs a value\n", path, lineNumber, name);
+            res = -1;
+        } else if (option->has_arg == no_argument && value != NULL) {
+            fprintf(stderr, "config: %s:%d: '%s' does not take a value\n", path, lineNumber, name);
+            res = -1;
+        } else if (applyOption(option->val, value != NULL ? strdup(value) : NULL) == -1) {
+            // values are kept for the whole session (e.g. file names)
+            fprintf(stderr, "config: %s:%d: invalid setting '%s'\n", path, lineNumber, name);
+            res = -1;
+        }
+    }
+
+    fclose(file);
+    return res;
+}
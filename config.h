@@ -0,0 +1,40 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <getopt.h>
+
+// longest message: a datagram (65507 bytes for UDP over IPv4) minus the "Remote Client: " header (15) and the '\0'
+#define MAX_MESSAGE_LEN 65491
+
+// upper bounds for the other settings
+#define MAX_QUEUE_CAPACITY (1024 * 1024)
+#define MAX_SOCKET_BUFFER_SIZE (1024 * 1024 * 1024)
+#define MAX_PIPE_BUFFER_SIZE (1024 * 1024 * 1024)
+#define MAX_INTERVAL_MS (24 * 3600 * 1000)      // --heartbeat, --peer-timeout, --receipts: a day
+#define MAX_IDLE_TIMEOUT (30 * 24 * 3600)       // --idle-timeout: 30 days in seconds
+#define MAX_DELAY_MICROS (1000 * 1000)          // --busy-poll, --flush-delay: a second
+#define MAX_RATE_LIMIT (1000 * 1000 * 1000)     // --rate-limit (messages) and --bandwidth-limit (bytes) per second
+
+// settings the modules read at start up, set by the command line options and configuration files
+typedef struct Config_s Config;
+struct Config_s {
+    int maxMessageLen;       // longest message read from the keyboard or accepted from the network
+    int inputQueueCapacity;  // messages waiting to be sent
+    int outputQueueCapacity; // messages waiting to be written
+    int receiveBufferSize;   // SO_RCVBUF of the listening socket in bytes, 0 = system default
+    int sendBufferSize;      // SO_SNDBUF of the sending socket in bytes, 0 = system default
+    int pipeBufferSize;      // pipe mode: stdin is read and stdout written in blocks of up to this many bytes
+};
+
+Config* getConfig();
+int parseSize(const char* text, long min, long max, int* value);
+int parseNumber(const char* text, long min, long max, int* value);
+int validateConfig();
+void setSocketBufferSize(int sockfd, int option, int size);
+
+// called for each setting of a configuration file with the option's val and its value (NULL for flags),
+// returns -1 if the value is invalid
+typedef int (*APPLY_OPTION_FN)(int opt, char* value);
+int readConfigFile(const char* path, const struct option* options, APPLY_OPTION_FN applyOption);
+
+#endif
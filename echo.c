@@ -0,0 +1,79 @@
+// LOCAL ECHO
+// with --echo, writerThread prints the messages typed at the keyboard too, in time order with the received ones
+// - keyboardThread adds a sent message to the echo queue as well as inputQueue: the same buffer, with a second
+//   reference (see freeManager.c), linked through its own echoNext link, so echoing copies nothing
+// - the echo queue is only as long as outputQueue and a message that does not fit is not echoed, so a slow
+//   terminal never holds up keyboardThread or UDPClient
+// - both queues are in time order (enqueueTime, stamped as a message is added), writerThread merges them by
+//   always taking the older of the two front messages
+
+#include <stdio.h>
+#include <string.h>
+
+#include "echo.h"
+#include "threadManager.h"
+#include "latencyReport.h"
+
+static int echoEnabled = 0;
+static EchoQueue echoQueue;
+
+// --echo: capacity = most messages waiting to be echoed, call before the threads start
+void initEcho(int capacity) {
+    EchoQueue_init(&echoQueue, capacity);
+    watchEchoQueue(&echoQueue);
+    echoEnabled = 1;
+}
+
+int isEchoEnabled() {
+    return echoEnabled;
+}
+
+// keyboardThread: echo message, which it is about to add to inputQueue
+void echoMessage(char* message) {
+    // case: "!" ends the session, it is not shown
+    if (!echoEnabled || getMessageInfo(message)->endOfSession) {
+        return;
+    }
+
+    getMessageInfo(message)->enqueueTime = realtimeNanoseconds();
+    if (addEcho(&echoQueue, holdMessage(message)) == MESSAGE_QUEUE_FAIL) {
+        releaseMessage(message);
+        return;
+    }
+    signalOutputWriter();
+}
+
+// writerThread: the oldest message of outputQueue and the echo queue, NULL if both are empty
+// *echoed is set if it came from the echo queue
+char* nextOutputMessage(MessageQueue* outputQueue, int* echoed) {
+    *echoed = 0;
+    if (!echoEnabled) {
+        return getMessage(outputQueue);
+    }
+
+    // writerThread is the only consumer of both queues, so the front messages stay put until it takes them
+    char* received = peekMessage(outputQueue);
+    char* sent = peekEcho(&echoQueue);
+    if (sent != NULL && (received == NULL || getMessageInfo(sent)->enqueueTime < getMessageInfo(received)->enqueueTime)) {
+        *echoed = 1;
+        return getEcho(&echoQueue);
+    }
+    return received != NULL ? getMessage(outputQueue) : NULL;
+}
+
+int countOutputMessages(MessageQueue* outputQueue) {
+    return countMessages(outputQueue) + (echoEnabled ? countEchoes(&echoQueue) : 0);
+}
+
+// release the messages that were not echoed (once writerThread has been joined)
+void closeEcho() {
+    char* message;
+
+    if (!echoEnabled) {
+        return;
+    }
+    while ((message = getEcho(&echoQueue)) != NULL) {
+        releaseMessage(message);
+    }
+    watchEchoQueue(NULL);
+}
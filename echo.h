@@ -0,0 +1,16 @@
+#ifndef _ECHO_H
+#define _ECHO_H
+
+#include "freeManager.h"
+
+// printed in front of an echoed message, like "Remote Client: " in front of a received one
+#define ECHO_HEADER "You: "
+
+void initEcho(int capacity);
+int isEchoEnabled();
+void echoMessage(char* message);
+char* nextOutputMessage(MessageQueue* outputQueue, int* echoed);
+int countOutputMessages(MessageQueue* outputQueue);
+void closeEcho();
+
+#endif
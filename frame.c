@@ -0,0 +1,303 @@
+// FRAME
+// optional wire format for datagrams:
+// [FrameHeader][send time if timestamped][receipt id if requested][payload][authentication tag if encrypted]
+// plain text datagrams are still accepted (unless encryption is enabled) so framed and unframed peers can talk to each other
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+
+#include "frame.h"
+#include "compression.h"
+#include "cipher.h"
+#include "latencyReport.h"
+#include "heartbeat.h"
+#include "receipts.h"
+
+static uint32_t sessionId;
+// frames are sent by senderThread (messages) and listenerThread (heartbeats)
+static atomic_uint_fast64_t nextSequence;
+
+// start up: pick the session id and first sequence number
+void initFraming() {
+    struct timespec now;
+
+    if (getrandom(&sessionId, sizeof(sessionId), 0) != sizeof(sessionId)) {
+        perror("frame: getrandom() error");
+        exit(-1);
+    }
+
+    // sequence numbers start at the wall clock time (in ns), so a restarted client continues above its old numbers
+    // and the replay check (see cipher.c) can reject frames from its older sessions
+    clock_gettime(CLOCK_REALTIME, &now);
+    atomic_store(&nextSequence, (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+// frames are only sent when a feature that needs them is enabled
+int isFramingEnabled() {
+    return isCompressionEnabled() || isEncryptionEnabled() || isLatencyReportEnabled() || isHeartbeatEnabled()
+        || isReceiptsEnabled();
+}
+
+// whether message is sent in a frame: always when a feature needs every message framed, but with only compression
+// enabled just the messages that are compressed, so plain text goes out until the remote client advertises
+// compression (see compression.c) and messages below the threshold stay readable for peers without framing
+// text that would be read as something else in plain text (a "!\n" message from --pipe, or bytes that start like a frame)
+// is always framed
+int isMessageFramed(const char* message, int length) {
+    if ((length == 2 && !memcmp(message, "!\n", 2)) || isFrame(message, length)) {
+        return 1;
+    }
+    if (isEncryptionEnabled() || isLatencyReportEnabled() || isHeartbeatEnabled() || isReceiptsEnabled()) {
+        return 1;
+    }
+    return isCompressionEnabled() && peerAcceptsCompression() && length >= getCompressionThreshold();
+}
+
+static void buildNonce(uint8_t nonce[CIPHER_NONCE_LEN], const FrameHeader* header) {
+    memcpy(nonce, &header->sessionId, sizeof(header->sessionId));
+    memcpy(nonce + sizeof(header->sessionId), &header->sequence, sizeof(header->sequence));
+}
+
+// copy header into frame, followed by the send time if the frame is timestamped and the receipt id if it has one
+// the send time is taken last, so it is as close to sendto() as the encryption allows
+static void writeHeader(char* frame, const FrameHeader* header, uint32_t receiptId) {
+    int headerLen = sizeof(FrameHeader);
+
+    memcpy(frame, header, sizeof(FrameHeader));
+
+    if (header->flags & FRAME_TIMESTAMPED) {
+        uint64_t sendTime = htobe64(realtimeNanoseconds());
+        memcpy(frame + headerLen, &sendTime, FRAME_TIMESTAMP_LEN);
+        headerLen += FRAME_TIMESTAMP_LEN;
+    }
+
+    if (header->flags & FRAME_RECEIPT_ID) {
+        receiptId = htonl(receiptId);
+        memcpy(frame + headerLen, &receiptId, FRAME_RECEIPT_ID_LEN);
+    }
+}
+
+// wrap message into frame, compressing the payload if both sides have agreed to it, then encrypting it
+// (receiptId is only written if flags has FRAME_RECEIPT_ID)
+// returns the frame length, or -1 if the frame does not fit in frameCapacity
+static int encodeFrameWithFlags(const char* message, int length, char* frame, int frameCapacity, uint8_t flags, uint8_t control, uint32_t receiptId) {
+    FrameHeader header;
+    int headerLen = sizeof(FrameHeader) + (isLatencyReportEnabled() ? FRAME_TIMESTAMP_LEN : 0)
+        + ((flags & FRAME_RECEIPT_ID) ? FRAME_RECEIPT_ID_LEN : 0);
+    int tagLen = isEncryptionEnabled() ? CIPHER_TAG_LEN : 0;
+    int payloadCapacity = frameCapacity - headerLen - tagLen;
+    int payloadLen = -1;
+
+    if (payloadCapacity < 0) {
+        return -1;
+    }
+
+    header.magic = htons(FRAME_MAGIC);
+    header.flags = flags;
+    header.control = control;
+    header.length = htonl((uint32_t)length);
+    header.sessionId = htonl(sessionId);
+    header.sequence = htobe64(atomic_fetch_add(&nextSequence, 1));
+
+    if (isLatencyReportEnabled()) {
+        header.flags |= FRAME_TIMESTAMPED;
+    }
+
+    if (isCompressionEnabled()) {
+        // advertise compression so the remote client can start compressing its messages
+        header.flags |= FRAME_CAN_COMPRESS;
+
+        // small messages are not worth the latency (and heartbeats, receipts and hellos are tiny)
+        if (!(flags & (FRAME_HEARTBEAT | FRAME_RECEIPTS | FRAME_HELLO)) && length >= getCompressionThreshold() && peerAcceptsCompression()) {
+            payloadLen = compressBlock(message, length, frame + headerLen, payloadCapacity);
+
+            // only keep the compressed payload if it actually saves space
+            if (payloadLen != -1 && payloadLen < length) {
+                header.flags |= FRAME_COMPRESSED;
+            } else {
+                payloadLen = -1;
+            }
+        }
+    }
+
+    // case: message is sent as is
+    if (payloadLen == -1) {
+        if (length > payloadCapacity) {
+            return -1;
+        }
+        memcpy(frame + headerLen, message, length);
+        payloadLen = length;
+    }
+
+    if (isEncryptionEnabled()) {
+        uint8_t nonce[CIPHER_NONCE_LEN];
+
+        // the header is authenticated as associated data, so it has to be final before encrypting
+        header.flags |= FRAME_ENCRYPTED;
+        writeHeader(frame, &header, receiptId);
+        buildNonce(nonce, &header);
+
+        if (encryptPayload(nonce, frame, headerLen, frame + headerLen, payloadLen, frame + headerLen + payloadLen) == -1) {
+            fprintf(stderr, "frame: could not encrypt message\n");
+            return -1;
+        }
+        return headerLen + payloadLen + tagLen;
+    }
+
+    writeHeader(frame, &header, receiptId);
+    return headerLen + payloadLen;
+}
+
+int encodeFrame(const char* message, int length, char* frame, int frameCapacity) {
+    return encodeFrameWithFlags(message, length, frame, frameCapacity, 0, 0, 0);
+}
+
+// message frame asking the remote client to acknowledge receiptId (see receipts.c)
+int encodeReceiptFrame(const char* message, int length, uint32_t receiptId, char* frame, int frameCapacity) {
+    return encodeFrameWithFlags(message, length, frame, frameCapacity, FRAME_RECEIPT_ID, 0, receiptId);
+}
+
+int encodeHeartbeatFrame(const char* heartbeat, int length, char* frame, int frameCapacity) {
+    return encodeFrameWithFlags(heartbeat, length, frame, frameCapacity, FRAME_HEARTBEAT, 0, 0);
+}
+
+int encodeReceiptsFrame(const char* receipts, int length, char* frame, int frameCapacity) {
+    return encodeFrameWithFlags(receipts, length, frame, frameCapacity, FRAME_RECEIPTS, 0, 0);
+}
+
+// hello: a frame without a message, sent so the remote client sees this client's flags (FRAME_CAN_COMPRESS)
+int encodeHelloFrame(char* frame, int frameCapacity) {
+    return encodeFrameWithFlags("", 0, frame, frameCapacity, FRAME_HELLO, 0, 0);
+}
+
+// the "!\n" that ends the session, framed when encryption is enabled (the remote client drops plain text then)
+// and otherwise sent as plain text (see isEndOfSession), returns the datagram length or -1 if it does not fit
+int encodeEndOfSessionFrame(char* frame, int frameCapacity) {
+    if (!isEncryptionEnabled()) {
+        if (frameCapacity < 2) {
+            return -1;
+        }
+        memcpy(frame, "!\n", 2);
+        return 2;
+    }
+    return encodeFrameWithFlags("!\n", 2, frame, frameCapacity, 0, FRAME_END_OF_SESSION, 0);
+}
+
+// whether a received datagram (unwrapped into payload and info) ends the session: a frame marked
+// FRAME_END_OF_SESSION, or "!\n" in plain text, which isMessageFramed never sends as a message
+int isEndOfSession(const char* datagram, int numbytes, const char* payload, int payloadLen, const FrameInfo* info) {
+    if (isFrame(datagram, numbytes)) {
+        return (info->control & FRAME_END_OF_SESSION) != 0;
+    }
+    return payloadLen == 2 && !memcmp(payload, "!\n", 2);
+}
+
+int isFrame(const char* datagram, int numbytes) {
+    uint16_t magic;
+
+    if (numbytes < (int)sizeof(FrameHeader)) {
+        return 0;
+    }
+
+    memcpy(&magic, datagram, sizeof(magic));
+    return ntohs(magic) == FRAME_MAGIC;
+}
+
+// whether datagram looks like a heartbeat, receipts or hello frame (from its header, before it is authenticated)
+int isControlFrame(const char* datagram, int numbytes) {
+    FrameHeader header;
+
+    if (!isFrame(datagram, numbytes) || numbytes > FRAME_CONTROL_MAX_LEN) {
+        return 0;
+    }
+    memcpy(&header, datagram, sizeof(header));
+    return (header.flags & (FRAME_HEARTBEAT | FRAME_RECEIPTS | FRAME_HELLO)) != 0;
+}
+
+// unwrap frame into message, decrypting the payload in place in datagram
+// info is set to the frame's flags, send time (0 if the frame is not timestamped) and receipt id
+// (source is where the datagram came from, for the replay check)
+// returns the message length, or -1 if the frame is malformed, forged or replayed
+int decodeFrame(char* datagram, int numbytes, const struct sockaddr_in* source, char* message, int messageCapacity, FrameInfo* info) {
+    FrameHeader header;
+    int headerLen = sizeof(FrameHeader);
+
+    memcpy(&header, datagram, headerLen);
+    info->flags = header.flags;
+    info->control = header.control;
+    info->sendTime = 0;
+    info->receiptId = 0;
+
+    if (header.flags & FRAME_TIMESTAMPED) {
+        if (numbytes < headerLen + FRAME_TIMESTAMP_LEN) {
+            return -1;
+        }
+        memcpy(&info->sendTime, datagram + headerLen, FRAME_TIMESTAMP_LEN);
+        info->sendTime = be64toh(info->sendTime);
+        headerLen += FRAME_TIMESTAMP_LEN;
+    }
+
+    if (header.flags & FRAME_RECEIPT_ID) {
+        if (numbytes < headerLen + FRAME_RECEIPT_ID_LEN) {
+            return -1;
+        }
+        memcpy(&info->receiptId, datagram + headerLen, FRAME_RECEIPT_ID_LEN);
+        info->receiptId = ntohl(info->receiptId);
+        headerLen += FRAME_RECEIPT_ID_LEN;
+    }
+
+    int length = (int)ntohl(header.length);
+    char* payload = datagram + headerLen;
+    int payloadLen = numbytes - headerLen;
+
+    if (length < 0 || length > messageCapacity) {
+        return -1;
+    }
+
+    // with encryption enabled, only authenticated frames are accepted
+    if (isEncryptionEnabled() != ((header.flags & FRAME_ENCRYPTED) != 0)) {
+        return -1;
+    }
+
+    if (isEncryptionEnabled()) {
+        uint8_t nonce[CIPHER_NONCE_LEN];
+
+        payloadLen -= CIPHER_TAG_LEN;
+        if (payloadLen < 0) {
+            return -1;
+        }
+
+        buildNonce(nonce, &header);
+        if (decryptPayload(nonce, datagram, headerLen, payload, payloadLen, payload + payloadLen) == -1) {
+            return -1;
+        }
+
+        if (!acceptSequence(source, ntohl(header.sessionId), be64toh(header.sequence))) {
+            return -1;
+        }
+    }
+
+    // remember that the remote client accepts compressed messages
+    if ((header.flags & FRAME_CAN_COMPRESS) && !peerAcceptsCompression()) {
+        setPeerCompression(1);
+    }
+
+    if (header.flags & FRAME_COMPRESSED) {
+        if (decompressBlock(payload, payloadLen, message, length) != length) {
+            return -1;
+        }
+        return length;
+    }
+
+    if (payloadLen != length) {
+        return -1;
+    }
+    memcpy(message, payload, length);
+    return length;
+}
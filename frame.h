@@ -0,0 +1,71 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "cipher.h"
+
+// limit for UDP datagram under IPv4 is 65507
+#define MAX_LEN_DATAGRAM 65507
+
+// first two bytes of every framed datagram
+#define FRAME_MAGIC 0x5AA7
+
+// frame flags
+#define FRAME_COMPRESSED 0x01     // payload is an LZ4 block
+#define FRAME_CAN_COMPRESS 0x02   // sender accepts compressed frames
+#define FRAME_ENCRYPTED 0x04      // payload is encrypted and followed by an authentication tag
+#define FRAME_TIMESTAMPED 0x08    // header is followed by the sender's send time (uint64_t, CLOCK_REALTIME in ns)
+#define FRAME_HEARTBEAT 0x10      // payload is a heartbeat (see heartbeat.c), not a message
+#define FRAME_RECEIPT_ID 0x20     // send time (if any) is followed by the message id to acknowledge (uint32_t)
+#define FRAME_RECEIPTS 0x40       // payload is a batch of acknowledged message ids (see receipts.c), not a message
+#define FRAME_HELLO 0x80          // empty frame that only advertises the sender's flags (see compression.c)
+
+// frame control bits (FrameHeader.control)
+#define FRAME_END_OF_SESSION 0x01 // message is the "!\n" that ends the session, a framed "!\n" without it is just text
+
+#define FRAME_TIMESTAMP_LEN 8
+#define FRAME_RECEIPT_ID_LEN 4
+
+// heartbeat, receipts and hello frames are all smaller than this (see isControlFrame)
+#define FRAME_CONTROL_MAX_LEN 512
+
+// header prepended to each datagram when framing is enabled
+typedef struct FrameHeader_s FrameHeader;
+struct __attribute__((packed)) FrameHeader_s {
+    uint16_t magic;
+    uint8_t flags;
+    uint8_t control;    // FRAME_END_OF_SESSION or 0
+    uint32_t length;    // length of the original (uncompressed) message
+    uint32_t sessionId; // random per run, together with sequence forms the encryption nonce
+    uint64_t sequence;  // increases by one per frame sent
+};
+
+// what decodeFrame found out about a frame besides its message
+typedef struct FrameInfo_s FrameInfo;
+struct FrameInfo_s {
+    uint64_t sendTime;  // sender's send time, 0 if the frame is not timestamped
+    uint32_t receiptId; // message id to acknowledge, only set if flags has FRAME_RECEIPT_ID
+    uint8_t flags;
+    uint8_t control;
+};
+
+// bytes added to each message by framing (header, send time, receipt id and authentication tag)
+#define FRAME_OVERHEAD (sizeof(FrameHeader) + FRAME_TIMESTAMP_LEN + FRAME_RECEIPT_ID_LEN + CIPHER_TAG_LEN)
+
+void initFraming();
+int isFramingEnabled();
+int isMessageFramed(const char* message, int length);
+int encodeFrame(const char* message, int length, char* frame, int frameCapacity);
+int encodeReceiptFrame(const char* message, int length, uint32_t receiptId, char* frame, int frameCapacity);
+int encodeHeartbeatFrame(const char* heartbeat, int length, char* frame, int frameCapacity);
+int encodeReceiptsFrame(const char* receipts, int length, char* frame, int frameCapacity);
+int encodeHelloFrame(char* frame, int frameCapacity);
+int encodeEndOfSessionFrame(char* frame, int frameCapacity);
+int isEndOfSession(const char* datagram, int numbytes, const char* payload, int payloadLen, const FrameInfo* info);
+int isFrame(const char* datagram, int numbytes);
+int isControlFrame(const char* datagram, int numbytes);
+int decodeFrame(char* datagram, int numbytes, const struct sockaddr_in* source, char* message, int messageCapacity, FrameInfo* info);
+
+#endif
@@ -1,11 +1,168 @@
+// References:
+// cppreference - memory_order (release on the decrement, acquire before the buffer is reused)
+
+// FREE MANAGER
+// messages are shared between the pipeline stages without copies: a message is written only by the thread that
+// allocates it, before it is queued, and is read-only from then on, so any number of stages can hold it at once
+// - allocMessage returns a message holding one reference, holdMessage adds one, releaseMessage drops one
+// - the counts are atomic, the last releaseMessage (from whichever thread) returns the buffer to the pool
+// - free buffers are kept per power of two size class, so the steady state of a chat allocates nothing
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+
+#include "freeManager.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+// a released buffer is poisoned while it waits in the pool, so AddressSanitizer still reports use after release
+#define POISON_BUFFER(info, size) ASAN_POISON_MEMORY_REGION((info) + 1, (size) - sizeof(MessageInfo))
+#define UNPOISON_BUFFER(info, size) ASAN_UNPOISON_MEMORY_REGION((info) + 1, (size) - sizeof(MessageInfo))
+#else
+#define POISON_BUFFER(info, size)
+#define UNPOISON_BUFFER(info, size)
+#endif
+
+// free buffers of one size class, linked through MessageInfo.next
+typedef struct SizeClass_s SizeClass;
+struct SizeClass_s {
+    pthread_mutex_t mutex;
+    MessageInfo* free;
+    int count;
+};
+
+static SizeClass pool[MESSAGE_POOL_CLASSES] = {
+    [0 ... MESSAGE_POOL_CLASSES - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static int classSize(int sizeClass) {
+    return MESSAGE_POOL_MIN_SIZE << sizeClass;
+}
+
+// smallest size class that fits size bytes, -1 if it is larger than every class
+static int findSizeClass(size_t size) {
+    if (size <= MESSAGE_POOL_MIN_SIZE) {
+        return 0;
+    }
+
+    int sizeClass = (int)(8 * sizeof(unsigned int)) - __builtin_clz((unsigned int)(size - 1)) - __builtin_ctz(MESSAGE_POOL_MIN_SIZE);
+    return sizeClass < MESSAGE_POOL_CLASSES ? sizeClass : -1;
+}
+
+// allocate a message with room for length characters and the '\0', and an empty MessageInfo in front of it
+// the caller holds the only reference
+char* allocMessage(int length) {
+    size_t size = sizeof(MessageInfo) + length + 1;
+    int sizeClass = findSizeClass(size);
+    MessageInfo* info = NULL;
+
+    if (sizeClass != -1) {
+        SizeClass* c = &pool[sizeClass];
+        size = classSize(sizeClass);
+
+        pthread_mutex_lock(&c->mutex);
+        info = c->free;
+        if (info != NULL) {
+            c->free = info->next;
+            c->count--;
+        }
+        pthread_mutex_unlock(&c->mutex);
+
+        if (info != NULL) {
+            UNPOISON_BUFFER(info, size);
+        }
+    }
+
+    if (info == NULL) {
+        info = malloc(size);
+        if (info == NULL) {
+            fprintf(stderr, "freeManager: could not allocate message\n");
+            exit(-1);
+        }
+    }
+
+    memset(info, 0, sizeof(MessageInfo));
+    atomic_init(&info->refs, 1);
+    info->sizeClass = sizeClass;
+    info->length = length;
+    return (char *)(info + 1);
+}
+
+MessageInfo* getMessageInfo(char* message) {
+    return (MessageInfo *)message - 1;
+}
+
+char* getMessageText(MessageInfo* info) {
+    return (char *)(info + 1);
+}
+
+// take another reference on message, for a stage that keeps it after handing it on
+char* holdMessage(char* message) {
+    atomic_fetch_add_explicit(&getMessageInfo(message)->refs, 1, memory_order_relaxed);
+    return message;
+}
+
+// give back a buffer that no one references anymore
+static void recycleMessage(MessageInfo* info) {
+    if (info->sizeClass == -1) {
+        free(info);
+        return;
+    }
+
+    SizeClass* c = &pool[info->sizeClass];
+    int size = classSize(info->sizeClass);
+
+    pthread_mutex_lock(&c->mutex);
+    if (c->count < MESSAGE_POOL_CLASS_BYTES / size) {
+        POISON_BUFFER(info, size);
+        info->next = c->free;
+        c->free = info;
+        c->count++;
+        info = NULL;
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    // case: the class already caches enough buffers
+    free(info);
+}
+
+// drop a reference on message, the buffer goes back to the pool with the last one
+void releaseMessage(char* message) {
+    if (message == NULL) {
+        return;
+    }
+
+    MessageInfo* info = getMessageInfo(message);
+    if (atomic_fetch_sub_explicit(&info->refs, 1, memory_order_release) == 1) {
+        atomic_thread_fence(memory_order_acquire);
+        recycleMessage(info);
+    }
+}
+
+// release every message left in queue (once no thread uses it anymore)
+void releaseMessages(MessageQueue* queue) {
+    MessageInfo* info;
+
+    while ((info = MessageQueue_pop(queue)) != NULL) {
+        releaseMessage(getMessageText(info));
+    }
+}
 
-#include "list.h"
+// free the buffers cached in the pool (at exit, once every message was released)
+void destroyMessagePool() {
+    for (int i = 0; i < MESSAGE_POOL_CLASSES; i++) {
+        SizeClass* c = &pool[i];
 
-// free messages once removed from inputList/outputList
-void freeMessage(char *message) {
-    free(message);
-    message = NULL;
+        pthread_mutex_lock(&c->mutex);
+        while (c->free != NULL) {
+            MessageInfo* info = c->free;
+            UNPOISON_BUFFER(info, classSize(i));
+            c->free = info->next;
+            free(info);
+        }
+        c->count = 0;
+        pthread_mutex_unlock(&c->mutex);
+    }
 }
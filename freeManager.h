@@ -1,8 +1,48 @@
 #ifndef _FREE_MANAGER_H
 #define _FREE_MANAGER_H
 
-#include "list.h"
+#include <stdint.h>
+#include <stdatomic.h>
 
-void freeMessage(char *message);
+#include "queue.h"
 
-#endif
\ No newline at end of file
+// MESSAGE POOL
+// smallest and largest pooled allocation (MessageInfo, text and '\0'), one size class per power of two in between
+// larger messages are allocated and freed directly
+#define MESSAGE_POOL_MIN_SIZE 128
+#define MESSAGE_POOL_CLASSES 11
+// most bytes of free buffers kept per size class, the rest go back to malloc
+#define MESSAGE_POOL_CLASS_BYTES (1024*1024)
+
+// stored in front of every message allocated with allocMessage, hidden from code that only uses the text
+// it links the message into inputQueue/outputQueue, so queueing a message needs no other allocation
+// times are CLOCK_REALTIME in ns (0 = not known), only filled in when the latency report is enabled
+typedef struct MessageInfo_s MessageInfo;
+struct MessageInfo_s {
+    MessageInfo* next;    // next message in the queue
+    uint64_t sendTime;    // when the remote client framed the message
+    uint64_t kernelTime;  // when the kernel received the datagram
+    uint64_t receiveTime; // when listenerThread received it from the socket
+    uint64_t enqueueTime; // when listenerThread added it to outputQueue
+    MessageInfo* echoNext; // next message in the echo queue (--echo), so a sent message can be in both queues
+    atomic_int refs;      // references held on the message, it goes back to the pool when the last one is released
+    int sizeClass;        // pool size class, -1 if it was allocated directly
+    int length;           // length of the text, which may contain '\0' in pipe mode (allocMessage sets it to the length asked for)
+    int endOfSession;     // the message is the "!\n" that ends the session, not one typed or piped by the user
+};
+
+// queue of messages linked through their MessageInfo (see queue.h)
+DEFINE_QUEUE(MessageQueue, MessageInfo, next)
+
+// queue of sent messages waiting to be echoed, linked through their own link (see echo.c)
+DEFINE_QUEUE(EchoQueue, MessageInfo, echoNext)
+
+char* allocMessage(int length);
+MessageInfo* getMessageInfo(char* message);
+char* getMessageText(MessageInfo* info);
+char* holdMessage(char* message);
+void releaseMessage(char* message);
+void releaseMessages(MessageQueue* queue);
+void destroyMessagePool();
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _FUZZ_H
+#define _FUZZ_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// entry point of every fuzz target, called once per input by libFuzzer or by the standalone driver (fuzzMain.c)
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+// a failed check is a crash, so the fuzzing engine keeps the input that caused it
+#define FUZZ_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,242 @@
+// FUZZ MAIN
+// standalone driver for the fuzz targets when libFuzzer is not available (gcc builds, see "make fuzz")
+// - ./target file...               run each file once (reproduce a crash, replay a corpus)
+// - ./target -runs=N [file...]     run N generated inputs: mutations of the given files, or random bytes without any
+// - ./target < file                run stdin once (AFL style, e.g. afl-fuzz -- ./target)
+// options: -seed=S picks the random sequence, -max_len=L limits generated inputs (default 4096 bytes)
+// if an input crashes the target it is written to crash-<seed>-<run> first
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include "fuzz.h"
+
+#define DEFAULT_MAX_LEN 4096
+
+typedef struct Input_s Input;
+struct Input_s {
+    uint8_t* data;
+    size_t size;
+};
+
+// sanitizers call this before exiting on an error they found (weak: builds without sanitizers do not have it)
+extern void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+static const uint8_t* currentData;
+static size_t currentSize;
+static char crashName[64];
+
+// write the input that is running to crashName, only uses async-signal-safe calls
+static void saveCrash() {
+    int fd = open(crashName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    if (currentData != NULL && write(fd, currentData, currentSize) == -1) {
+        // nothing left to do about it
+    }
+    close(fd);
+    if (write(2, "fuzz: input written to ", 23) == -1 || write(2, crashName, strlen(crashName)) == -1 || write(2, "\n", 1) == -1) {
+        // same
+    }
+}
+
+static void crashHandler(int sig) {
+    saveCrash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static Input readInput(FILE* file, const char* name) {
+    Input input = { NULL, 0 };
+    size_t capacity = 0;
+
+    while (1) {
+        if (input.size == capacity) {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            input.data = realloc(input.data, capacity);
+            if (input.data == NULL) {
+                fprintf(stderr, "fuzz: out of memory\n");
+                exit(-1);
+            }
+        }
+
+        size_t n = fread(input.data + input.size, 1, capacity - input.size, file);
+        if (n == 0) {
+            break;
+        }
+        input.size += n;
+    }
+
+    if (ferror(file)) {
+        fprintf(stderr, "fuzz: could not read %s\n", name);
+        exit(-1);
+    }
+    return input;
+}
+
+static Input readFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(-1);
+    }
+
+    Input input = readInput(file, path);
+    fclose(file);
+    return input;
+}
+
+static void runInput(const uint8_t* data, size_t size) {
+    currentData = data;
+    currentSize = size;
+    LLVMFuzzerTestOneInput(data, size);
+    currentData = NULL;
+}
+
+// overwrite, insert or delete a few random bytes, or splice in a run of one byte (lengths, magic numbers)
+static size_t mutate(uint8_t* data, size_t size, size_t maxLen) {
+    int mutations = 1 + rand() % 8;
+
+    for (int i = 0; i < mutations; i++) {
+        size_t pos = size == 0 ? 0 : (size_t)rand() % size;
+
+        switch (rand() % 5) {
+            case 0: // overwrite
+                if (size > 0) {
+                    data[pos] = rand();
+                }
+                break;
+            case 1: // flip a bit
+                if (size > 0) {
+                    data[pos] ^= 1 << (rand() % 8);
+                }
+                break;
+            case 2: // insert
+                if (size < maxLen) {
+                    memmove(data + pos + 1, data + pos, size - pos);
+                    data[pos] = rand();
+                    size++;
+                }
+                break;
+            case 3: // delete
+                if (size > 0) {
+                    memmove(data + pos, data + pos + 1, size - pos - 1);
+                    size--;
+                }
+                break;
+            default: { // run of an interesting byte
+                static const uint8_t interesting[] = { 0x00, 0x01, 0x7f, 0x80, 0xff, '\n', '!' };
+                size_t run = 1 + rand() % 16;
+                uint8_t value = interesting[rand() % sizeof(interesting)];
+                for (size_t j = pos; j < size && j < pos + run; j++) {
+                    data[j] = value;
+                }
+                break;
+            }
+        }
+    }
+    return size;
+}
+
+int main(int argc, char* argv[]) {
+    long runs = -1;
+    unsigned int seed = time(NULL);
+    size_t maxLen = DEFAULT_MAX_LEN;
+    Input* corpus = NULL;
+    int corpusSize = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = strtoul(argv[i] + 6, NULL, 10);
+        } else if (strncmp(argv[i], "-max_len=", 9) == 0) {
+            maxLen = strtoul(argv[i] + 9, NULL, 10);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "fuzz: unknown option %s\n", argv[i]);
+            exit(-1);
+        } else {
+            corpus = realloc(corpus, (corpusSize + 1) * sizeof(Input));
+            if (corpus == NULL) {
+                fprintf(stderr, "fuzz: out of memory\n");
+                exit(-1);
+            }
+            corpus[corpusSize++] = readFile(argv[i]);
+        }
+    }
+
+    if (__sanitizer_set_death_callback != NULL) {
+        __sanitizer_set_death_callback(saveCrash);
+    }
+    signal(SIGSEGV, crashHandler);
+    signal(SIGBUS, crashHandler);
+    signal(SIGABRT, crashHandler);
+    signal(SIGFPE, crashHandler);
+
+    // case: reproduce, every file runs once
+    if (runs == -1 && corpusSize > 0) {
+        for (int i = 0; i < corpusSize; i++) {
+            snprintf(crashName, sizeof(crashName), "crash-file-%d", i);
+            runInput(corpus[i].data, corpus[i].size);
+        }
+        fprintf(stderr, "fuzz: ran %d inputs\n", corpusSize);
+        return 0;
+    }
+
+    // case: AFL style, one input on stdin
+    if (runs == -1) {
+        Input input = readInput(stdin, "stdin");
+        snprintf(crashName, sizeof(crashName), "crash-stdin");
+        runInput(input.data, input.size);
+        free(input.data);
+        return 0;
+    }
+
+    uint8_t* data = malloc(maxLen + 1);
+    if (data == NULL) {
+        fprintf(stderr, "fuzz: out of memory\n");
+        exit(-1);
+    }
+
+    srand(seed);
+    for (long run = 0; run < runs; run++) {
+        size_t size;
+
+        if (corpusSize > 0) {
+            const Input* base = &corpus[rand() % corpusSize];
+            size = base->size < maxLen ? base->size : maxLen;
+            memcpy(data, base->data, size);
+        } else {
+            size = maxLen == 0 ? 0 : (size_t)rand() % (maxLen + 1);
+            for (size_t i = 0; i < size; i++) {
+                data[i] = rand();
+            }
+        }
+        size = mutate(data, size, maxLen);
+
+        // run the input from an exactly sized copy, so reading past its end is caught by the sanitizers
+        uint8_t* exact = malloc(size == 0 ? 1 : size);
+        if (exact == NULL) {
+            fprintf(stderr, "fuzz: out of memory\n");
+            exit(-1);
+        }
+        memcpy(exact, data, size);
+        snprintf(crashName, sizeof(crashName), "crash-%u-%ld", seed, run);
+        runInput(exact, size);
+        free(exact);
+    }
+
+    fprintf(stderr, "fuzz: ran %ld inputs (seed %u)\n", runs, seed);
+    free(data);
+    for (int i = 0; i < corpusSize; i++) {
+        free(corpus[i].data);
+    }
+    free(corpus);
+    return 0;
+}
@@ -0,0 +1,402 @@
+// LIST FUZZ
+// fuzz target for list.c: every input is a sequence of List API calls, run against the real lists and a
+// plain array model of them, after each call the result, the links, the current pointer/state and
+// the sizes must match the model
+// at the end of each input every list is freed, then all heads and nodes must be available again
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fuzz.h"
+#include "../list.h"
+
+// model cursor positions besides an index
+#define CURSOR_START -1
+#define CURSOR_END -2
+
+enum {
+    OP_CREATE, OP_COUNT, OP_FIRST, OP_LAST, OP_NEXT, OP_PREV, OP_CURR, OP_INSERT_AFTER, OP_INSERT_BEFORE,
+    OP_APPEND, OP_PREPEND, OP_REMOVE, OP_TRIM, OP_CONCAT, OP_FREE, OP_SEARCH, NUM_OPS
+};
+
+typedef struct Model_s Model;
+struct Model_s {
+    List* list; // NULL if the slot is not in use
+    int items[LIST_MAX_NUM_NODES];
+    int size;
+    int cursor; // index of the current item, CURSOR_START or CURSOR_END
+};
+
+static Model models[LIST_MAX_NUM_HEADS];
+static int headsInUse;
+static int nodesInUse;
+static int nextValue;
+
+// items freed by the last List_free
+static int freed[LIST_MAX_NUM_NODES];
+static int freedCount;
+
+static void* itemOf(int value) {
+    return (void*)(uintptr_t)value;
+}
+
+static bool isItem(void* item, void* comparisonArg) {
+    return item == comparisonArg;
+}
+
+static void recordFree(void* item) {
+    FUZZ_CHECK(freedCount < LIST_MAX_NUM_NODES);
+    freed[freedCount++] = (int)(uintptr_t)item;
+}
+
+static void* modelCurrent(const Model* m) {
+    return m->cursor >= 0 ? itemOf(m->items[m->cursor]) : NULL;
+}
+
+// the list's nodes, links, size and current pointer match the model
+static void checkList(const Model* m) {
+    const List* list = m->list;
+    const Node* prev = NULL;
+    const Node* node = list->head;
+
+    FUZZ_CHECK(list->size == m->size);
+
+    for (int i = 0; i < m->size; i++) {
+        FUZZ_CHECK(node != NULL);
+        FUZZ_CHECK(node->prev == prev);
+        FUZZ_CHECK(node->item == itemOf(m->items[i]));
+        if (m->cursor == i) {
+            FUZZ_CHECK(list->curr == node);
+            FUZZ_CHECK(list->currentState != LIST_OOB_START && list->currentState != LIST_OOB_END);
+        }
+        prev = node;
+        node = node->next;
+    }
+    FUZZ_CHECK(node == NULL);
+    FUZZ_CHECK(list->tail == prev);
+
+    if (m->cursor == CURSOR_START) {
+        FUZZ_CHECK(list->curr == NULL && list->currentState == LIST_OOB_START);
+    } else if (m->cursor == CURSOR_END) {
+        FUZZ_CHECK(list->curr == NULL && list->currentState == LIST_OOB_END);
+    }
+}
+
+static void modelInsert(Model* m, int index, int value) {
+    memmove(&m->items[index + 1], &m->items[index], (m->size - index) * sizeof(int));
+    m->items[index] = value;
+    m->size++;
+    m->cursor = index;
+    nodesInUse++;
+}
+
+static int modelRemove(Model* m, int index) {
+    int value = m->items[index];
+
+    memmove(&m->items[index], &m->items[index + 1], (m->size - index - 1) * sizeof(int));
+    m->size--;
+    nodesInUse--;
+    return value;
+}
+
+// index a new item goes to for insert_after/insert_before (before = 0 or 1)
+static int insertIndex(const Model* m, int before) {
+    if (m->size == 0 || m->cursor == CURSOR_START) {
+        return 0;
+    }
+    if (m->cursor == CURSOR_END) {
+        return m->size;
+    }
+    return before ? m->cursor : m->cursor + 1;
+}
+
+static void runInsert(Model* m, int op) {
+    int value = nextValue++;
+    int index;
+    int res;
+
+    switch (op) {
+        case OP_INSERT_AFTER:
+            res = List_insert_after(m->list, itemOf(value));
+            index = insertIndex(m, 0);
+            break;
+        case OP_INSERT_BEFORE:
+            res = List_insert_before(m->list, itemOf(value));
+            index = insertIndex(m, 1);
+            break;
+        case OP_APPEND:
+            res = List_append(m->list, itemOf(value));
+            index = m->size;
+            break;
+        default:
+            res = List_prepend(m->list, itemOf(value));
+            index = 0;
+            break;
+    }
+
+    // case: all nodes are in use
+    if (nodesInUse == LIST_MAX_NUM_NODES) {
+        FUZZ_CHECK(res == LIST_FAIL);
+        return;
+    }
+    FUZZ_CHECK(res == LIST_SUCCESS);
+    modelInsert(m, index, value);
+}
+
+static void runFree(Model* m) {
+    int size = m->size;
+
+    freedCount = 0;
+    List_free(m->list, recordFree);
+
+    FUZZ_CHECK(freedCount == size);
+    FUZZ_CHECK(memcmp(freed, m->items, size * sizeof(int)) == 0);
+    nodesInUse -= size;
+    headsInUse--;
+    m->list = NULL;
+}
+
+static void runSearch(Model* m, uint8_t arg) {
+    // search for an item in the list, or one that is not in any list
+    int target = m->size > 0 && (arg & 1) ? m->items[(arg >> 1) % m->size] : 0;
+    void* res = List_search(m->list, isItem, itemOf(target));
+    void* expected = NULL;
+
+    if (m->size == 0) {
+        m->cursor = CURSOR_END;
+    } else if (m->cursor != CURSOR_END) {
+        m->cursor = m->cursor == CURSOR_START ? 0 : m->cursor;
+        while (m->cursor < m->size && m->items[m->cursor] != target) {
+            m->cursor++;
+        }
+        if (m->cursor == m->size) {
+            m->cursor = CURSOR_END;
+        } else {
+            expected = itemOf(target);
+        }
+    }
+    FUZZ_CHECK(res == expected);
+}
+
+static void runConcat(Model* m1, Model* m2) {
+    // case: a list cannot be concatenated to itself
+    if (m1 == m2) {
+        return;
+    }
+
+    // case: either list does not exist, nothing changes
+    if (m1->list == NULL || m2->list == NULL) {
+        List_concat(m1->list, m2->list);
+        return;
+    }
+
+    List_concat(m1->list, m2->list);
+
+    if (m2->size > 0 && m1->size == 0) {
+        m1->cursor = CURSOR_START;
+    }
+    memcpy(&m1->items[m1->size], m2->items, m2->size * sizeof(int));
+    m1->size += m2->size;
+    headsInUse--;
+    m2->list = NULL;
+}
+
+// calls on a list that does not exist fail without side effects
+static void runOnNull(int op) {
+    switch (op) {
+        case OP_COUNT:
+            FUZZ_CHECK(List_count(NULL) == LIST_FAIL);
+            break;
+        case OP_FIRST:
+            FUZZ_CHECK(List_first(NULL) == NULL);
+            break;
+        case OP_LAST:
+            FUZZ_CHECK(List_last(NULL) == NULL);
+            break;
+        case OP_NEXT:
+            FUZZ_CHECK(List_next(NULL) == NULL);
+            break;
+        case OP_PREV:
+            FUZZ_CHECK(List_prev(NULL) == NULL);
+            break;
+        case OP_CURR:
+            FUZZ_CHECK(List_curr(NULL) == NULL);
+            break;
+        case OP_INSERT_AFTER:
+            FUZZ_CHECK(List_insert_after(NULL, itemOf(1)) == LIST_FAIL);
+            break;
+        case OP_INSERT_BEFORE:
+            FUZZ_CHECK(List_insert_before(NULL, itemOf(1)) == LIST_FAIL);
+            break;
+        case OP_APPEND:
+            FUZZ_CHECK(List_append(NULL, itemOf(1)) == LIST_FAIL);
+            break;
+        case OP_PREPEND:
+            FUZZ_CHECK(List_prepend(NULL, itemOf(1)) == LIST_FAIL);
+            break;
+        case OP_REMOVE:
+            FUZZ_CHECK(List_remove(NULL) == NULL);
+            break;
+        case OP_TRIM:
+            FUZZ_CHECK(List_trim(NULL) == NULL);
+            break;
+        case OP_FREE:
+            List_free(NULL, recordFree);
+            break;
+        case OP_SEARCH:
+            FUZZ_CHECK(List_search(NULL, isItem, itemOf(1)) == NULL);
+            break;
+    }
+}
+
+static void runOp(int op, Model* m, Model* other, uint8_t arg) {
+    void* res;
+
+    if (op == OP_CREATE) {
+        if (m->list != NULL) {
+            return;
+        }
+        m->list = List_create();
+        if (headsInUse == LIST_MAX_NUM_HEADS) {
+            FUZZ_CHECK(m->list == NULL);
+            return;
+        }
+        FUZZ_CHECK(m->list != NULL);
+        m->size = 0;
+        m->cursor = CURSOR_START;
+        headsInUse++;
+        return;
+    }
+
+    if (op == OP_CONCAT) {
+        runConcat(m, other);
+        return;
+    }
+
+    if (m->list == NULL) {
+        runOnNull(op);
+        return;
+    }
+
+    switch (op) {
+        case OP_COUNT:
+            FUZZ_CHECK(List_count(m->list) == m->size);
+            break;
+        case OP_FIRST:
+        case OP_LAST:
+            res = op == OP_FIRST ? List_first(m->list) : List_last(m->list);
+            if (m->size > 0) {
+                m->cursor = op == OP_FIRST ? 0 : m->size - 1;
+            }
+            FUZZ_CHECK(res == modelCurrent(m));
+            break;
+        case OP_NEXT:
+            res = List_next(m->list);
+            if (m->size == 0 || m->cursor == m->size - 1) {
+                m->cursor = CURSOR_END;
+            } else if (m->cursor != CURSOR_END) {
+                m->cursor = m->cursor == CURSOR_START ? 0 : m->cursor + 1;
+            }
+            FUZZ_CHECK(res == modelCurrent(m));
+            break;
+        case OP_PREV:
+            res = List_prev(m->list);
+            if (m->size > 0 && m->cursor != CURSOR_START) {
+                m->cursor = m->cursor == CURSOR_END ? m->size - 1 : m->cursor - 1;
+                if (m->cursor == -1) {
+                    m->cursor = CURSOR_START;
+                }
+            }
+            FUZZ_CHECK(res == modelCurrent(m));
+            break;
+        case OP_CURR:
+            FUZZ_CHECK(List_curr(m->list) == modelCurrent(m));
+            break;
+        case OP_INSERT_AFTER:
+        case OP_INSERT_BEFORE:
+        case OP_APPEND:
+        case OP_PREPEND:
+            runInsert(m, op);
+            break;
+        case OP_REMOVE:
+            res = List_remove(m->list);
+            if (m->cursor < 0) {
+                FUZZ_CHECK(res == NULL);
+                break;
+            }
+            FUZZ_CHECK(res == itemOf(modelRemove(m, m->cursor)));
+            if (m->cursor == m->size) {
+                m->cursor = CURSOR_END;
+            }
+            break;
+        case OP_TRIM:
+            res = List_trim(m->list);
+            if (m->size == 0) {
+                FUZZ_CHECK(res == NULL);
+                break;
+            }
+            FUZZ_CHECK(res == itemOf(modelRemove(m, m->size - 1)));
+            m->cursor = m->size == 0 ? CURSOR_END : m->size - 1;
+            break;
+        case OP_FREE:
+            runFree(m);
+            break;
+        case OP_SEARCH:
+            runSearch(m, arg);
+            break;
+    }
+}
+
+// every head and node is back on the free stacks: all of them can be taken again, and no more
+static void checkPools() {
+    List* lists[LIST_MAX_NUM_HEADS];
+
+    for (int i = 0; i < LIST_MAX_NUM_HEADS; i++) {
+        lists[i] = List_create();
+        FUZZ_CHECK(lists[i] != NULL);
+    }
+    FUZZ_CHECK(List_create() == NULL);
+
+    for (int i = 0; i < LIST_MAX_NUM_NODES; i++) {
+        FUZZ_CHECK(List_append(lists[i % LIST_MAX_NUM_HEADS], itemOf(i + 1)) == LIST_SUCCESS);
+    }
+    FUZZ_CHECK(List_append(lists[0], itemOf(1)) == LIST_FAIL);
+
+    for (int i = 0; i < LIST_MAX_NUM_HEADS; i++) {
+        freedCount = 0;
+        List_free(lists[i], recordFree);
+        FUZZ_CHECK(freedCount == LIST_MAX_NUM_NODES / LIST_MAX_NUM_HEADS);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    memset(models, 0, sizeof(models));
+    headsInUse = 0;
+    nodesInUse = 0;
+    nextValue = 1;
+
+    // each call takes 3 bytes: operation, list, argument (other list or search target)
+    for (size_t i = 0; i + 3 <= size; i += 3) {
+        int op = data[i] % NUM_OPS;
+        Model* m = &models[data[i + 1] % LIST_MAX_NUM_HEADS];
+        Model* other = &models[data[i + 2] % LIST_MAX_NUM_HEADS];
+
+        runOp(op, m, other, data[i + 2]);
+
+        for (int j = 0; j < LIST_MAX_NUM_HEADS; j++) {
+            if (models[j].list != NULL) {
+                checkList(&models[j]);
+            }
+        }
+    }
+
+    for (int j = 0; j < LIST_MAX_NUM_HEADS; j++) {
+        if (models[j].list != NULL) {
+            runFree(&models[j]);
+        }
+    }
+    FUZZ_CHECK(headsInUse == 0 && nodesInUse == 0);
+    checkPools();
+    return 0;
+}
@@ -0,0 +1,213 @@
+// MESSAGE STRESS
+// multithreaded stress test for the shared queues (see threadManager.c), meant to run under ThreadSanitizer ("make stress")
+// - like the pipeline, there are two queues, each emptied by one consumer thread that waits with waitOutputWriter
+//   or waitUDPClient
+// - several producers per queue add messages as fast as they can, alternating between addMessageWait (like
+//   keyboardThread) and addMessage (like listenerThread, which drops the message when the queue is full)
+// - every message that was not dropped must be received exactly once, in the order its producer added it
+// usage: ./messageStress [producers per queue] [messages per producer] [busy poll spin time in us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../threadManager.h"
+#include "../freeManager.h"
+
+#define DEFAULT_PRODUCERS 3
+#define DEFAULT_MESSAGES 50000
+#define MESSAGE_LEN 32
+
+typedef struct Producer_s Producer;
+struct Producer_s {
+    pthread_t thread;
+    int id;
+    MessageQueue* queue;
+    void (*signal)();
+    char* dropped; // per message: addMessage failed
+};
+
+typedef struct Consumer_s Consumer;
+struct Consumer_s {
+    pthread_t thread;
+    MessageQueue queue;
+    void (*wait)(MessageQueue*, const TimerWheel*);
+    int firstProducer;
+};
+
+static int producersPerQueue = DEFAULT_PRODUCERS;
+static int messagesPerProducer = DEFAULT_MESSAGES;
+
+// per producer: next message expected (all before it were received or dropped), and the messages received
+static int* nextExpected;
+static char** received;
+static atomic_int failures = 0;
+
+static void fail(const char* reason, int producer, int sequence) {
+    fprintf(stderr, "messageStress: %s (producer %d, message %d)\n", reason, producer, sequence);
+    atomic_fetch_add(&failures, 1);
+}
+
+static void* produce(void* arg) {
+    Producer* p = arg;
+
+    for (int i = 0; i < messagesPerProducer; i++) {
+        char* message = allocMessage(MESSAGE_LEN);
+        snprintf(message, MESSAGE_LEN + 1, "%d %d\n", p->id, i);
+
+        if (i % 2 == 0) {
+            if (addMessageWait(p->queue, message) == MESSAGE_QUEUE_FAIL) {
+                fail("addMessageWait failed before shutdown", p->id, i);
+                releaseMessage(message);
+            }
+        } else if (addMessage(p->queue, message) == MESSAGE_QUEUE_FAIL) {
+            p->dropped[i] = 1;
+            releaseMessage(message);
+        }
+        p->signal();
+    }
+
+    return NULL;
+}
+
+static void receive(const Consumer* c, char* message) {
+    int producer, sequence;
+
+    if (sscanf(message, "%d %d", &producer, &sequence) != 2
+        || producer < c->firstProducer || producer >= c->firstProducer + producersPerQueue
+        || sequence < 0 || sequence >= messagesPerProducer) {
+        fail("corrupt or misrouted message", -1, -1);
+        releaseMessage(message);
+        return;
+    }
+
+    if (sequence < nextExpected[producer]) {
+        fail("message received twice or out of order", producer, sequence);
+    }
+    nextExpected[producer] = sequence + 1;
+    received[producer][sequence] = 1;
+    releaseMessage(message);
+}
+
+static void* consume(void* arg) {
+    Consumer* c = arg;
+    char* message;
+
+    while (1) {
+        c->wait(&c->queue, NULL);
+
+        while ((message = getMessage(&c->queue)) != NULL) {
+            receive(c, message);
+        }
+
+        // case: producers are done, requestShutdown was called after the last message was added
+        if (isShuttingDown() && countMessages(&c->queue) == 0) {
+            return NULL;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int spinMicros = 0;
+
+    if (argc > 1) {
+        producersPerQueue = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        messagesPerProducer = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        spinMicros = atoi(argv[3]);
+    }
+    if (producersPerQueue <= 0 || messagesPerProducer <= 0 || spinMicros < 0) {
+        fprintf(stderr, "usage: %s [producers per queue] [messages per producer] [busy poll spin time in us]\n", argv[0]);
+        exit(-1);
+    }
+
+    initShutdown();
+    initMutexes();
+    initConditionVars();
+    initBusyPoll(spinMicros);
+
+    int numProducers = 2 * producersPerQueue;
+    Producer* producers = calloc(numProducers, sizeof(Producer));
+    nextExpected = calloc(numProducers, sizeof(int));
+    received = calloc(numProducers, sizeof(char*));
+    if (producers == NULL || nextExpected == NULL || received == NULL) {
+        fprintf(stderr, "messageStress: out of memory\n");
+        exit(-1);
+    }
+
+    // outputQueue and inputQueue, as in main.c
+    Consumer consumers[2] = {
+        { .wait = waitOutputWriter, .firstProducer = 0 },
+        { .wait = waitUDPClient, .firstProducer = producersPerQueue }
+    };
+    MessageQueue_init(&consumers[0].queue, DEFAULT_OUTPUT_QUEUE_CAPACITY);
+    MessageQueue_init(&consumers[1].queue, DEFAULT_INPUT_QUEUE_CAPACITY);
+
+    for (int i = 0; i < 2; i++) {
+        if (pthread_create(&consumers[i].thread, NULL, consume, &consumers[i]) != 0) {
+            perror("messageStress: could not create consumer");
+            exit(-1);
+        }
+    }
+
+    for (int i = 0; i < numProducers; i++) {
+        Producer* p = &producers[i];
+        p->id = i;
+        p->queue = i < producersPerQueue ? &consumers[0].queue : &consumers[1].queue;
+        p->signal = i < producersPerQueue ? signalOutputWriter : signalUDPClient;
+        p->dropped = calloc(messagesPerProducer, 1);
+        received[i] = calloc(messagesPerProducer, 1);
+        if (p->dropped == NULL || received[i] == NULL) {
+            fprintf(stderr, "messageStress: out of memory\n");
+            exit(-1);
+        }
+
+        if (pthread_create(&p->thread, NULL, produce, p) != 0) {
+            perror("messageStress: could not create producer");
+            exit(-1);
+        }
+    }
+
+    for (int i = 0; i < numProducers; i++) {
+        pthread_join(producers[i].thread, NULL);
+    }
+    requestShutdown();
+    for (int i = 0; i < 2; i++) {
+        pthread_join(consumers[i].thread, NULL);
+    }
+
+    // every message was either dropped or received
+    long total = 0, dropped = 0;
+    for (int i = 0; i < numProducers; i++) {
+        for (int j = 0; j < messagesPerProducer; j++) {
+            total++;
+            dropped += producers[i].dropped[j];
+            if (producers[i].dropped[j] == received[i][j]) {
+                fail(received[i][j] ? "dropped message was received" : "message was lost", i, j);
+            }
+        }
+        free(producers[i].dropped);
+        free(received[i]);
+    }
+
+    printf("messageStress: %ld messages from %d producers, %ld dropped (queue full), %d failures\n",
+        total, numProducers, dropped, atomic_load(&failures));
+
+    for (int i = 0; i < 2; i++) {
+        releaseMessages(&consumers[i].queue);
+    }
+    destroyMessagePool();
+    free(producers);
+    free(nextExpected);
+    free(received);
+    destroyConditionVars();
+    destroyMutexes();
+    destroyShutdown();
+
+    return atomic_load(&failures) == 0 ? 0 : 1;
+}
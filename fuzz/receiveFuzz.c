@@ -0,0 +1,139 @@
+// RECEIVE FUZZ
+// fuzz target for listenerThread's parse path: unwrapDatagram (frame decoding, decompression) and addHeader
+// the first byte of an input picks how the rest is turned into a datagram, so frames get past the magic number:
+// - 0: the rest is the datagram as is
+// - 1: the rest is put behind a frame header with the magic number, flags and length taken from the input
+// - 2: the rest is framed (and compressed if it is long enough) by encodeFrame, then one of its bytes is changed
+// encryption is off: forged frames would only reach the authentication tag check
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "fuzz.h"
+#include "../UDPServer.h"
+#include "../frame.h"
+#include "../compression.h"
+#include "../freeManager.h"
+
+#define FUZZ_COMPRESSION_THRESHOLD 16
+
+static char messageBuffer[MAX_LEN_DATAGRAM + 1];
+static char frameBuffer[MAX_LEN_DATAGRAM];
+static int intact; // mode 2 frame was left as encodeFrame wrote it
+static const struct sockaddr_in source = { .sin_family = AF_INET, .sin_port = 0x1234 };
+
+static void init() {
+    static int initialized = 0;
+
+    if (!initialized) {
+        initCompression(FUZZ_COMPRESSION_THRESHOLD);
+        setPeerCompression(1);
+        initFraming();
+        initialized = 1;
+    }
+}
+
+// datagram filled from data, in a buffer of exactly numbytes so reading past it is caught by the sanitizers
+static char* copyDatagram(const char* data, int numbytes) {
+    char* datagram = malloc(numbytes == 0 ? 1 : numbytes);
+    if (datagram == NULL) {
+        fprintf(stderr, "receiveFuzz: out of memory\n");
+        exit(-1);
+    }
+    memcpy(datagram, data, numbytes);
+    return datagram;
+}
+
+static int buildFrame(const uint8_t* data, int size) {
+    FrameHeader header;
+
+    if (size < 3 || size - 3 > MAX_LEN_DATAGRAM - (int)sizeof(FrameHeader)) {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = htons(FRAME_MAGIC);
+    header.flags = data[0];
+    header.length = htonl((data[1] << 8) | data[2]);
+
+    memcpy(frameBuffer, &header, sizeof(header));
+    memcpy(frameBuffer + sizeof(header), data + 3, size - 3);
+    return sizeof(header) + size - 3;
+}
+
+static int encodeAndMutate(const uint8_t* data, int size) {
+    if (size < 3) {
+        return -1;
+    }
+
+    int frameLen = encodeFrame((const char*)data + 3, size - 3, frameBuffer, sizeof(frameBuffer));
+    if (frameLen <= 0) {
+        return -1;
+    }
+
+    // change one byte, leaving the magic number (the only way past it is mode 1)
+    int pos = ((data[0] << 8) | data[1]) % frameLen;
+    intact = pos < 2 || data[2] == 0;
+    if (!intact) {
+        frameBuffer[pos] ^= data[2];
+    }
+    return frameLen;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    FrameInfo info;
+    char* payload;
+    int numbytes;
+
+    init();
+    intact = 0;
+
+    if (size < 1 || size > MAX_LEN_DATAGRAM) {
+        return 0;
+    }
+
+    switch (data[0] % 3) {
+        case 0:
+            numbytes = size - 1;
+            memcpy(frameBuffer, data + 1, numbytes);
+            break;
+        case 1:
+            numbytes = buildFrame(data + 1, size - 1);
+            break;
+        default:
+            numbytes = encodeAndMutate(data + 1, size - 1);
+            break;
+    }
+    if (numbytes < 0) {
+        return 0;
+    }
+
+    char* datagram = copyDatagram(frameBuffer, numbytes);
+    int payloadLen = unwrapDatagram(datagram, numbytes, &source, messageBuffer, MAX_LEN_DATAGRAM, &payload, &info);
+
+    if (payloadLen != -1) {
+        FUZZ_CHECK(payloadLen >= 0 && payloadLen <= MAX_LEN_DATAGRAM);
+        FUZZ_CHECK(payload == datagram || payload == messageBuffer);
+        FUZZ_CHECK(payload == messageBuffer || payloadLen == numbytes);
+    }
+
+    // an unchanged frame gives back the message that was encoded
+    if (intact && size > 4) {
+        FUZZ_CHECK(payloadLen == (int)size - 4);
+        FUZZ_CHECK(memcmp(payload, data + 4, payloadLen) == 0);
+    }
+
+    // what listenerThread does with a message
+    if (payloadLen != -1) {
+        char* message = addHeader(payload, payloadLen);
+        int headerLen = strlen("Remote Client: ");
+        FUZZ_CHECK(memcmp(message, "Remote Client: ", headerLen) == 0);
+        FUZZ_CHECK(memcmp(message + headerLen, payload, payloadLen) == 0);
+        FUZZ_CHECK(message[headerLen + payloadLen] == '\0');
+        releaseMessage(message);
+    }
+
+    free(datagram);
+    return 0;
+}
@@ -0,0 +1,130 @@
+// REPLAY FUZZ
+// fuzz target for cipher.c's replay check: every input interleaves the frames of several senders that share the
+// key, each numbering its frames from a different start (like the wall clock start times of real clients) and
+// sending from its own address
+// the frames of a sender are sent in order, skipped (held back and delivered later, out of order) or replayed,
+// and the sender can restart, and acceptSequence must match a model of each sender's window, whatever the other
+// senders do:
+// - a new frame, or a held-back one no more than REPLAY_WINDOW below the sender's newest, is accepted
+// - a replayed frame, or a held-back one older than that, is rejected
+// - a restarted sender (new session, numbered above its old frames) is accepted, and from then on the held-back
+//   frames of its old session are rejected
+// - a session from an earlier run (new session id, numbered below what its address has sent) is rejected
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "fuzz.h"
+#include "../cipher.h"
+
+#define MAX_SENDERS 4
+#define REPLAY_WINDOW 64
+#define MAX_HELD 32
+#define MAX_ACCEPTED 32
+
+enum { OP_SEND, OP_REPLAY, OP_SKIP, OP_DELIVER, OP_RESTART, NUM_OPS };
+
+// a frame: the session that sent it and its sequence number
+typedef struct Frame_s Frame;
+struct Frame_s {
+    uint32_t sessionId;
+    uint64_t sequence;
+};
+
+typedef struct Sender_s Sender;
+struct Sender_s {
+    struct sockaddr_in addr;
+    uint32_t sessionId;
+    uint64_t next;     // sequence number of its next new frame
+    uint64_t highest;  // highest accepted
+    Frame held[MAX_HELD];
+    int heldCount;
+    Frame accepted[MAX_ACCEPTED]; // ring of the last accepted
+    int acceptedCount;
+};
+
+static uint32_t nextSessionId = 1;
+
+static void deliver(Sender* s, Frame frame, int expected) {
+    FUZZ_CHECK(acceptSequence(&s->addr, frame.sessionId, frame.sequence) == expected);
+
+    if (expected) {
+        if (frame.sequence > s->highest) {
+            s->highest = frame.sequence;
+        }
+        s->accepted[s->acceptedCount++ % MAX_ACCEPTED] = frame;
+    }
+}
+
+static Frame nextFrame(Sender* s) {
+    Frame frame = { s->sessionId, s->next++ };
+    return frame;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    Sender senders[MAX_SENDERS];
+
+    if (size < 1 + MAX_SENDERS) {
+        return 0;
+    }
+
+    // every input starts with no senders known (the starts below are minutes apart, well within the session age)
+    resetReplayWindows(0);
+
+    int numSenders = 2 + data[0] % (MAX_SENDERS - 1);
+    memset(senders, 0, sizeof(senders));
+    for (int i = 0; i < numSenders; i++) {
+        senders[i].addr.sin_family = AF_INET;
+        senders[i].addr.sin_port = htons(i + 1);
+        senders[i].sessionId = nextSessionId++;
+        senders[i].next = ((uint64_t)data[1 + i] << 32) + 1;
+    }
+
+    for (size_t pos = 1 + MAX_SENDERS; pos < size; pos++) {
+        uint8_t b = data[pos];
+        Sender* s = &senders[b % numSenders];
+        int arg = b / numSenders / NUM_OPS;
+
+        switch (b / numSenders % NUM_OPS) {
+            case OP_SEND:
+                deliver(s, nextFrame(s), 1);
+                break;
+            case OP_REPLAY:
+                if (s->acceptedCount > 0) {
+                    int count = s->acceptedCount < MAX_ACCEPTED ? s->acceptedCount : MAX_ACCEPTED;
+                    deliver(s, s->accepted[arg % count], 0);
+                }
+                break;
+            case OP_SKIP:
+                for (int i = 0; i <= arg % 8 && s->heldCount < MAX_HELD; i++) {
+                    s->held[s->heldCount++] = nextFrame(s);
+                }
+                break;
+            case OP_DELIVER:
+                if (s->heldCount > 0) {
+                    int i = arg % s->heldCount;
+                    Frame frame = s->held[i];
+                    s->held[i] = s->held[--s->heldCount];
+                    deliver(s, frame, frame.sessionId == s->sessionId
+                        && (frame.sequence > s->highest || s->highest - frame.sequence < REPLAY_WINDOW));
+                }
+                break;
+            default:
+                // case: a session of an earlier run, numbered below what the address has sent
+                if (arg % 2 == 1 && s->highest > (uint64_t)arg) {
+                    Frame frame = { nextSessionId++, s->highest - arg };
+                    deliver(s, frame, 0);
+                    break;
+                }
+
+                // case: the sender restarts (its first frame is accepted, the old ones held back are not any more)
+                s->sessionId = nextSessionId++;
+                s->next += 1 + arg;
+                deliver(s, nextFrame(s), 1);
+                break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+// SIMULATOR FUZZ
+// fuzz target for networkSimulator.c's determinism: every input runs the same messages through the simulated link
+// twice, over a socketpair, with the same settings and seed but heartbeats and receipts sent at other points
+// (like in real runs, where they are timed by the clock): the messages must come out the same both times, so
+// the same ones are lost, duplicated, reordered and delayed
+// the link's clock is moved forward by the target (TICK_NS per message), so nothing depends on how fast it runs
+// input: loss, reorder and duplicate percentages, latency and jitter, the seed, then one byte per message saying
+// which run sends a heartbeat or receipts frame before it
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "fuzz.h"
+#include "../networkSimulator.h"
+#include "../transport.h"
+#include "../frame.h"
+#include "../timerWheel.h"
+
+#define SETTINGS_LEN 8
+#define MAX_MESSAGES 256
+#define TICK_NS 1000000ULL
+#define MAX_DELAY_MS 8
+
+static uint64_t fakeNow;
+
+static uint64_t fakeClock() {
+    return fakeNow;
+}
+
+// what came out of the link in one run: the message numbers in the order they were delivered
+typedef struct Run_s Run;
+struct Run_s {
+    int delivered[2 * MAX_MESSAGES];
+    int count;
+};
+
+static void sendDatagram(int fd, const void* datagram, int length) {
+    if (send(fd, datagram, length, 0) != length) {
+        perror("simulatorFuzz: send() error");
+        exit(-1);
+    }
+}
+
+// a frame the simulator counts as a heartbeat or receipts (it only looks at the header)
+static void sendControl(int fd, uint8_t flags) {
+    char frame[sizeof(FrameHeader) + 8];
+    FrameHeader header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = htons(FRAME_MAGIC);
+    header.flags = flags;
+    header.length = htonl(sizeof(frame) - sizeof(header));
+    memset(frame, 0, sizeof(frame));
+    memcpy(frame, &header, sizeof(header));
+    sendDatagram(fd, frame, sizeof(frame));
+}
+
+// take every datagram the link delivers by now, keeping the numbers of the messages
+static void drain(int fd, Run* run) {
+    char datagram[64];
+    char control[NETSIM_CONTROL_SPACE];
+    struct sockaddr_storage addr;
+    struct iovec iov = { .iov_base = datagram, .iov_len = sizeof(datagram) };
+    struct msghdr msg;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof(addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        int numbytes = getTransport()->receive(fd, &msg);
+        if (numbytes == -1) {
+            FUZZ_CHECK(errno == EAGAIN);
+            return;
+        }
+
+        if (numbytes > 0 && datagram[0] == 'm') {
+            FUZZ_CHECK(run->count < 2 * MAX_MESSAGES);
+            datagram[numbytes < (int)sizeof(datagram) ? numbytes : (int)sizeof(datagram) - 1] = '\0';
+            run->delivered[run->count++] = atoi(datagram + 1);
+        }
+    }
+}
+
+// send the messages of the input through the link, with the control frames of run (0 or 1)
+static void simulate(const char* settings, const uint8_t* steps, int numMessages, int which, Run* run) {
+    TimerWheel timers;
+    int fds[2];
+
+    if (initNetworkSimulator(settings) == -1) {
+        fprintf(stderr, "simulatorFuzz: invalid settings %s\n", settings);
+        exit(-1);
+    }
+    initTimerWheel(&timers, TIMER_TICK_NS);
+    startNetworkSimulator(&timers);
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1) {
+        perror("simulatorFuzz: socketpair() error");
+        exit(-1);
+    }
+
+    run->count = 0;
+    for (int i = 0; i < numMessages; i++) {
+        char message[16];
+        uint8_t step = steps[i] >> (which * 2);
+
+        // a control frame and the message, each taken off the socket before the next is sent
+        // (a datagram socketpair queues only a few)
+        if (step & 1) {
+            sendControl(fds[0], FRAME_HEARTBEAT);
+            drain(fds[1], run);
+        }
+        if (step & 2) {
+            sendControl(fds[0], FRAME_RECEIPTS);
+            drain(fds[1], run);
+        }
+
+        int length = snprintf(message, sizeof(message), "m%d", i);
+        sendDatagram(fds[0], message, length);
+        drain(fds[1], run);
+
+        fakeNow += TICK_NS;
+        drain(fds[1], run);
+    }
+
+    // let everything still held back come out
+    for (int i = 0; i <= MAX_DELAY_MS + NETSIM_REORDER_MS; i++) {
+        fakeNow += TICK_NS;
+        drain(fds[1], run);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    closeNetworkSimulator();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static Run runs[2];
+    char settings[256];
+
+    if (size < SETTINGS_LEN) {
+        return 0;
+    }
+
+    int numMessages = size - SETTINGS_LEN < MAX_MESSAGES ? size - SETTINGS_LEN : MAX_MESSAGES;
+    int latency = data[3] % (MAX_DELAY_MS / 2 + 1);
+    int jitter = data[4] % (latency + 1);
+    unsigned int seed = data[5] | (data[6] << 8) | (data[7] << 16);
+    snprintf(settings, sizeof(settings), "loss=%d,reorder=%d,duplicate=%d,latency=%d,jitter=%d,seed=%u",
+        data[0] % 101, data[1] % 101, data[2] % 101, latency, jitter, seed);
+
+    setNetworkSimulatorClock(fakeClock);
+    fakeNow = timerNow();
+    for (int which = 0; which < 2; which++) {
+        simulate(settings, data + SETTINGS_LEN, numMessages, which, &runs[which]);
+    }
+
+    FUZZ_CHECK(runs[0].count == runs[1].count);
+    FUZZ_CHECK(memcmp(runs[0].delivered, runs[1].delivered, runs[0].count * sizeof(int)) == 0);
+
+    // every message comes out at most twice, and at least once without loss
+    int seen[MAX_MESSAGES];
+    memset(seen, 0, sizeof(seen));
+    for (int i = 0; i < runs[0].count; i++) {
+        FUZZ_CHECK(runs[0].delivered[i] >= 0 && runs[0].delivered[i] < numMessages);
+        seen[runs[0].delivered[i]]++;
+    }
+    for (int i = 0; i < numMessages; i++) {
+        FUZZ_CHECK(seen[i] <= 2);
+        FUZZ_CHECK(data[0] % 101 != 0 || seen[i] >= 1);
+    }
+
+    return 0;
+}
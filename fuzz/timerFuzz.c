@@ -0,0 +1,197 @@
+// TIMER FUZZ
+// fuzz target for timerWheel.c: every input adds, cancels and re-adds timers anywhere on the wheel (all 4 levels
+// of 64 slots, and past its end) and moves the clock forward across level boundaries, checked against a model
+// that only remembers each timer's expiry time:
+// - a run fires exactly the timers that expired by then, each once, in the order of their expiry ticks
+// - a cancelled timer never fires, a re-added one fires at its new time only
+// - a timer can add itself again from its callback
+// - nextTimerDelay never sleeps past the earliest timer
+// the clock starts more than a full wheel ahead of CLOCK_MONOTONIC, so addTimer on an empty wheel never moves it,
+// and on a tick picked by the input, so an input always crosses the same level boundaries
+// timers far away are rare (see spanLevels): the wheel walks every 64th tick on the way to them, which is most of
+// the time an input takes
+// input: 3 bytes of start tick, 1 byte saying if timers go past the end of the wheel, then 4 bytes per operation
+// (what and which timer, level and sub-tick, 2 bytes of distance within the level)
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fuzz.h"
+#include "../timerWheel.h"
+
+#define NUM_TIMERS 16
+#define MAX_OPS 128
+#define START_LEN 4
+#define OP_LEN 4
+
+// ticks one wheel covers (64^4), and one slot of its last level
+#define WHEEL_TICKS (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define LAST_SLOT_TICKS (1ULL << (TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1)))
+
+// last level timers are within its first LAST_LEVEL_SLOTS slots
+#define LAST_LEVEL_SLOTS 8
+
+// the level whose span a delay is picked from, TIMER_WHEEL_LEVELS = past the end of the wheel
+// the clock is only moved up to a level 2 span at once, further by waking up for the next timer
+static const int spanLevels[8] = { 0, 0, 0, 1, 1, 2, 3, TIMER_WHEEL_LEVELS };
+#define NUM_SPANS 8
+#define NUM_ADVANCE_SPANS 6
+
+enum { OP_ADD, OP_CANCEL, OP_ADVANCE, OP_RUN_NEXT };
+
+// a timer and what the model expects of it
+typedef struct FuzzTimer_s FuzzTimer;
+struct FuzzTimer_s {
+    Timer timer;
+    int pending;
+    uint64_t expires;
+    uint64_t readdDelay; // added again this long after it fires, 0 = not added again
+};
+
+static TimerWheel wheel;
+static FuzzTimer timers[NUM_TIMERS];
+static uint64_t now;
+static uint64_t lastFiredTick;
+static int firedInRun;
+
+// ns from the operation's level and distance bytes: level n spans 64^(n+1) ticks, past the end of the wheel is
+// within a last level slot of its last tick
+static uint64_t readDelay(const uint8_t* op, int numSpans) {
+    int level = spanLevels[(op[1] & 7) % numSpans];
+    uint64_t distance = op[2] | (op[3] << 8);
+    uint64_t subTick = (op[1] >> 3) * (TIMER_TICK_NS / 32);
+    uint64_t ticks;
+
+    if (level == TIMER_WHEEL_LEVELS) {
+        ticks = WHEEL_TICKS - LAST_SLOT_TICKS + ((2 * LAST_SLOT_TICKS * distance) >> 16);
+    } else if (level == TIMER_WHEEL_LEVELS - 1) {
+        ticks = (LAST_LEVEL_SLOTS * LAST_SLOT_TICKS * distance) >> 16;
+    } else {
+        ticks = ((1ULL << (TIMER_WHEEL_BITS * (level + 1))) * distance) >> 16;
+    }
+
+    // 1 ns less with the top bit of the first byte, so a timer can be due 1 ns after a run
+    uint64_t delay = ticks * TIMER_TICK_NS + subTick;
+    return delay > 0 ? delay - (op[0] >> 7) : 0;
+}
+
+static void fired(void* arg, uint64_t firedAt) {
+    FuzzTimer* timer = arg;
+    uint64_t tick = timer->expires / TIMER_TICK_NS;
+
+    FUZZ_CHECK(firedAt == now);
+    FUZZ_CHECK(timer->pending);
+    FUZZ_CHECK(timer->expires <= now);
+    FUZZ_CHECK(!isTimerPending(&timer->timer));
+    FUZZ_CHECK(tick >= lastFiredTick);
+
+    timer->pending = 0;
+    lastFiredTick = tick;
+    firedInRun++;
+
+    if (timer->readdDelay != 0) {
+        timer->expires = now + timer->readdDelay;
+        timer->pending = 1;
+        addTimer(&wheel, &timer->timer, timer->expires, fired, timer);
+    }
+}
+
+// run the wheel at now, every timer that expired by then has to fire
+static void run() {
+    lastFiredTick = 0;
+    firedInRun = 0;
+
+    FUZZ_CHECK(runTimers(&wheel, now) == firedInRun);
+
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        FUZZ_CHECK(!timers[i].pending || timers[i].expires > now);
+    }
+}
+
+static void checkModel() {
+    int pending = 0;
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        FUZZ_CHECK(isTimerPending(&timers[i].timer) == timers[i].pending);
+        pending += timers[i].pending;
+    }
+    FUZZ_CHECK(wheel.count == pending);
+
+    // the wheel may wake up early (to cascade), never late
+    int64_t delay = nextTimerDelay(&wheel, now);
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        if (timers[i].pending) {
+            FUZZ_CHECK(delay >= 0 && now + delay <= timers[i].expires);
+        }
+    }
+    FUZZ_CHECK(pending != 0 || delay == -1);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size < START_LEN) {
+        return 0;
+    }
+
+    // a whole wheel ahead of the clock, on a tick the input picks within the next one
+    uint64_t startTick = (timerNow() / TIMER_TICK_NS / WHEEL_TICKS + 2) * WHEEL_TICKS;
+    startTick += (data[0] | (data[1] << 8) | (data[2] << 16)) % WHEEL_TICKS;
+    now = startTick * TIMER_TICK_NS;
+
+    // timers past the end of the wheel in 1 in 16 inputs
+    int addSpans = (data[3] & 15) == 0 ? NUM_SPANS : NUM_SPANS - 1;
+
+    initTimerWheel(&wheel, TIMER_TICK_NS);
+    memset(timers, 0, sizeof(timers));
+    run();
+
+    int numOps = (size - START_LEN) / OP_LEN < MAX_OPS ? (size - START_LEN) / OP_LEN : MAX_OPS;
+    for (int i = 0; i < numOps; i++) {
+        const uint8_t* op = data + START_LEN + i * OP_LEN;
+        FuzzTimer* timer = &timers[(op[0] >> 2) % NUM_TIMERS];
+
+        switch (op[0] & 3) {
+            // a pending timer is moved
+            case OP_ADD:
+                timer->expires = now + readDelay(op, addSpans);
+                timer->readdDelay = op[0] & 0x40 ? (1 + op[1]) * TIMER_TICK_NS : 0;
+                timer->pending = 1;
+                addTimer(&wheel, &timer->timer, timer->expires, fired, timer);
+                break;
+
+            case OP_CANCEL:
+                timer->pending = 0;
+                cancelTimer(&wheel, &timer->timer);
+                break;
+
+            case OP_ADVANCE:
+                now += readDelay(op, NUM_ADVANCE_SPANS);
+                run();
+                break;
+
+            // like a thread sleeping in poll() until the next timer
+            case OP_RUN_NEXT: {
+                int64_t delay = nextTimerDelay(&wheel, now);
+                if (delay > 0) {
+                    now += delay;
+                }
+                run();
+                break;
+            }
+        }
+
+        checkModel();
+    }
+
+    // let every timer still on the wheel fire (without adding themselves again), every wake up has to make progress
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        timers[i].readdDelay = 0;
+    }
+    while (wheel.count != 0) {
+        int64_t delay = nextTimerDelay(&wheel, now);
+        now += delay;
+        run();
+        FUZZ_CHECK(delay > 0 || firedInRun > 0);
+        checkModel();
+    }
+
+    return 0;
+}
@@ -0,0 +1,225 @@
+// References:
+// RFC 6298 - Computing TCP's Retransmission Timer, 2. The Basic Algorithm
+// RFC 3550 - RTP, 6.4.1 (interarrival jitter)
+
+// HEARTBEAT
+// keepalive datagrams between the two listener sockets, driven by listenerThread's timer wheel (see UDPServer.c)
+// - every interval a ping carrying the local send time goes to the remote client, whose listener echoes it back in a pong
+// - each pong gives an RTT sample for the smoothed RTT, RTT variation and jitter estimates
+// - any authentic datagram from the remote client's address is a sign of life (its messages come from its sender
+//   socket, whose port is not known, so only the host is compared): once it has been heard from, the session ends
+//   if nothing arrives from it for the peer timeout, datagrams of other peers or strangers do not keep it going
+// everything except the statistics (read by /rtt from keyboardThread) belongs to listenerThread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "heartbeat.h"
+#include "timerWheel.h"
+#include "frame.h"
+#include "threadManager.h"
+#include "outputWriter.h"
+#include "pipeMode.h"
+#include "transport.h"
+
+static int heartbeatEnabled = 0;
+static uint64_t interval;
+static uint64_t timeout;
+static struct sockaddr_in peerAddr;
+static int heartbeatSockfd = -1;
+
+static TimerWheel* wheel; // listenerThread's timers
+static Timer pingTimer;
+static Timer peerTimer;
+static int peerHeard = 0;
+
+// statistics (ns), srtt = 0 until the first pong
+static uint64_t lastHeard;
+static uint64_t srtt;
+static uint64_t rttvar;
+static uint64_t jitter;
+static uint64_t lastRtt;
+static uint64_t pingsSent;
+static uint64_t pongsReceived;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t absDiff(uint64_t a, uint64_t b) {
+    return a > b ? a - b : b - a;
+}
+
+static void sendHeartbeat(int type, uint64_t timestamp, const struct sockaddr_in* to) {
+    char frame[sizeof(FrameHeader) + FRAME_TIMESTAMP_LEN + sizeof(Heartbeat) + CIPHER_TAG_LEN];
+    Heartbeat heartbeat;
+
+    memset(&heartbeat, 0, sizeof(heartbeat));
+    heartbeat.type = type;
+    heartbeat.timestamp = htobe64(timestamp);
+
+    int frameLen = encodeHeartbeatFrame((const char*)&heartbeat, sizeof(heartbeat), frame, sizeof(frame));
+    if (frameLen == -1) {
+        fprintf(stderr, "heartbeat: could not frame heartbeat\n");
+        return;
+    }
+
+    // a lost heartbeat is not an error, the next one will follow
+    getTransport()->send(heartbeatSockfd, frame, frameLen, 0, (const struct sockaddr*)to, sizeof(*to));
+}
+
+static void sendPing(void* arg, uint64_t now) {
+    sendHeartbeat(HEARTBEAT_PING, now, &peerAddr);
+
+    pthread_mutex_lock(&statsMutex);
+    pingsSent++;
+    pthread_mutex_unlock(&statsMutex);
+
+    addTimer(wheel, &pingTimer, now + interval, sendPing, NULL);
+}
+
+// nothing has been heard from the remote client for a while (or it was heard from since the timer was set)
+static void checkPeer(void* arg, uint64_t now) {
+    pthread_mutex_lock(&statsMutex);
+    uint64_t heard = lastHeard;
+    pthread_mutex_unlock(&statsMutex);
+
+    // case: heard from since, check again a full timeout after that
+    if (now - heard < timeout) {
+        addTimer(wheel, &peerTimer, heard + timeout, checkPeer, NULL);
+        return;
+    }
+
+    fprintf(stderr, "Remote client has not responded for %llu ms, ending the session\n", (unsigned long long)(timeout / 1000000));
+    signalOutputWriter(); // outputWriter can write what has been received, then stop
+    requestShutdown(); // inputReader, UDPClient and UDPServer stop too
+}
+
+// start up: resolve the remote client's listening address
+void initHeartbeat(int intervalMs, int timeoutMs, char* remoteName, char* remotePort) {
+    struct addrinfo hints, *servinfo;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET; // using IPv4
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int gaiVal = getaddrinfo(remoteName, remotePort, &hints, &servinfo);
+    if (gaiVal != 0) {
+        fprintf(stderr, "heartbeat: getaddrinfo error: %s\n", gai_strerror(gaiVal));
+        exit(-1);
+    }
+    memcpy(&peerAddr, servinfo->ai_addr, sizeof(peerAddr));
+    freeaddrinfo(servinfo);
+
+    interval = (uint64_t)intervalMs * 1000000;
+    timeout = (uint64_t)timeoutMs * 1000000;
+    heartbeatEnabled = 1;
+}
+
+int isHeartbeatEnabled() {
+    return heartbeatEnabled;
+}
+
+// listenerThread: heartbeats are sent from the listening socket, so pongs come back to it
+void startHeartbeat(int sockfd, TimerWheel* timers) {
+    heartbeatSockfd = sockfd;
+    wheel = timers;
+    addTimer(wheel, &pingTimer, timerNow(), sendPing, NULL);
+}
+
+// listenerThread: an authentic datagram arrived from from, a sign of life if that is the remote client's host
+void heardFromPeer(const struct sockaddr_in* from) {
+    uint64_t now = timerNow();
+
+    if (from->sin_addr.s_addr != peerAddr.sin_addr.s_addr) {
+        return;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    lastHeard = now;
+    pthread_mutex_unlock(&statsMutex);
+
+    // the peer timer only starts once the remote client is up, so it can be started after this one
+    if (!peerHeard) {
+        peerHeard = 1;
+        addTimer(wheel, &peerTimer, now + timeout, checkPeer, NULL);
+    }
+}
+
+// listenerThread: answer pings, take RTT samples from pongs
+void handleHeartbeat(const char* payload, int length, const struct sockaddr_in* from) {
+    Heartbeat heartbeat;
+
+    if (length != sizeof(heartbeat)) {
+        return;
+    }
+    memcpy(&heartbeat, payload, sizeof(heartbeat));
+
+    if (heartbeat.type == HEARTBEAT_PING) {
+        sendHeartbeat(HEARTBEAT_PONG, be64toh(heartbeat.timestamp), from);
+        return;
+    }
+
+    uint64_t sent = be64toh(heartbeat.timestamp);
+    uint64_t now = timerNow();
+    if (heartbeat.type != HEARTBEAT_PONG || sent > now) {
+        return;
+    }
+    uint64_t rtt = now - sent;
+
+    pthread_mutex_lock(&statsMutex);
+    if (pongsReceived == 0) {
+        srtt = rtt;
+        rttvar = rtt / 2;
+    } else {
+        rttvar = (3 * rttvar + absDiff(srtt, rtt)) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+        jitter += ((int64_t)absDiff(rtt, lastRtt) - (int64_t)jitter) / 16;
+    }
+    lastRtt = rtt;
+    pongsReceived++;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+static void formatStats(char* buffer, int capacity) {
+    pthread_mutex_lock(&statsMutex);
+    if (pongsReceived == 0) {
+        snprintf(buffer, capacity, "RTT: no replies yet (%llu pings sent)\n", (unsigned long long)pingsSent);
+    } else {
+        snprintf(buffer, capacity, "RTT: %.1f us (variation %.1f us, jitter %.1f us, last %.1f us), %llu pings sent, %llu replies\n",
+            srtt / 1e3, rttvar / 1e3, jitter / 1e3, lastRtt / 1e3, (unsigned long long)pingsSent, (unsigned long long)pongsReceived);
+    }
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// keyboardThread: "/rtt" prints the current estimates instead of being sent
+// returns 1 if line was the command
+int runHeartbeatCommand(const char* line) {
+    char stats[256];
+
+    if (!heartbeatEnabled || isPipeMode() || strcmp(line, "/rtt\n") != 0) {
+        return 0;
+    }
+
+    formatStats(stats, sizeof(stats));
+    if (write(1, stats, strlen(stats)) == -1) {
+        perror("heartbeat: failed to print RTT");
+    }
+    return 1;
+}
+
+// print the final estimates to stderr (stdout may be a pipe mode stream)
+void printHeartbeatReport() {
+    char stats[256];
+
+    if (!heartbeatEnabled) {
+        return;
+    }
+
+    formatStats(stats, sizeof(stats));
+    fputs(stats, stderr);
+}
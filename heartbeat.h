@@ -0,0 +1,31 @@
+#ifndef _HEARTBEAT_H
+#define _HEARTBEAT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "timerWheel.h"
+
+// heartbeat types
+#define HEARTBEAT_PING 1
+#define HEARTBEAT_PONG 2
+
+// payload of a FRAME_HEARTBEAT frame
+typedef struct Heartbeat_s Heartbeat;
+struct __attribute__((packed)) Heartbeat_s {
+    uint8_t type;        // HEARTBEAT_PING or HEARTBEAT_PONG
+    uint8_t reserved[7];
+    uint64_t timestamp;  // ping: sender's CLOCK_MONOTONIC in ns, pong: the ping's timestamp (network byte order)
+};
+
+void initHeartbeat(int intervalMs, int timeoutMs, char* remoteName, char* remotePort);
+int isHeartbeatEnabled();
+
+void startHeartbeat(int sockfd, TimerWheel* timers);
+void heardFromPeer(const struct sockaddr_in* from);
+void handleHeartbeat(const char* payload, int length, const struct sockaddr_in* from);
+
+int runHeartbeatCommand(const char* line);
+void printHeartbeatReport();
+
+#endif
@@ -0,0 +1,521 @@
+// HISTORY
+// runs historyThread
+// persists sent and received messages to an append-only, length-prefixed history file
+// messages are staged in memory by the sender/listener threads and written in large batches by historyThread,
+// an index file with the offset of every record lets replay/scrollback seek straight to recent messages,
+// the message index (messageIndex.c) is kept up to date with every record for searches
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "history.h"
+#include "messageIndex.h"
+#include "pipeMode.h"
+
+// size of each of the two staging buffers
+#define HISTORY_BUFFER_SIZE (1024 * 1024)
+
+// written records are synced to disk together at most this often
+#define HISTORY_SYNC_INTERVAL_MS 200
+
+// maximum number of messages printed by a search
+#define HISTORY_MAX_RESULTS 20
+
+static int historyEnabled = 0;
+static int logFd = -1;
+static int indexFd = -1;
+static uint64_t logSize;
+
+// in-memory copy of the index file: offsets[n] = offset of record n in the history file
+static uint64_t* offsets;
+static uint64_t recordCount;
+static uint64_t offsetsCapacity;
+static pthread_mutex_t indexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// records waiting to be written, producers fill stagingBuffer while historyThread writes flushBuffer
+static char* stagingBuffer;
+static char* flushBuffer;
+static int stagingLen;
+static int historyStopping;
+static pthread_mutex_t historyMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t historyFlag = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t historySpaceFlag = PTHREAD_COND_INITIALIZER;
+static pthread_t historyThread;
+
+static uint64_t nowNanoseconds(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void appendOffset(uint64_t offset) {
+    if (recordCount == offsetsCapacity) {
+        uint64_t newCapacity = offsetsCapacity == 0 ? 1024 : offsetsCapacity * 2;
+        uint64_t* newOffsets = realloc(offsets, newCapacity * sizeof(uint64_t));
+        if (newOffsets == NULL) {
+            fprintf(stderr, "history: could not grow index\n");
+            exit(-1);
+        }
+        offsets = newOffsets;
+        offsetsCapacity = newCapacity;
+    }
+    offsets[recordCount++] = offset;
+}
+
+static void writeAll(int fd, const char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t res = write(fd, buffer, length);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("history: write() error");
+            exit(-1);
+        }
+        buffer += res;
+        length -= res;
+    }
+}
+
+// 1 if a whole record starts at offset in the history file, its length is set to the record's size
+static int isRecordAt(uint64_t offset, uint64_t* length) {
+    HistoryRecord record;
+
+    if (offset + sizeof(record) > logSize || pread(logFd, &record, sizeof(record), offset) != sizeof(record)) {
+        return 0;
+    }
+    if (offset + sizeof(record) + record.length > logSize) {
+        return 0;
+    }
+    *length = sizeof(record) + record.length;
+    return 1;
+}
+
+// read the index file and bring it up to date with the history file
+// (records written just before a crash may be missing from the index, a torn last record is dropped)
+// the index is trusted up to its last entry that points at a whole record: only the history file past that
+// record is scanned, and the entries for the records found there are appended
+static void loadIndex() {
+    struct stat indexStat;
+    uint64_t offset = 0;
+    uint64_t length;
+
+    if (fstat(indexFd, &indexStat) == -1) {
+        perror("history: fstat() error");
+        exit(-1);
+    }
+
+    uint64_t indexed = indexStat.st_size / sizeof(uint64_t);
+    offsetsCapacity = indexed + 1024;
+    offsets = malloc(offsetsCapacity * sizeof(uint64_t));
+    if (offsets == NULL) {
+        fprintf(stderr, "history: could not allocate index\n");
+        exit(-1);
+    }
+    if (indexed > 0 && pread(indexFd, offsets, indexed * sizeof(uint64_t), 0) != (ssize_t)(indexed * sizeof(uint64_t))) {
+        perror("history: could not read index file");
+        exit(-1);
+    }
+
+    // drop the entries past the end of the history file (e.g. the index was synced, the history file was not)
+    while (indexed > 0 && !isRecordAt(offsets[indexed - 1], &length)) {
+        indexed--;
+    }
+    recordCount = indexed;
+    if (indexed > 0) {
+        offset = offsets[indexed - 1] + length;
+    }
+
+    if ((uint64_t)indexStat.st_size != indexed * sizeof(uint64_t) && ftruncate(indexFd, indexed * sizeof(uint64_t)) == -1) {
+        perror("history: could not truncate index file");
+        exit(-1);
+    }
+
+    // scan the rest of the history file for records that are not indexed yet
+    while (isRecordAt(offset, &length)) {
+        appendOffset(offset);
+        offset += length;
+    }
+
+    // case: the last record is incomplete, drop it
+    if (offset != logSize) {
+        fprintf(stderr, "history: dropping %llu bytes of incomplete history\n", (unsigned long long)(logSize - offset));
+        if (ftruncate(logFd, offset) == -1) {
+            perror("history: ftruncate() error");
+            exit(-1);
+        }
+        logSize = offset;
+    }
+
+    writeAll(indexFd, (const char*)(offsets + indexed), (recordCount - indexed) * sizeof(uint64_t));
+}
+
+// write everything in flushBuffer and index the records it contains
+static void flushRecords(const char* buffer, int length) {
+    uint64_t firstRecord;
+    HistoryRecord record;
+    int pos = 0;
+
+    writeAll(logFd, buffer, length);
+
+    pthread_mutex_lock(&indexMutex);
+    firstRecord = recordCount;
+    while (pos < length) {
+        memcpy(&record, buffer + pos, sizeof(record));
+        appendOffset(logSize + pos);
+        pos += sizeof(record) + record.length;
+    }
+    pthread_mutex_unlock(&indexMutex);
+
+    // make the new records searchable
+    pos = 0;
+    for (uint64_t i = firstRecord; pos < length; i++) {
+        memcpy(&record, buffer + pos, sizeof(record));
+        indexMessage(i, record.direction, record.peerAddr, record.peerPort, buffer + pos + sizeof(record), record.length);
+        pos += sizeof(record) + record.length;
+    }
+
+    writeAll(indexFd, (const char*)(offsets + firstRecord), (recordCount - firstRecord) * sizeof(uint64_t));
+    logSize += length;
+}
+
+void* writeHistory() {
+    uint64_t lastSync = nowNanoseconds(CLOCK_MONOTONIC);
+    int unsynced = 0;
+
+    while (1) {
+        pthread_mutex_lock(&historyMutex);
+
+        // wait for records, waking up in time to sync what has already been written
+        while (stagingLen == 0 && !historyStopping) {
+            if (!unsynced) {
+                pthread_cond_wait(&historyFlag, &historyMutex);
+                continue;
+            }
+
+            struct timespec deadline;
+            uint64_t syncAt = lastSync + (uint64_t)HISTORY_SYNC_INTERVAL_MS * 1000000ULL;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            uint64_t now = nowNanoseconds(CLOCK_MONOTONIC);
+            if (syncAt <= now) {
+                break;
+            }
+            uint64_t wait = (uint64_t)deadline.tv_nsec + (syncAt - now);
+            deadline.tv_sec += wait / 1000000000ULL;
+            deadline.tv_nsec = wait % 1000000000ULL;
+            if (pthread_cond_timedwait(&historyFlag, &historyMutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        // swap buffers so producers can keep staging records while this batch is written
+        char* batch = stagingBuffer;
+        int batchLen = stagingLen;
+        int stopping = historyStopping;
+        stagingBuffer = flushBuffer;
+        flushBuffer = batch;
+        stagingLen = 0;
+        pthread_cond_broadcast(&historySpaceFlag);
+        pthread_mutex_unlock(&historyMutex);
+
+        if (batchLen > 0) {
+            flushRecords(batch, batchLen);
+            unsynced = 1;
+        }
+
+        // group commit: one sync covers every batch written since the last one
+        uint64_t now = nowNanoseconds(CLOCK_MONOTONIC);
+        if (unsynced && (stopping || now - lastSync >= (uint64_t)HISTORY_SYNC_INTERVAL_MS * 1000000ULL)) {
+            fdatasync(logFd);
+            fdatasync(indexFd);
+            lastSync = now;
+            unsynced = 0;
+        }
+
+        if (stopping) {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// index every record already in the history file, mapping it in one go instead of reading record by record
+static void buildMessageIndex() {
+    HistoryRecord record;
+
+    initMessageIndex();
+    if (logSize == 0) {
+        return;
+    }
+
+    char* log = mmap(NULL, logSize, PROT_READ, MAP_PRIVATE, logFd, 0);
+    if (log == MAP_FAILED) {
+        perror("history: mmap() error");
+        exit(-1);
+    }
+    madvise(log, logSize, MADV_SEQUENTIAL);
+
+    for (uint64_t i = 0; i < recordCount; i++) {
+        memcpy(&record, log + offsets[i], sizeof(record));
+        indexMessage(i, record.direction, record.peerAddr, record.peerPort, log + offsets[i] + sizeof(record), record.length);
+    }
+
+    munmap(log, logSize);
+}
+
+void initHistory(char* path) {
+    // the index path is <path>.idx, copied rather than sprintf'd: with -fsanitize=undefined gcc
+    // takes path for a possible NULL and -Wformat-overflow stops the asan build
+    size_t pathLen = strlen(path);
+    char* indexPath = malloc(pathLen + sizeof(".idx"));
+    if (indexPath == NULL) {
+        fprintf(stderr, "history: could not allocate index path\n");
+        exit(-1);
+    }
+    memcpy(indexPath, path, pathLen);
+    memcpy(indexPath + pathLen, ".idx", sizeof(".idx"));
+
+    logFd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    indexFd = open(indexPath, O_RDWR | O_CREAT | O_APPEND, 0600);
+    free(indexPath);
+
+    if (logFd == -1 || indexFd == -1) {
+        perror("history: could not open history file");
+        exit(-1);
+    }
+
+    logSize = lseek(logFd, 0, SEEK_END);
+    loadIndex();
+    buildMessageIndex();
+
+    stagingBuffer = malloc(HISTORY_BUFFER_SIZE);
+    flushBuffer = malloc(HISTORY_BUFFER_SIZE);
+    if (stagingBuffer == NULL || flushBuffer == NULL) {
+        fprintf(stderr, "history: could not allocate buffers\n");
+        exit(-1);
+    }
+    stagingLen = 0;
+    historyStopping = 0;
+    historyEnabled = 1;
+
+    // create historyThread - writes staged records to the history file
+    int res = pthread_create(&historyThread, NULL, writeHistory, NULL);
+    if (res != 0) {
+        perror("history: thread creation error");
+        exit(-1);
+    }
+}
+
+int isHistoryEnabled() {
+    return historyEnabled;
+}
+
+// stage a copy of message to be written to the history file
+void recordHistory(const char* message, int length, int direction, const struct sockaddr_in* peer) {
+    HistoryRecord record;
+    int recordLen = sizeof(record) + length;
+
+    if (!historyEnabled || recordLen > HISTORY_BUFFER_SIZE) {
+        return;
+    }
+
+    record.length = length;
+    record.direction = direction;
+    record.reserved = 0;
+    record.peerPort = peer != NULL ? peer->sin_port : 0;
+    record.peerAddr = peer != NULL ? peer->sin_addr.s_addr : 0;
+    record.timestamp = nowNanoseconds(CLOCK_REALTIME);
+
+    pthread_mutex_lock(&historyMutex);
+
+    // case: staging buffer is full, wait for historyThread to swap it out
+    while (stagingLen + recordLen > HISTORY_BUFFER_SIZE && !historyStopping) {
+        pthread_cond_signal(&historyFlag);
+        pthread_cond_wait(&historySpaceFlag, &historyMutex);
+    }
+
+    if (!historyStopping) {
+        memcpy(stagingBuffer + stagingLen, &record, sizeof(record));
+        memcpy(stagingBuffer + stagingLen + sizeof(record), message, length);
+
+        // wake historyThread on the first record of a batch
+        if (stagingLen == 0) {
+            pthread_cond_signal(&historyFlag);
+        }
+        stagingLen += recordLen;
+    }
+
+    pthread_mutex_unlock(&historyMutex);
+}
+
+// print the last count messages from the history file
+void replayHistory(int count) {
+    HistoryRecord record;
+    char* message = NULL;
+    uint32_t messageCapacity = 0;
+
+    if (!historyEnabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&indexMutex);
+    uint64_t first = (uint64_t)count < recordCount ? recordCount - count : 0;
+    uint64_t last = recordCount;
+    pthread_mutex_unlock(&indexMutex);
+
+    for (uint64_t i = first; i < last; i++) {
+        pthread_mutex_lock(&indexMutex);
+        uint64_t offset = offsets[i];
+        pthread_mutex_unlock(&indexMutex);
+
+        if (pread(logFd, &record, sizeof(record), offset) != sizeof(record)) {
+            break;
+        }
+
+        if (record.length > messageCapacity) {
+            char* newMessage = realloc(message, record.length);
+            if (newMessage == NULL) {
+                fprintf(stderr, "history: could not allocate replay buffer\n");
+                exit(-1);
+            }
+            message = newMessage;
+            messageCapacity = record.length;
+        }
+        if (pread(logFd, message, record.length, offset + sizeof(record)) != record.length) {
+            break;
+        }
+
+        const char* header = record.direction == HISTORY_SENT ? "You: " : "Remote Client: ";
+        writeAll(1, header, strlen(header));
+        writeAll(1, message, record.length);
+    }
+
+    free(message);
+}
+
+static void printMatch(uint64_t sequence, const IndexedMessage* message, const char* text) {
+    char peer[INET_ADDRSTRLEN];
+    char prefix[64];
+
+    if (message->direction == HISTORY_SENT) {
+        snprintf(prefix, sizeof(prefix), "[%llu] You: ", (unsigned long long)sequence);
+    } else {
+        struct in_addr addr = { .s_addr = message->peerAddr };
+        inet_ntop(AF_INET, &addr, peer, sizeof(peer));
+        snprintf(prefix, sizeof(prefix), "[%llu] %s:%d: ", (unsigned long long)sequence, peer, ntohs(message->peerPort));
+    }
+
+    writeAll(1, prefix, strlen(prefix));
+    writeAll(1, text, message->length);
+    if (message->length == 0 || text[message->length - 1] != '\n') {
+        writeAll(1, "\n", 1);
+    }
+}
+
+// search the history for messages containing text and print the most recent matches
+void searchHistory(const char* text) {
+    if (historyEnabled && searchMessages(text, HISTORY_MAX_RESULTS, printMatch) == 0) {
+        writeAll(1, "No messages found\n", strlen("No messages found\n"));
+    }
+}
+
+// run a history command typed at the keyboard:
+//   /search [text]          most recent messages containing text
+//   /from [address][:port]  most recent messages from a remote client
+//   /seq [number]           message with the given sequence number
+//   /history [count]        last count messages
+// returns 1 if line was a history command, 0 if it is a regular message
+int runHistoryCommand(const char* line) {
+    char argument[256];
+    int length = strlen(line);
+
+    if (!historyEnabled || isPipeMode() || length == 0 || line[0] != '/' || strchr(line, '\n') != line + length - 1 || length > (int)sizeof(argument)) {
+        return 0;
+    }
+
+    if (sscanf(line, "/search %255[^\n]", argument) == 1) {
+        searchHistory(argument);
+        return 1;
+    }
+
+    if (sscanf(line, "/from %255[^\n]", argument) == 1) {
+        struct in_addr addr;
+        int port = 0;
+        char* separator = strrchr(argument, ':');
+
+        // the port is optional, the remote client sends from a different port than the one it listens on
+        if (separator != NULL) {
+            port = atoi(separator + 1);
+            if (port <= 0 || port > 65535) {
+                writeAll(1, "Usage: /from [address][:port]\n", strlen("Usage: /from [address][:port]\n"));
+                return 1;
+            }
+            *separator = '\0';
+        }
+        if (inet_pton(AF_INET, argument, &addr) != 1) {
+            writeAll(1, "Usage: /from [address][:port]\n", strlen("Usage: /from [address][:port]\n"));
+            return 1;
+        }
+
+        if (findMessagesFromPeer(addr.s_addr, htons(port), HISTORY_MAX_RESULTS, printMatch) == 0) {
+            writeAll(1, "No messages found\n", strlen("No messages found\n"));
+        }
+        return 1;
+    }
+
+    unsigned long long sequence;
+    if (sscanf(line, "/seq %llu", &sequence) == 1) {
+        if (!findMessage(sequence, printMatch)) {
+            writeAll(1, "No messages found\n", strlen("No messages found\n"));
+        }
+        return 1;
+    }
+
+    int count;
+    if (sscanf(line, "/history %d", &count) == 1) {
+        replayHistory(count);
+        return 1;
+    }
+
+    return 0;
+}
+
+void closeHistory() {
+    if (!historyEnabled) {
+        return;
+    }
+
+    // stop historyThread once it has written and synced everything staged so far
+    pthread_mutex_lock(&historyMutex);
+    historyStopping = 1;
+    pthread_cond_signal(&historyFlag);
+    pthread_mutex_unlock(&historyMutex);
+
+    // join (wait for and detach) historyThread
+    int res = pthread_join(historyThread, NULL);
+    if (res != 0) {
+        perror("history: thread could not be joined\n");
+        exit(-1);
+    }
+
+    close(logFd);
+    close(indexFd);
+    free(stagingBuffer);
+    free(flushBuffer);
+    free(offsets);
+    destroyMessageIndex();
+    offsets = NULL;
+    recordCount = offsetsCapacity = 0;
+    historyEnabled = 0;
+}
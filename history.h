@@ -0,0 +1,31 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+// record directions
+#define HISTORY_SENT 0
+#define HISTORY_RECEIVED 1
+
+// each record in the history file is [HistoryRecord][message bytes]
+// record n starts at the nth uint64_t offset stored in the index file ([history file].idx)
+typedef struct HistoryRecord_s HistoryRecord;
+struct __attribute__((packed)) HistoryRecord_s {
+    uint32_t length;    // number of message bytes after the record header
+    uint8_t direction;  // HISTORY_SENT or HISTORY_RECEIVED
+    uint8_t reserved;
+    uint16_t peerPort;  // network byte order, 0 for sent messages
+    uint32_t peerAddr;  // network byte order, 0 for sent messages
+    uint64_t timestamp; // CLOCK_REALTIME in ns
+};
+
+void initHistory(char* path);
+int isHistoryEnabled();
+void recordHistory(const char* message, int length, int direction, const struct sockaddr_in* peer);
+void replayHistory(int count);
+void searchHistory(const char* text);
+int runHistoryCommand(const char* line);
+void closeHistory();
+
+#endif
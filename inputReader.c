@@ -4,93 +4,356 @@
 
 // INPUT READER
 // runs keyboardThread
-// awaits keyboard input and adds message to inputList
+// awaits keyboard input (or length-prefixed messages in pipe mode) and adds message to inputQueue
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+#include <errno.h>
 
-#include "list.h"
 #include "threadManager.h"
 #include "inputReader.h"
 #include "outputWriter.h"
 #include "UDPClient.h"
 #include "UDPServer.h"
+#include "freeManager.h"
+#include "echo.h"
+#include "frame.h"
+#include "history.h"
+#include "pipeMode.h"
+#include "threadOptions.h"
+#include "heartbeat.h"
+#include "config.h"
+#include "rooms.h"
+#include "tui.h"
 
-// limit for UDP datagram under IPv4 is 65507
-#define MAX_LEN_BUFFER 65491  // 65507 - 15 (for header) - 1 (for '\0')
-
-static List* inputList;
+static MessageQueue* inputQueue;
 static pthread_t keyboardThread;
 
+// send the final "!\n" message and stop the other threads
+static void endSession() {
+    signalUDPClient(); 
+    requestShutdown();
+}
+
+// the "!\n" message that ends the session when it is not typed (end of input)
+static char* allocEndOfSession() {
+    char* message = allocMessage(strlen("!\n"));
+    strcpy(message, "!\n");
+    getMessageInfo(message)->endOfSession = 1;
+    return message;
+}
+
+// wait until stdin is readable or the session is ending
+// returns 1 if input is available, 0 on shutdown
+static int waitForInput() {
+    struct pollfd fds[2] = {
+        { .fd = 0, .events = POLLIN },
+        { .fd = getShutdownFd(), .events = POLLIN }
+    };
+
+    while (!isShuttingDown()) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                // --tui: the terminal was resized
+                if (isTuiEnabled()) {
+                    refreshTuiInput();
+                }
+                continue;
+            }
+            perror("inputReader: poll() error");
+            exit(-1);
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// longest message read from stdin: --max-message-length, less room for the frame header and authentication tag
+// when framing is enabled
+static int getReadLimit() {
+    int maxMessageLen = getConfig()->maxMessageLen;
+    if (isFramingEnabled() && maxMessageLen > (int)(MAX_LEN_DATAGRAM - FRAME_OVERHEAD)) {
+        return MAX_LEN_DATAGRAM - FRAME_OVERHEAD;
+    }
+    return maxMessageLen;
+}
+
+// end of input (or a pipe mode error): send the final "!\n" message after the queued ones, free the read buffer
+// and stop the other threads
+static void endInput(char* buffer) {
+    char* message = allocEndOfSession();
+    if (addMessageWait(inputQueue, message) == MESSAGE_QUEUE_FAIL) {
+        releaseMessage(message);
+    }
+    free(buffer);
+    endSession();
+}
+
 void* readKeyboardInput() {
+    int readLimit = getReadLimit();
+    char* messageBuffer = malloc(readLimit);
+
+    if (messageBuffer == NULL) {
+        fprintf(stderr, "inputReader: could not allocate message buffer\n");
+        exit(-1);
+    }
+
     while (1) {
         char *message;
-        char messageBuffer[MAX_LEN_BUFFER]; 
         int numbytes;
 
         // run once before checking while condition
         do {
             // clear the messageBuffer to store input
-            memset(&messageBuffer, 0, MAX_LEN_BUFFER);
+            memset(messageBuffer, 0, readLimit);
+
+            // case: session ended remotely while waiting for input
+            if (!waitForInput()) {
+                free(messageBuffer);
+                return NULL;
+            }
 
             // store user input
-            numbytes = read(0,messageBuffer, MAX_LEN_BUFFER);
+            numbytes = read(0,messageBuffer, readLimit);
 
             if(numbytes == -1) {
                 perror("inputReader: failed to read keyboard input\n");
                 exit(-1);
             }
 
+            // end of input (Ctrl-D, or stdin was closed) ends the session as if the user had entered "!"
+            if (numbytes == 0) {
+                endInput(messageBuffer);
+                return NULL;
+            }
+
             // store messsage
-            message = (char *)malloc(sizeof(char) * (numbytes + 1));
+            message = allocMessage(numbytes);
             strncpy(message, messageBuffer, numbytes);
             message[numbytes] = '\0';
 
-            // add message to inputList
-            int res = addMessage(inputList, message);
+            // history commands (/search, /from, ...), /rtt and room commands are run locally instead of being sent
+            if (runHistoryCommand(message) || runHeartbeatCommand(message) || runRoomCommand(message)) {
+                releaseMessage(message);
+                continue;
+            }
+
+            // stop reading if user enters "!\n" (checked before UDPClient can send and release message)
+            int endOfSession = !strcmp(message, "!\n");
+            getMessageInfo(message)->endOfSession = endOfSession;
+
+            // --echo: show the message without waiting for UDPClient to send it
+            echoMessage(message);
 
-            if(res == LIST_FAIL) {
-                fprintf(stderr,"inputReader: failed to add message to inputList\n");
+            // add message to inputQueue (waits for UDPClient to make room if it is full)
+            if (addMessageWait(inputQueue, message) == MESSAGE_QUEUE_FAIL) {
+                releaseMessage(message);
+                free(messageBuffer);
+                return NULL;
             }
 
-            // stop reading if user enters "!\n"
-            if (!strcmp(message, "!\n")) {
-                signalUDPClient(); 
-                cancelOutputWriter(); 
-                cancelUDPServer();
+            if (endOfSession) {
+                free(messageBuffer);
+                endSession();
                 return NULL;
             }
 
             // if the user presses enter (adds '\n' to end of message), jump out of loop and stop reading input
         } while (messageBuffer[numbytes - 1] != '\n'); 
 
-        // signal UDPClient to send the message
-        signalUDPClient();
+        // signal UDPClient to send the message (unless the line was a history command)
+        if (countMessages(inputQueue) != 0) {
+            signalUDPClient();
+        }
     }
 
     return NULL;
 }
 
-void initInputReader(List* list) {
-    inputList = list;
+// --tui: a typed line (or a local command, whose output goes into the scroll region) is queued like in
+// readKeyboardInput, returns 0 when keyboardThread has to stop
+static int submitLine(char* message) {
+    // commands all start with '/'
+    if (message[0] == '/') {
+        beginTuiOutput();
+        int isCommand = runHistoryCommand(message) || runHeartbeatCommand(message) || runRoomCommand(message);
+        endTuiOutput();
+        if (isCommand) {
+            releaseMessage(message);
+            return 1;
+        }
+    }
+
+    int endOfSession = !strcmp(message, "!\n");
+    getMessageInfo(message)->endOfSession = endOfSession;
+
+    echoMessage(message);
+
+    if (addMessageWait(inputQueue, message) == MESSAGE_QUEUE_FAIL) {
+        releaseMessage(message);
+        return 0;
+    }
+    signalUDPClient();
+
+    if (endOfSession) {
+        endSession();
+        return 0;
+    }
+    return 1;
+}
+
+// --tui: keys edit the input line at the bottom of the terminal (see tui.c), Enter sends it
+void* readTuiInput() {
+    int readLimit = getReadLimit();
+    char keys[256];
 
-    // create the keyboardThread - does nothing other than await input from the keyboard
-    int res =  pthread_create(&keyboardThread, NULL, readKeyboardInput, NULL);
-    
-    if(res !=0) {
-        perror("inputReader: thread creation error");
+    // room for the '\n' added by takeTuiInput
+    startTuiInput(readLimit - 1);
+    refreshTuiInput();
+
+    while (1) {
+        // case: session ended remotely while waiting for input
+        if (!waitForInput()) {
+            return NULL;
+        }
+
+        int numbytes = read(0, keys, sizeof(keys));
+
+        if (numbytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("inputReader: failed to read keyboard input\n");
+            exit(-1);
+        }
+
+        // end of input (terminal hung up) ends the session
+        if (numbytes == 0) {
+            submitLine(allocEndOfSession());
+            return NULL;
+        }
+
+        int pos = 0;
+        while (pos < numbytes) {
+            int lineDone;
+            pos += editTuiInput(keys + pos, numbytes - pos, &lineDone);
+
+            if (lineDone) {
+                char* message = allocMessage(getTuiInputLength() + 1);
+                takeTuiInput(message);
+                if (!submitLine(message)) {
+                    refreshTuiInput();
+                    return NULL;
+                }
+            }
+        }
+
+        refreshTuiInput();
+    }
+
+    return NULL;
+}
+
+// pipe mode: read stdin in large blocks and split it into length-prefixed messages,
+// so a burst of messages costs one read() and one signal to UDPClient
+void* readPipeInput() {
+    int bufferSize = getConfig()->pipeBufferSize;
+    char* buffer = malloc(bufferSize);
+    int bufferLen = 0;
+    int maxMessageLen = getReadLimit();
+
+    if (buffer == NULL) {
+        fprintf(stderr, "inputReader: could not allocate pipe buffer\n");
         exit(-1);
     }
+
+    while (1) {
+        // case: session ended remotely while waiting for input
+        if (!waitForInput()) {
+            free(buffer);
+            return NULL;
+        }
+
+        int numbytes = read(0, buffer + bufferLen, bufferSize - bufferLen);
+
+        if (numbytes == -1) {
+            perror("inputReader: failed to read pipe input\n");
+            exit(-1);
+        }
+
+        // end of input ends the session
+        if (numbytes == 0) {
+            endInput(buffer);
+            return NULL;
+        }
+        bufferLen += numbytes;
+
+        // queue every complete message in the buffer
+        int pos = 0;
+        while (bufferLen - pos >= PIPE_LENGTH_PREFIX) {
+            uint32_t length = readPipeLength(buffer + pos);
+
+            // the messages before it are still sent, so the remote client sees the session end instead of waiting
+            if (length > (uint32_t)maxMessageLen) {
+                fprintf(stderr, "inputReader: pipe message of %u bytes is larger than the limit of %d bytes, ending the session\n", length, maxMessageLen);
+                endInput(buffer);
+                return NULL;
+            }
+
+            // case: rest of the message has not been read yet
+            if ((uint32_t)(bufferLen - pos - PIPE_LENGTH_PREFIX) < length) {
+                break;
+            }
+
+            char* payload = buffer + pos + PIPE_LENGTH_PREFIX;
+            pos += PIPE_LENGTH_PREFIX + length;
+
+            // any bytes can be sent, the message keeps its length (see MessageInfo) and only the end of stdin ends the session
+            char* message = allocMessage(length);
+            memcpy(message, payload, length);
+            message[length] = '\0';
+
+            // wake UDPClient as soon as there is something to send, so it drains the queue while the rest is parsed
+            int count = addMessageWait(inputQueue, message);
+            if (count == MESSAGE_QUEUE_FAIL) {
+                releaseMessage(message);
+                free(buffer);
+                return NULL;
+            }
+            if (count == 1) {
+                signalUDPClient();
+            }
+        }
+
+        // keep the partial message at the front of the buffer
+        memmove(buffer, buffer + pos, bufferLen - pos);
+        bufferLen -= pos;
+
+        if (countMessages(inputQueue) != 0) {
+            signalUDPClient();
+        }
+    }
+
+    return NULL;
 }
 
-void cancelInputReader() {
-    // cancel the keyboard thread
-    int res = pthread_cancel(keyboardThread);
-    if (res != 0) {
-        perror("inputReader: thread could not be cancelled\n");
+void initInputReader(MessageQueue* queue) {
+    inputQueue = queue;
+
+    // create the keyboardThread - does nothing other than await input from the keyboard (or the pipe)
+    void* (*reader)() = isPipeMode() ? readPipeInput : isTuiEnabled() ? readTuiInput : readKeyboardInput;
+    int res =  createPipelineThread(THREAD_KEYBOARD, &keyboardThread, reader);
+    
+    if(res !=0) {
+        perror("inputReader: thread creation error");
         exit(-1);
     }
 }
@@ -1,11 +1,11 @@
 #ifndef _INPUT_READER_H
 #define _INPUT_READER_H
 
-#include "list.h"
+#include "freeManager.h"
 
 void* readKeyboardInput();
-void initInputReader(List* list);
-void cancelInputReader();
+void* readPipeInput();
+void initInputReader(MessageQueue* queue);
 void closeInputReader();
 
 #endif
\ No newline at end of file
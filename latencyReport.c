@@ -0,0 +1,187 @@
+// LATENCY REPORT
+// per stage latency breakdown of received messages, printed when the session ends
+// - network:      remote client framed the message -> kernel received the datagram (needs synchronized clocks across machines)
+// - socket queue: kernel received the datagram -> listenerThread received it
+// - listener:     listenerThread received it -> added to outputQueue (decrypting, decompressing, adding the header)
+// - output queue: added to outputQueue -> writerThread took it from the queue
+// - write:        writerThread took it from the queue -> the write() containing it returned
+// - total:        remote client framed the message (or kernel received it) -> written
+// samples are only added by writerThread, the report is printed after it has been joined
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latencyReport.h"
+
+// log-linear histogram: values below 16 ns have their own bucket, above that every power of 2 is split into 16 buckets
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+enum { STAGE_NETWORK, STAGE_SOCKET_QUEUE, STAGE_LISTENER, STAGE_OUTPUT_QUEUE, STAGE_WRITE, STAGE_TOTAL, NUM_STAGES };
+
+typedef struct Stage_s Stage;
+struct Stage_s {
+    const char* name;
+    uint64_t count;
+    uint64_t skipped; // samples without both timestamps, or with the end before the start (clock skew)
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+// a message taken from outputQueue whose write() has not returned yet
+typedef struct PendingSample_s PendingSample;
+struct PendingSample_s {
+    MessageInfo info;
+    uint64_t dequeueTime;
+};
+
+static int latencyReport = 0;
+static Stage* stages;
+static PendingSample* pending;
+static int pendingCount;
+static int pendingCapacity;
+
+static const char* stageNames[NUM_STAGES] = { "network", "socket queue", "listener", "output queue", "write", "total" };
+
+uint64_t realtimeNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int bucketIndex(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    int subBucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+// smallest value that falls in bucket index
+static uint64_t bucketValue(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t subBucket = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + subBucket) << (exponent - SUB_BUCKET_BITS);
+}
+
+static uint64_t percentile(const Stage* stage, double fraction) {
+    uint64_t rank = (uint64_t)(stage->count * fraction);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += stage->buckets[i];
+        if (seen > rank) {
+            return bucketValue(i);
+        }
+    }
+    return stage->max;
+}
+
+static void addSample(int stage, uint64_t start, uint64_t end) {
+    Stage* s = &stages[stage];
+
+    if (start == 0 || end == 0 || end < start) {
+        s->skipped++;
+        return;
+    }
+
+    uint64_t value = end - start;
+    s->count++;
+    s->sum += value;
+    if (value > s->max) {
+        s->max = value;
+    }
+    s->buckets[bucketIndex(value)]++;
+}
+
+void initLatencyReport() {
+    stages = calloc(NUM_STAGES, sizeof(Stage));
+    if (stages == NULL) {
+        fprintf(stderr, "latencyReport: out of memory\n");
+        exit(-1);
+    }
+
+    for (int i = 0; i < NUM_STAGES; i++) {
+        stages[i].name = stageNames[i];
+    }
+    latencyReport = 1;
+}
+
+int isLatencyReportEnabled() {
+    return latencyReport;
+}
+
+// writerThread: remember info (copied, the message can be freed right away) until the write() containing it returns
+void addLatencySample(const MessageInfo* info, uint64_t dequeueTime) {
+    if (pendingCount == pendingCapacity) {
+        pendingCapacity = pendingCapacity == 0 ? 256 : pendingCapacity * 2;
+        pending = realloc(pending, pendingCapacity * sizeof(PendingSample));
+        if (pending == NULL) {
+            fprintf(stderr, "latencyReport: out of memory\n");
+            exit(-1);
+        }
+    }
+
+    pending[pendingCount].info = *info;
+    pending[pendingCount].dequeueTime = dequeueTime;
+    pendingCount++;
+}
+
+// writerThread: every pending sample has been written at writeTime
+void completeLatencySamples(uint64_t writeTime) {
+    for (int i = 0; i < pendingCount; i++) {
+        const MessageInfo* info = &pending[i].info;
+
+        addSample(STAGE_NETWORK, info->sendTime, info->kernelTime);
+        addSample(STAGE_SOCKET_QUEUE, info->kernelTime, info->receiveTime);
+        addSample(STAGE_LISTENER, info->receiveTime, info->enqueueTime);
+        addSample(STAGE_OUTPUT_QUEUE, info->enqueueTime, pending[i].dequeueTime);
+        addSample(STAGE_WRITE, pending[i].dequeueTime, writeTime);
+        addSample(STAGE_TOTAL, info->sendTime != 0 ? info->sendTime : info->kernelTime, writeTime);
+    }
+    pendingCount = 0;
+}
+
+// print the report to stderr (stdout may be a pipe mode stream)
+void printLatencyReport() {
+    if (!latencyReport) {
+        return;
+    }
+
+    fprintf(stderr, "latency report (us)    messages      mean       p50       p99     p99.9       max\n");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const Stage* s = &stages[i];
+
+        if (s->count == 0) {
+            fprintf(stderr, "  %-20s %8d         -         -         -         -         -", s->name, 0);
+        } else {
+            fprintf(stderr, "  %-20s %8llu %9.1f %9.1f %9.1f %9.1f %9.1f", s->name, (unsigned long long)s->count,
+                s->sum / (double)s->count / 1e3, percentile(s, 0.5) / 1e3, percentile(s, 0.99) / 1e3,
+                percentile(s, 0.999) / 1e3, s->max / 1e3);
+        }
+
+        if (s->skipped != 0) {
+            fprintf(stderr, "  (%llu skipped)", (unsigned long long)s->skipped);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+void destroyLatencyReport() {
+    free(stages);
+    free(pending);
+    stages = NULL;
+    pending = NULL;
+    pendingCount = pendingCapacity = 0;
+    latencyReport = 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _LATENCY_REPORT_H
+#define _LATENCY_REPORT_H
+
+#include <stdint.h>
+
+#include "freeManager.h"
+
+void initLatencyReport();
+int isLatencyReportEnabled();
+uint64_t realtimeNanoseconds();
+
+void addLatencySample(const MessageInfo* info, uint64_t dequeueTime);
+void completeLatencySamples(uint64_t writeTime);
+
+void printLatencyReport();
+void destroyLatencyReport();
+
+#endif
@@ -535,14 +535,14 @@ void* List_trim(List* pList) {
     void *lastItem = pList->tail->item;
 
     if (pList->size == 1) {
-        // add node to available nodes
-        pList->curr->next = availableNode;
+        // add node to available nodes (the tail: current may be before the start or beyond the end)
+        pList->tail->next = availableNode;
 
         if (availableNode != NULL) {
-            availableNode->prev = pList->curr;
+            availableNode->prev = pList->tail;
         }
 
-        availableNode = pList->curr;
+        availableNode = pList->tail;
         availableNode->prev = NULL;
 
         // reset to defaul values
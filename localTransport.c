@@ -0,0 +1,218 @@
+// References:
+// unix(7) - pathname socket addresses
+// getifaddrs(3)
+
+// LOCAL TRANSPORT
+// same-host peers skip the UDP/IP stack (routing, checksums, the loopback device) for their messages:
+// - listenerThread also receives on an AF_UNIX datagram socket named after its UDP port, "/tmp/s-talk-<uid>/<port>"
+// - senderThread sends to that socket instead of the UDP port when the remote machine is this host
+//   (a loopback address or one of its interfaces' addresses) and the remote client has one
+// the directory belongs to the user and only they can access it (it is not used otherwise), so only their own
+// clients can send to the socket or stand in for it: other users' clients stay on UDP
+// datagrams are the same frames or plain text as over UDP, behind a LocalHeader with their length and the sender's
+// UDP port: a batch of datagrams of one length (see offload.c) is sent as one local datagram, like UDP segmentation
+// offload does
+// heartbeats stay on UDP (their pongs are sent back to the UDP source address)
+// a full AF_UNIX receive queue does not block senderThread: the datagram that did not fit is sent over UDP instead
+// (and may overtake the ones still queued, the receiver reads UDP first)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "localTransport.h"
+#include "transport.h"
+
+static int localTransportEnabled = 1;
+
+// path of listenerThread's local socket, removed when it is closed ("" if there is none)
+static char listenerPath[sizeof(((struct sockaddr_un*)0)->sun_path)] = "";
+
+// senderThread's UDP port (network byte order), sent with its local datagrams
+static uint16_t sourcePort = 0;
+
+// --udp-only: always send over UDP, and do not listen on a local socket
+void disableLocalTransport() {
+    localTransportEnabled = 0;
+}
+
+int isLocalTransportEnabled() {
+    return localTransportEnabled;
+}
+
+// the user's directory of local sockets, created if create is set
+// returns -1 if it is missing or someone else could have put a socket in it (not a directory of the user's
+// that only they can access)
+static int checkLocalDirectory(const char* dir, int create) {
+    struct stat st;
+
+    if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    if (lstat(dir, &st) == -1) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// AF_UNIX address for UDP port (host byte order), returns its length, or -1 if the directory is not safe to use
+static int localAddress(struct sockaddr_un* addr, int port, int create) {
+    char dir[64];
+
+    snprintf(dir, sizeof(dir), "/tmp/s-talk-%d", (int)getuid());
+    if (checkLocalDirectory(dir, create) == -1) {
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%d", dir, port);
+    return sizeof(*addr);
+}
+
+// listenerThread: local socket for the UDP port sockfd is bound to, -1 if there is none (local transport is
+// disabled or the directory cannot be used)
+// a socket left behind by a client that did not end cleanly is replaced: the UDP port is this client's now
+int openLocalListener(int sockfd) {
+    struct sockaddr_in udpAddr;
+    socklen_t udpAddrLen = sizeof(udpAddr);
+    struct sockaddr_un addr;
+
+    if (!localTransportEnabled) {
+        return -1;
+    }
+
+    if (getsockname(sockfd, (struct sockaddr*)&udpAddr, &udpAddrLen) == -1) {
+        perror("localTransport: getsockname() error");
+        return -1;
+    }
+
+    int addrLen = localAddress(&addr, ntohs(udpAddr.sin_port), 1);
+    if (addrLen == -1) {
+        fprintf(stderr, "localTransport: /tmp/s-talk-%d is not a private directory, same-host messages use UDP\n", (int)getuid());
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("localTransport: socket() error");
+        return -1;
+    }
+
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr*)&addr, addrLen) == -1) {
+        perror("localTransport: could not bind the local socket, same-host messages use UDP");
+        close(fd);
+        return -1;
+    }
+
+    strcpy(listenerPath, addr.sun_path);
+    return fd;
+}
+
+// close listenerThread's local socket and remove its name
+void closeLocalListener(int fd) {
+    close(fd);
+    if (listenerPath[0] != '\0') {
+        unlink(listenerPath);
+        listenerPath[0] = '\0';
+    }
+}
+
+// senderThread, for a remote client on this host: bind sockfd (an IPv4 UDP socket) to the port its messages are
+// sent from, so its local datagrams can carry that port (the receiver records it like a UDP source port)
+void bindSourcePort(int sockfd) {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = 0;
+
+    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1
+        || getsockname(sockfd, (struct sockaddr*)&addr, &addrLen) == -1) {
+        perror("localTransport: could not bind the UDP socket, local datagrams are sent with port 0");
+        return;
+    }
+    sourcePort = addr.sin_port;
+}
+
+// 1 if addr (IPv4) is a loopback address or the address of one of this host's interfaces
+int isLocalAddress(const struct sockaddr* addr) {
+    struct ifaddrs *interfaces, *i;
+    int local = 0;
+
+    if (addr->sa_family != AF_INET) {
+        return 0;
+    }
+
+    in_addr_t ip = ((const struct sockaddr_in*)addr)->sin_addr.s_addr;
+    if ((ntohl(ip) >> 24) == IN_LOOPBACKNET) {
+        return 1;
+    }
+
+    if (getifaddrs(&interfaces) == -1) {
+        return 0;
+    }
+    for (i = interfaces; i != NULL && !local; i = i->ifa_next) {
+        if (i->ifa_addr != NULL && i->ifa_addr->sa_family == AF_INET) {
+            local = ((struct sockaddr_in*)i->ifa_addr)->sin_addr.s_addr == ip;
+        }
+    }
+    freeifaddrs(interfaces);
+
+    return local;
+}
+
+// senderThread: socket connected to the local socket of the remote client listening on addr (a local address),
+// -1 if it does not have one (not started yet, --udp-only, another user's client, or an older version)
+int connectLocalPeer(const struct sockaddr* addr) {
+    struct sockaddr_un localAddr;
+
+    int addrLen = localAddress(&localAddr, ntohs(((const struct sockaddr_in*)addr)->sin_port), 0);
+    if (addrLen == -1) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("localTransport: socket() error");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&localAddr, addrLen) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// send length bytes of datagrams of segmentSize bytes (the last one may be shorter) as one local datagram
+// returns length, 0 if the remote client's receive queue is full (nothing was sent, send them over UDP), or -1 if
+// it could not be sent
+int sendLocal(int fd, const char* buffer, int length, int segmentSize) {
+    LocalHeader header = { .segmentSize = segmentSize, .port = sourcePort };
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = (char*)buffer, .iov_len = length }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+    if (getTransport()->sendMsg(fd, &msg, MSG_DONTWAIT) != (ssize_t)(sizeof(header) + length)) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    return length;
+}
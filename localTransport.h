@@ -0,0 +1,33 @@
+#ifndef _LOCAL_TRANSPORT_H
+#define _LOCAL_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// a local datagram starts with the size of the datagrams it holds (one, or a batch of equal-sized ones)
+// and the UDP port of the client that sent it
+typedef struct LocalHeader_s LocalHeader;
+struct LocalHeader_s {
+    uint16_t segmentSize;
+    uint16_t port; // network byte order
+};
+
+// a same-host remote client that has no local socket (yet) is looked for again at most this often
+#define LOCAL_RETRY_NS 1000000000ULL
+// while the remote client's local receive queue is full, a datagram waits this long for room before it is sent over
+// UDP instead (which the remote client reads first, so it overtakes the queued ones)
+#define LOCAL_SEND_WAIT_MS 1000
+// the end of the session waits longer: sent over UDP, it would end the session before the queued messages are read
+#define LOCAL_END_WAIT_MS 10000
+
+void disableLocalTransport();
+int isLocalTransportEnabled();
+
+int openLocalListener(int sockfd);
+void closeLocalListener(int fd);
+void bindSourcePort(int sockfd);
+int isLocalAddress(const struct sockaddr* addr);
+int connectLocalPeer(const struct sockaddr* addr);
+int sendLocal(int fd, const char* buffer, int length, int segmentSize);
+
+#endif
@@ -1,52 +1,412 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <limits.h>
 
-#include "list.h"
 #include "inputReader.h"
 #include "outputWriter.h"
 #include "UDPServer.h"
 #include "UDPClient.h"
 #include "freeManager.h"
 #include "threadManager.h"
+#include "compression.h"
+#include "cipher.h"
+#include "frame.h"
+#include "history.h"
+#include "pipeMode.h"
+#include "threadOptions.h"
+#include "latencyReport.h"
+#include "heartbeat.h"
+#include "rateLimit.h"
+#include "config.h"
+#include "localTransport.h"
+#include "offload.h"
+#include "zerocopy.h"
+#include "rooms.h"
+#include "echo.h"
+#include "receipts.h"
+#include "tui.h"
+#include "networkSimulator.h"
+
+static struct option longOptions[] = {
+    {"compress", no_argument, NULL, 'z'},
+    {"compress-threshold", required_argument, NULL, 'Z'},
+    {"key-file", required_argument, NULL, 'k'},
+    {"history", required_argument, NULL, 'H'},
+    {"replay", required_argument, NULL, 'r'},
+    {"search", required_argument, NULL, 's'},
+    {"pipe", no_argument, NULL, 'p'},
+    {"thread", required_argument, NULL, 't'},
+    {"busy-poll", required_argument, NULL, 'b'},
+    {"latency-report", no_argument, NULL, 'L'},
+    {"heartbeat", required_argument, NULL, 'B'},
+    {"peer-timeout", required_argument, NULL, 'T'},
+    {"idle-timeout", required_argument, NULL, 'I'},
+    {"flush-delay", required_argument, NULL, 'F'},
+    {"rate-limit", required_argument, NULL, 'R'},
+    {"bandwidth-limit", required_argument, NULL, 'W'},
+    {"config", required_argument, NULL, 'c'},
+    {"port", required_argument, NULL, 'l'},
+    {"remote-machine", required_argument, NULL, 'm'},
+    {"remote-port", required_argument, NULL, 'n'},
+    {"max-message-length", required_argument, NULL, 'M'},
+    {"input-queue", required_argument, NULL, 'Q'},
+    {"output-queue", required_argument, NULL, 'O'},
+    {"receive-buffer", required_argument, NULL, 'V'},
+    {"send-buffer", required_argument, NULL, 'S'},
+    {"pipe-buffer", required_argument, NULL, 'P'},
+    {"udp-only", no_argument, NULL, 'U'},
+    {"no-offload", no_argument, NULL, 'G'},
+    {"zerocopy", required_argument, NULL, 'Y'},
+    {"peer", required_argument, NULL, 'A'},
+    {"room", required_argument, NULL, 'J'},
+    {"echo", no_argument, NULL, 'E'},
+    {"receipts", required_argument, NULL, 'D'},
+    {"tui", no_argument, NULL, 'X'},
+    {"simulate", required_argument, NULL, 'N'},
+    {NULL, 0, NULL, 0}
+};
+
+static void printUsage() {
+    printf("Please enter the arguments: ./s-talk [options] [my port number] [remote machine name] [remote port number]\n");
+    printf("(or give them with --port, --remote-machine and --remote-port)\n");
+    printf("Options:\n");
+    printf("  -c, --config FILE              apply the settings in FILE: one long option per line, e.g. \"pipe\" or\n");
+    printf("                                 \"input-queue = 200\", '#' starts a comment (options after --config override them)\n");
+    printf("  -z, --compress                 compress large messages (when the remote client also uses --compress)\n");
+    printf("      --compress-threshold BYTES only compress messages of at least BYTES bytes (default %d)\n", DEFAULT_COMPRESSION_THRESHOLD);
+    printf("  -k, --key-file FILE            encrypt and authenticate messages with a key derived from FILE (shared with the remote client)\n");
+    printf("  -H, --history FILE             append sent and received messages to FILE\n");
+    printf("  -r, --replay COUNT             print the last COUNT messages from the history file on start up\n");
+    printf("  -p, --pipe                     read and write messages as a 4 byte big endian length followed by the message,\n");
+    printf("                                 without the \"Remote Client: \" header; only end of input ends the session\n");
+    printf("  -t, --thread THREAD:OPTIONS    pin the keyboard, sender, listener or writer thread to CPUs, run it with SCHED_FIFO\n");
+    printf("                                 or change its stack size, e.g. --thread listener:cpu=2,priority=50,stack=256k\n");
+    printf("                                 (can be repeated, once per thread)\n");
+    printf("  -b, --busy-poll MICROSECONDS   spin for up to MICROSECONDS waiting for datagrams and messages before sleeping\n");
+    printf("                                 (lower latency, but keeps CPUs busy), also sets SO_BUSY_POLL on the socket\n");
+    printf("  -L, --latency-report           timestamp messages and print a per stage latency breakdown of the received\n");
+    printf("                                 messages when the session ends (the remote client needs it too for network times)\n");
+    printf("      --heartbeat MILLISECONDS   exchange heartbeats with the remote client (which needs --heartbeat too) every\n");
+    printf("                                 MILLISECONDS to measure the RTT (shown by typing /rtt) and notice when it is gone\n");
+    printf("      --peer-timeout MILLISECONDS\n");
+    printf("                                 with --heartbeat, end the session when nothing has been received from the remote\n");
+    printf("                                 client for MILLISECONDS (default 5 heartbeats)\n");
+    printf("      --idle-timeout SECONDS     end the session when no message has been sent for SECONDS\n");
+    printf("      --flush-delay MICROSECONDS with --pipe, wait up to MICROSECONDS for more messages before writing them to stdout\n");
+    printf("      --rate-limit MESSAGES      drop datagrams from any address that sends more than MESSAGES per second\n");
+    printf("      --bandwidth-limit BYTES    drop datagrams from any address that sends more than BYTES per second\n");
+    printf("      --max-message-length BYTES longest message read or received (default and maximum %d)\n", MAX_MESSAGE_LEN);
+    printf("      --input-queue MESSAGES     most messages waiting to be sent (default %d)\n", DEFAULT_INPUT_QUEUE_CAPACITY);
+    printf("      --output-queue MESSAGES    most messages waiting to be written, more are dropped (default %d)\n", DEFAULT_OUTPUT_QUEUE_CAPACITY);
+    printf("      --receive-buffer BYTES     socket receive buffer size (default: system default)\n");
+    printf("      --send-buffer BYTES        socket send buffer size (default: system default)\n");
+    printf("      --pipe-buffer BYTES        with --pipe, read stdin and write stdout in blocks of up to BYTES (default %dk)\n", DEFAULT_PIPE_BUFFER_SIZE / 1024);
+    printf("                                 (sizes in BYTES take a k or m suffix)\n");
+    printf("      --udp-only                 send over UDP even when the remote client is on this host (which otherwise\n");
+    printf("                                 uses a local socket), and do not accept messages on the local socket\n");
+    printf("      --no-offload               send and receive every datagram with its own syscall, instead of batching\n");
+    printf("                                 equal-sized datagrams with UDP segmentation offload (GSO/GRO)\n");
+    printf("      --zerocopy BYTES           send messages of at least BYTES (%d or more) over UDP with MSG_ZEROCOPY, without\n", MIN_ZEROCOPY_THRESHOLD);
+    printf("                                 copying them into the kernel (turned off if the kernel copies them anyway)\n");
+    printf("      --peer NAME=HOST:PORT      name another s-talk for rooms (the remote client is \"%s\"), can be repeated\n", REMOTE_PEER_NAME);
+    printf("      --room ROOM:NAME[,NAME...] create ROOM with these subscribers: a message starting with \"#ROOM \" is sent to\n");
+    printf("                                 them instead of the remote client (also /join #ROOM NAME, /leave #ROOM NAME, /rooms)\n");
+    printf("      --echo                     also show the messages you send (\"%s...\"), in time order with the received ones\n", ECHO_HEADER);
+    printf("      --receipts MILLISECONDS    ask the remote client (which needs --receipts too) to acknowledge messages, sending\n");
+    printf("                                 its receipts every MILLISECONDS, and show which messages were (not) delivered\n");
+    printf("      --tui                      keep the line being typed at the bottom of the terminal, messages scroll above it\n");
+    printf("                                 (implies --echo)\n");
+    printf("      --simulate SETTINGS        pass received datagrams through a simulated network link, SETTINGS are\n");
+    printf("                                 \"latency=MS,jitter=MS,loss=PERCENT,reorder=PERCENT,duplicate=PERCENT,seed=N\"\n");
+    printf("  -s, --search TEXT              print the most recent messages in the history file containing TEXT and exit\n");
+    printf("                                 (ports and remote machine name are not needed)\n");
+}
+
+// settings from the command line and configuration files
+static int compress = 0;
+static int compressThreshold = DEFAULT_COMPRESSION_THRESHOLD;
+static char* keyFile = NULL;
+static char* historyFile = NULL;
+static int replayCount = 0;
+static char* searchText = NULL;
+static int heartbeatInterval = 0;
+static int peerTimeout = 0;
+static int rateLimit = 0;
+static int bandwidthLimit = 0;
+static char* localPort = NULL;
+static char* remoteHostname = NULL;
+static char* remotePort = NULL;
+static int zerocopyThreshold = 0;
+static int echo = 0;
+static int tui = 0;
+static int receiptInterval = 0;
+
+// apply one option (opt = its short name or val in longOptions), returns -1 if arg is invalid
+static int applyOption(int opt, char* arg) {
+    Config* config = getConfig();
+    int busyPoll, number;
+
+    switch (opt) {
+        case 'z':
+            compress = 1;
+            break;
+        case 'Z':
+            return parseSize(arg, 0, MAX_MESSAGE_LEN, &compressThreshold);
+        case 'k':
+            keyFile = arg;
+            break;
+        case 'H':
+            historyFile = arg;
+            break;
+        case 'p':
+            initPipeMode();
+            break;
+        case 't':
+            return setThreadOptions(arg);
+        case 'b':
+            if (parseNumber(arg, 1, MAX_DELAY_MICROS, &busyPoll) == -1) {
+                return -1;
+            }
+            initBusyPoll(busyPoll);
+            break;
+        case 'B':
+            return parseNumber(arg, 1, MAX_INTERVAL_MS, &heartbeatInterval);
+        case 'T':
+            return parseNumber(arg, 1, MAX_INTERVAL_MS, &peerTimeout);
+        case 'I':
+            if (parseNumber(arg, 1, MAX_IDLE_TIMEOUT, &number) == -1) {
+                return -1;
+            }
+            setIdleTimeout(number);
+            break;
+        case 'F':
+            if (parseNumber(arg, 0, MAX_DELAY_MICROS, &number) == -1) {
+                return -1;
+            }
+            setOutputFlushDelay(number);
+            break;
+        case 'R':
+            return parseNumber(arg, 1, MAX_RATE_LIMIT, &rateLimit);
+        case 'W':
+            return parseSize(arg, 1, MAX_RATE_LIMIT, &bandwidthLimit);
+        case 'L':
+            initLatencyReport();
+            break;
+        case 'U':
+            disableLocalTransport();
+            break;
+        case 'G':
+            disableOffload();
+            break;
+        case 'A':
+            return addPeer(arg);
+        case 'J':
+            return addRoom(arg);
+        case 'E':
+            echo = 1;
+            break;
+        case 'X':
+            tui = 1;
+            break;
+        case 'N':
+            if (initNetworkSimulator(arg) == -1) {
+                return -1;
+            }
+            // every datagram crosses the simulated link on its own, over UDP
+            disableLocalTransport();
+            disableOffload();
+            break;
+        case 'D':
+            return parseNumber(arg, 1, MAX_INTERVAL_MS, &receiptInterval);
+        case 'Y':
+            if (parseSize(arg, MIN_ZEROCOPY_THRESHOLD, MAX_MESSAGE_LEN, &zerocopyThreshold) == -1) {
+                return -1;
+            }
+            initZerocopy(zerocopyThreshold);
+            break;
+        case 's':
+            searchText = arg;
+            break;
+        case 'r':
+            return parseNumber(arg, 0, INT_MAX, &replayCount);
+        case 'l':
+            localPort = arg;
+            break;
+        case 'm':
+            remoteHostname = arg;
+            break;
+        case 'n':
+            remotePort = arg;
+            break;
+        case 'M':
+            return parseSize(arg, 1, MAX_MESSAGE_LEN, &config->maxMessageLen);
+        case 'Q':
+            return parseSize(arg, 1, MAX_QUEUE_CAPACITY, &config->inputQueueCapacity);
+        case 'O':
+            return parseSize(arg, 1, MAX_QUEUE_CAPACITY, &config->outputQueueCapacity);
+        case 'V':
+            return parseSize(arg, 1, MAX_SOCKET_BUFFER_SIZE, &config->receiveBufferSize);
+        case 'S':
+            return parseSize(arg, 1, MAX_SOCKET_BUFFER_SIZE, &config->sendBufferSize);
+        case 'P':
+            return parseSize(arg, PIPE_LENGTH_PREFIX + 1, MAX_PIPE_BUFFER_SIZE, &config->pipeBufferSize);
+        default:
+            // --config is only taken from the command line, not nested in a configuration file
+            return -1;
+    }
+
+    return 0;
+}
 
 int main (int argc, char * argv[]) {
-    // check to make sure all arguments are given
-    if (argc != 4) {
-        printf("Please enter the arguments: ./s-talk [my port number] [remote machine name] [remote port number]\n");
+    int opt;
+
+    // parse the options
+    while ((opt = getopt_long(argc, argv, "zk:H:r:s:pt:b:Lc:", longOptions, NULL)) != -1) {
+        if (opt == 'c') {
+            if (readConfigFile(optarg, longOptions, applyOption) == -1) {
+                return -1;
+            }
+        } else if (applyOption(opt, optarg) == -1) {
+            // setThreadOptions prints its own message
+            if (opt != 't') {
+                printUsage();
+            }
+            return -1;
+        }
+    }
+
+    if ((replayCount > 0 || searchText != NULL) && historyFile == NULL) {
+        printf("--replay and --search require --history\n");
         return -1;
     }
 
-    // store the arguments
-    char* localPort = argv[1];
-    char* remoteHostname = argv[2];
-    char* remotePort = argv[3];
+    // search the history without starting a session
+    if (searchText != NULL) {
+        initHistory(historyFile);
+        searchHistory(searchText);
+        closeHistory();
+        return 0;
+    }
+
+    // the ports and remote machine name are given as arguments, or all three as options
+    if (argc - optind == 3) {
+        localPort = argv[optind];
+        remoteHostname = argv[optind + 1];
+        remotePort = argv[optind + 2];
+    } else if (argc - optind != 0 || localPort == NULL || remoteHostname == NULL || remotePort == NULL) {
+        printUsage();
+        return -1;
+    }
 
-    // create the shared lists
-    List *inputList = List_create(); // this list stores the messages to be sent
-    List *outputList = List_create(); // this list stores the messages to be displayed
+    if (validateConfig() == -1 || initRooms() == -1) {
+        return -1;
+    }
+
+    if (peerTimeout > 0 && heartbeatInterval == 0) {
+        printf("--peer-timeout requires --heartbeat\n");
+        return -1;
+    }
+    if (peerTimeout > 0 && peerTimeout <= heartbeatInterval) {
+        printf("--peer-timeout must be longer than the --heartbeat interval\n");
+        return -1;
+    }
+
+    // pipe mode output has no headers, echoed messages could not be told apart from received ones
+    if (echo && isPipeMode()) {
+        printf("--echo cannot be used with --pipe\n");
+        return -1;
+    }
+
+    // the typed line is cleared when it is sent, the echo shows what was sent
+    if (tui && isPipeMode()) {
+        printf("--tui cannot be used with --pipe\n");
+        return -1;
+    }
+    if (tui) {
+        echo = 1;
+    }
+
+    if (compress) {
+        initCompression(compressThreshold);
+    }
+    if (keyFile != NULL) {
+        initCipher(keyFile);
+    }
+    if (heartbeatInterval > 0) {
+        initHeartbeat(heartbeatInterval, peerTimeout > 0 ? peerTimeout : 5 * heartbeatInterval, remoteHostname, remotePort);
+    }
+    if (receiptInterval > 0) {
+        initReceipts(receiptInterval, remoteHostname, remotePort);
+    }
+    initFraming();
+    initRateLimit(rateLimit, bandwidthLimit, remoteHostname, remotePort);
+
+    if (tui) {
+        initTui();
+    }
+
+    // load the chat history and show the most recent messages
+    if (historyFile != NULL) {
+        initHistory(historyFile);
+        beginTuiOutput();
+        replayHistory(replayCount);
+        endTuiOutput();
+    }
+
+    // create the shared queues
+    MessageQueue inputQueue; // this queue stores the messages to be sent
+    MessageQueue outputQueue; // this queue stores the messages to be displayed
+    MessageQueue_init(&inputQueue, getConfig()->inputQueueCapacity);
+    MessageQueue_init(&outputQueue, getConfig()->outputQueueCapacity);
+    if (echo) {
+        initEcho(getConfig()->outputQueueCapacity);
+    }
 
     // init pthreads: mutexes and condition variables
     initMutexes();
     initConditionVars();
+    initShutdown();
 
     // init processes
-    initInputReader(inputList);
-    initUDPClient(remoteHostname, remotePort, inputList);
-    initUDPServer(localPort, outputList);
-    initOutputWriter(outputList);
+    initInputReader(&inputQueue);
+    initUDPClient(remoteHostname, remotePort, &inputQueue);
+    initUDPServer(localPort, &outputQueue);
+    initOutputWriter(&outputQueue);
 
     // close processes 
     closeInputReader();
     closeUDPClient();
     closeUDPServer();
     closeOutputWriter();
+    closeTui();
+    closeHistory();
+    closeEcho();
+
+    // release anything left in the queues (e.g. a message that arrived while shutting down)
+    releaseMessages(&inputQueue);
+    releaseMessages(&outputQueue);
+    destroyMessagePool();
 
     // destroy pthreads: mutexes and condition variables
+    destroyShutdown();
     destroyMutexes();
     destroyConditionVars();
+    destroyCipher();
 
-    printf("Session was ended\n");
+    printLatencyReport();
+    printHeartbeatReport();
+    printRateLimitReport();
+    printZerocopyReport();
+    printReceiptsReport();
+    printNetworkSimulatorReport();
+    destroyLatencyReport();
+
+    if (!isPipeMode()) {
+        printf("Session was ended\n");
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,394 @@
+// References:
+// Russ Cox - Regular Expression Matching with a Trigram Index
+
+// MESSAGE INDEX
+// in-memory index of the chat history, updated by historyThread as records are written
+// - by sequence number: messages are stored in an array indexed by their history record number
+// - by peer: hash table from peer IP address to the sequence numbers of its messages (ports are checked on lookup)
+// - by substring: hash table from (lower case) trigram to the sequence numbers of the messages containing it
+// posting lists are appended to in sequence order, so they are always sorted
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "messageIndex.h"
+
+typedef struct PostingList_s PostingList;
+struct PostingList_s {
+    uint32_t* sequences;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+// open addressing hash table from key to posting list (key 0 marks an empty slot)
+typedef struct PostingTable_s PostingTable;
+struct PostingTable_s {
+    uint64_t* keys;
+    PostingList* lists;
+    uint64_t capacity; // always a power of 2
+    uint64_t count;
+};
+
+static IndexedMessage* messages;
+static uint64_t messageCount;
+static uint64_t messageCapacity;
+
+// every message text, back to back
+static char* textArena;
+static uint64_t textLen;
+static uint64_t textCapacity;
+
+static PostingTable peerTable;
+static PostingTable trigramTable;
+
+// historyThread writes, queries (keyboard commands) read
+static pthread_rwlock_t indexLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void* growArray(void* array, uint64_t* capacity, uint64_t needed, size_t itemSize, uint64_t initial) {
+    if (needed <= *capacity) {
+        return array;
+    }
+
+    uint64_t newCapacity = *capacity == 0 ? initial : *capacity;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+
+    array = realloc(array, newCapacity * itemSize);
+    if (array == NULL) {
+        fprintf(stderr, "messageIndex: out of memory\n");
+        exit(-1);
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+static uint64_t hashKey(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void initTable(PostingTable* table, uint64_t capacity) {
+    table->keys = calloc(capacity, sizeof(uint64_t));
+    table->lists = calloc(capacity, sizeof(PostingList));
+    table->capacity = capacity;
+    table->count = 0;
+
+    if (table->keys == NULL || table->lists == NULL) {
+        fprintf(stderr, "messageIndex: out of memory\n");
+        exit(-1);
+    }
+}
+
+static void freeTable(PostingTable* table) {
+    for (uint64_t i = 0; i < table->capacity; i++) {
+        free(table->lists[i].sequences);
+    }
+    free(table->keys);
+    free(table->lists);
+    memset(table, 0, sizeof(*table));
+}
+
+// returns the slot for key, either the one holding it or the empty slot where it belongs
+static uint64_t findSlot(const PostingTable* table, uint64_t key) {
+    uint64_t mask = table->capacity - 1;
+    uint64_t slot = hashKey(key) & mask;
+
+    while (table->keys[slot] != 0 && table->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static PostingList* lookupList(const PostingTable* table, uint64_t key) {
+    uint64_t slot = findSlot(table, key);
+    return table->keys[slot] == key ? &table->lists[slot] : NULL;
+}
+
+static PostingList* getOrAddList(PostingTable* table, uint64_t key) {
+    // keep the load factor under 1/2
+    if ((table->count + 1) * 2 > table->capacity) {
+        PostingTable grown;
+        initTable(&grown, table->capacity * 2);
+
+        for (uint64_t i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != 0) {
+                uint64_t slot = findSlot(&grown, table->keys[i]);
+                grown.keys[slot] = table->keys[i];
+                grown.lists[slot] = table->lists[i];
+            }
+        }
+        grown.count = table->count;
+
+        free(table->keys);
+        free(table->lists);
+        *table = grown;
+    }
+
+    uint64_t slot = findSlot(table, key);
+    if (table->keys[slot] == 0) {
+        table->keys[slot] = key;
+        table->count++;
+    }
+    return &table->lists[slot];
+}
+
+static void appendPosting(PostingList* list, uint32_t sequence) {
+    // skip duplicates (e.g. a trigram that appears twice in the same message)
+    if (list->count > 0 && list->sequences[list->count - 1] == sequence) {
+        return;
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+        list->sequences = realloc(list->sequences, list->capacity * sizeof(uint32_t));
+        if (list->sequences == NULL) {
+            fprintf(stderr, "messageIndex: out of memory\n");
+            exit(-1);
+        }
+    }
+    list->sequences[list->count++] = sequence;
+}
+
+static int containsPosting(const PostingList* list, uint32_t sequence) {
+    uint32_t low = 0;
+    uint32_t high = list->count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (list->sequences[mid] < sequence) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < list->count && list->sequences[low] == sequence;
+}
+
+static int comparePostingLists(const void* a, const void* b) {
+    uint32_t countA = (*(PostingList* const*)a)->count;
+    uint32_t countB = (*(PostingList* const*)b)->count;
+    return (countA > countB) - (countA < countB);
+}
+
+// keys are offset by one so that 0 can mark empty slots
+static uint64_t peerKey(uint32_t peerAddr) {
+    return (uint64_t)peerAddr + 1;
+}
+
+static uint64_t trigramKey(const char* text) {
+    return (((uint64_t)(unsigned char)tolower((unsigned char)text[0]) << 16)
+        | ((uint64_t)(unsigned char)tolower((unsigned char)text[1]) << 8)
+        | (uint64_t)(unsigned char)tolower((unsigned char)text[2])) + 1;
+}
+
+static int containsIgnoreCase(const char* text, uint32_t length, const char* pattern, uint32_t patternLen) {
+    if (patternLen > length) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i + patternLen <= length; i++) {
+        uint32_t j = 0;
+        while (j < patternLen && tolower((unsigned char)text[i + j]) == tolower((unsigned char)pattern[j])) {
+            j++;
+        }
+        if (j == patternLen) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void initMessageIndex() {
+    initTable(&peerTable, 16);
+    initTable(&trigramTable, 4096);
+}
+
+void destroyMessageIndex() {
+    freeTable(&peerTable);
+    freeTable(&trigramTable);
+    free(messages);
+    free(textArena);
+    messages = NULL;
+    textArena = NULL;
+    messageCount = messageCapacity = 0;
+    textLen = textCapacity = 0;
+}
+
+// add a message to the index, sequence has to be the next history record number
+void indexMessage(uint64_t sequence, int direction, uint32_t peerAddr, uint16_t peerPort, const char* text, int length) {
+    pthread_rwlock_wrlock(&indexLock);
+
+    if (sequence != messageCount || sequence > UINT32_MAX) {
+        pthread_rwlock_unlock(&indexLock);
+        return;
+    }
+
+    messages = growArray(messages, &messageCapacity, messageCount + 1, sizeof(IndexedMessage), 1024);
+    textArena = growArray(textArena, &textCapacity, textLen + length, 1, 64 * 1024);
+
+    IndexedMessage* message = &messages[messageCount++];
+    message->textOffset = textLen;
+    message->length = length;
+    message->peerAddr = peerAddr;
+    message->peerPort = peerPort;
+    message->direction = direction;
+
+    memcpy(textArena + textLen, text, length);
+    textLen += length;
+
+    appendPosting(getOrAddList(&peerTable, peerKey(peerAddr)), (uint32_t)sequence);
+    for (int i = 0; i + 3 <= length; i++) {
+        appendPosting(getOrAddList(&trigramTable, trigramKey(text + i)), (uint32_t)sequence);
+    }
+
+    pthread_rwlock_unlock(&indexLock);
+}
+
+// matches are copied out of the index under indexLock and reported after it is released, so a slow matchFn
+// (printing to a blocked stdout) does not hold up historyThread
+typedef struct Match_s Match;
+struct Match_s {
+    uint64_t sequence;
+    IndexedMessage message; // textOffset is into the match list's own text
+};
+
+typedef struct MatchList_s MatchList;
+struct MatchList_s {
+    Match* matches;
+    uint64_t count;
+    uint64_t capacity;
+    char* text;
+    uint64_t textLen;
+    uint64_t textCapacity;
+};
+
+// indexLock must be held
+static void addMatch(MatchList* list, uint64_t sequence) {
+    const IndexedMessage* message = &messages[sequence];
+
+    list->matches = growArray(list->matches, &list->capacity, list->count + 1, sizeof(Match), 16);
+    list->text = growArray(list->text, &list->textCapacity, list->textLen + message->length, 1, 4096);
+
+    Match* match = &list->matches[list->count++];
+    match->sequence = sequence;
+    match->message = *message;
+    match->message.textOffset = list->textLen;
+
+    memcpy(list->text + list->textLen, textArena + message->textOffset, message->length);
+    list->textLen += message->length;
+}
+
+// called after indexLock is released, returns the number of matches
+static int reportMatches(MatchList* list, MATCH_FN matchFn) {
+    for (uint64_t i = 0; i < list->count; i++) {
+        Match* match = &list->matches[i];
+        matchFn(match->sequence, &match->message, list->text + match->message.textOffset);
+    }
+
+    free(list->matches);
+    free(list->text);
+    return (int)list->count;
+}
+
+// returns 1 if the message with the given sequence number exists
+int findMessage(uint64_t sequence, MATCH_FN matchFn) {
+    MatchList list = { 0 };
+
+    pthread_rwlock_rdlock(&indexLock);
+    if (sequence < messageCount) {
+        addMatch(&list, sequence);
+    }
+    pthread_rwlock_unlock(&indexLock);
+
+    return reportMatches(&list, matchFn);
+}
+
+// peerPort 0 matches any port, returns the number of matches (at most maxResults)
+int findMessagesFromPeer(uint32_t peerAddr, uint16_t peerPort, int maxResults, MATCH_FN matchFn) {
+    MatchList list = { 0 };
+
+    pthread_rwlock_rdlock(&indexLock);
+    PostingList* postings = lookupList(&peerTable, peerKey(peerAddr));
+    if (postings != NULL) {
+        for (uint32_t i = postings->count; i > 0 && list.count < (uint64_t)maxResults; i--) {
+            IndexedMessage* message = &messages[postings->sequences[i - 1]];
+            if (peerPort != 0 && message->peerPort != peerPort) {
+                continue;
+            }
+            addMatch(&list, postings->sequences[i - 1]);
+        }
+    }
+    pthread_rwlock_unlock(&indexLock);
+
+    return reportMatches(&list, matchFn);
+}
+
+// case insensitive substring search, returns the number of matches (at most maxResults)
+int searchMessages(const char* text, int maxResults, MATCH_FN matchFn) {
+    uint32_t patternLen = strlen(text);
+    MatchList list = { 0 };
+
+    pthread_rwlock_rdlock(&indexLock);
+
+    // case: pattern is too short to have a trigram, check every message (newest first)
+    if (patternLen < 3) {
+        for (uint64_t i = messageCount; i > 0 && list.count < (uint64_t)maxResults; i--) {
+            IndexedMessage* message = &messages[i - 1];
+            if (containsIgnoreCase(textArena + message->textOffset, message->length, text, patternLen)) {
+                addMatch(&list, i - 1);
+            }
+        }
+        pthread_rwlock_unlock(&indexLock);
+        return reportMatches(&list, matchFn);
+    }
+
+    // every trigram of the pattern has to be in the message
+    uint32_t trigramCount = patternLen - 2;
+    PostingList** lists = malloc(trigramCount * sizeof(PostingList*));
+
+    if (lists == NULL) {
+        fprintf(stderr, "messageIndex: out of memory\n");
+        exit(-1);
+    }
+
+    for (uint32_t i = 0; i < trigramCount; i++) {
+        lists[i] = lookupList(&trigramTable, trigramKey(text + i));
+
+        // case: trigram never seen, no message can match
+        if (lists[i] == NULL) {
+            free(lists);
+            pthread_rwlock_unlock(&indexLock);
+            return 0;
+        }
+    }
+
+    // walk the shortest posting list, checking the most selective trigrams first so candidates are rejected early
+    qsort(lists, trigramCount, sizeof(PostingList*), comparePostingLists);
+
+    for (uint32_t i = lists[0]->count; i > 0 && list.count < (uint64_t)maxResults; i--) {
+        uint32_t sequence = lists[0]->sequences[i - 1];
+        int candidate = 1;
+
+        for (uint32_t j = 1; j < trigramCount && candidate; j++) {
+            if (!containsPosting(lists[j], sequence)) {
+                candidate = 0;
+            }
+        }
+
+        // trigrams can match out of order, so check the text itself
+        IndexedMessage* message = &messages[sequence];
+        if (candidate && containsIgnoreCase(textArena + message->textOffset, message->length, text, patternLen)) {
+            addMatch(&list, sequence);
+        }
+    }
+
+    free(lists);
+    pthread_rwlock_unlock(&indexLock);
+    return reportMatches(&list, matchFn);
+}
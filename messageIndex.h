@@ -0,0 +1,27 @@
+#ifndef _MESSAGE_INDEX_H
+#define _MESSAGE_INDEX_H
+
+#include <stdint.h>
+
+typedef struct IndexedMessage_s IndexedMessage;
+struct IndexedMessage_s {
+    uint64_t textOffset; // offset of the message text in the index's text arena
+    uint32_t length;
+    uint32_t peerAddr;   // network byte order
+    uint16_t peerPort;   // network byte order
+    uint8_t direction;   // HISTORY_SENT or HISTORY_RECEIVED
+};
+
+// called for every match, newest first, after the index is unlocked (text is a copy, freed after the call)
+typedef void (*MATCH_FN)(uint64_t sequence, const IndexedMessage* message, const char* text);
+
+void initMessageIndex();
+void destroyMessageIndex();
+
+void indexMessage(uint64_t sequence, int direction, uint32_t peerAddr, uint16_t peerPort, const char* text, int length);
+
+int findMessage(uint64_t sequence, MATCH_FN matchFn);
+int findMessagesFromPeer(uint32_t peerAddr, uint16_t peerPort, int maxResults, MATCH_FN matchFn);
+int searchMessages(const char* text, int maxResults, MATCH_FN matchFn);
+
+#endif
@@ -0,0 +1,420 @@
+// References:
+// netem(8) - delay, jitter, loss, reorder and duplicate
+// Sebastiano Vigna - splitmix64 (https://prng.di.unimi.it/splitmix64.c)
+
+// NETWORK SIMULATOR
+// --simulate: the datagrams listenerThread receives first pass through a simulated network link, to test and
+// benchmark (e.g. with bench/pipeBench) the reliability features on one machine, in conditions like a real network's:
+// - latency: every datagram is held back this long (plus or minus up to the jitter, which reorders some of them)
+// - loss / duplicate: percentage of datagrams that are dropped / delivered twice (the copy with its own delay)
+// - reorder: percentage of datagrams held back NETSIM_REORDER_MS longer, so later ones overtake them
+// - seed: every decision about a datagram is a hash of the seed, the datagram's position and the decision, so the
+//   same datagrams in the same order are lost, duplicated, reordered and delayed the same way in every run
+//   messages, heartbeats, receipts and hellos are counted apart: the others are sent at timing-dependent points,
+//   and must not change what happens to the messages around them
+// the link is simulated as the datagrams are received, so one process simulates its incoming direction: run both
+// clients with --simulate for both directions
+// held-back datagrams wait in a heap ordered by when they are due, a timer on listenerThread's timer wheel wakes it
+// for the next one
+// local transport and offload are turned off: every datagram crosses the link on its own (a GRO buffer or a batch
+// on the local socket would be delayed or lost as a whole)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "networkSimulator.h"
+#include "transport.h"
+#include "frame.h"
+
+#define DEFAULT_SEED 1
+
+// a datagram on its way, with what recvmsg returned for it
+typedef struct Delivery_s Delivery;
+struct Delivery_s {
+    uint64_t due;
+    uint64_t sequence; // datagrams due at the same time are delivered in the order they were received
+    char* datagram;
+    int length;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    char control[NETSIM_CONTROL_SPACE];
+    int controlLen;
+};
+
+static int simulatorEnabled = 0;
+
+// settings
+static uint64_t latency = 0;
+static uint64_t jitter = 0;
+static double lossPercent = 0;
+static double reorderPercent = 0;
+static double duplicatePercent = 0;
+static uint64_t seed = DEFAULT_SEED;
+
+// kinds of datagrams, each numbered on its own
+enum { STREAM_MESSAGES, STREAM_HEARTBEATS, STREAM_RECEIPTS, STREAM_HELLOS, STREAM_COUNT };
+// decisions about one datagram
+enum { DECIDE_LOSS, DECIDE_DELAY, DECIDE_REORDER, DECIDE_DUPLICATE, DECIDE_DUPLICATE_DELAY, DECISION_COUNT };
+
+// datagrams of each kind received so far (listenerThread only)
+static uint64_t streamPosition[STREAM_COUNT];
+
+// time source, timerNow unless replaced with setNetworkSimulatorClock
+static uint64_t (*linkClock)() = timerNow;
+
+// held-back datagrams, a heap by (due, sequence) (listenerThread only)
+static Delivery pending[NETSIM_MAX_PENDING];
+static int pendingCount = 0;
+static uint64_t nextSequence = 0;
+
+static TimerWheel* listenerTimers;
+static Timer deliveryTimer;
+
+// statistics
+static uint64_t receivedCount = 0;
+static uint64_t lostCount = 0;
+static uint64_t duplicatedCount = 0;
+static uint64_t reorderedCount = 0;
+static uint64_t overflowCount = 0;
+
+// what one datagram decides with: the kind of datagram, its position among them and the decision
+typedef struct Fate_s Fate;
+struct Fate_s {
+    int stream;
+    uint64_t position;
+};
+
+// splitmix64 output number n for the seed, n picked from the datagram and the decision (so no decision depends
+// on how many were made before it)
+static uint64_t fateRandom(const Fate* fate, int decision) {
+    uint64_t n = (fate->position * STREAM_COUNT + fate->stream) * DECISION_COUNT + decision + 1;
+    uint64_t z = seed + n * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// 1 with a chance of percent in 100
+static int chance(const Fate* fate, int decision, double percent) {
+    return percent > 0 && (fateRandom(fate, decision) >> 11) * 0x1.0p-53 * 100 < percent;
+}
+
+// latency, plus or minus up to the jitter
+static uint64_t delayFor(const Fate* fate, int decision) {
+    if (jitter == 0) {
+        return latency;
+    }
+
+    int64_t delay = (int64_t)latency + (int64_t)(fateRandom(fate, decision) % (2 * jitter + 1)) - (int64_t)jitter;
+    return delay > 0 ? delay : 0;
+}
+
+// which kind of datagram this is, from the flags of its frame header (plain text datagrams are messages)
+static int streamOf(const char* datagram, int length) {
+    FrameHeader header;
+
+    if (!isFrame(datagram, length)) {
+        return STREAM_MESSAGES;
+    }
+    memcpy(&header, datagram, sizeof(header));
+    if (header.flags & FRAME_HEARTBEAT) {
+        return STREAM_HEARTBEATS;
+    }
+    if (header.flags & FRAME_RECEIPTS) {
+        return STREAM_RECEIPTS;
+    }
+    if (header.flags & FRAME_HELLO) {
+        return STREAM_HELLOS;
+    }
+    return STREAM_MESSAGES;
+}
+
+static int isEarlier(const Delivery* a, const Delivery* b) {
+    return a->due < b->due || (a->due == b->due && a->sequence < b->sequence);
+}
+
+static void swapDeliveries(int i, int j) {
+    Delivery tmp = pending[i];
+    pending[i] = pending[j];
+    pending[j] = tmp;
+}
+
+static void pushDelivery(const Delivery* delivery) {
+    int i = pendingCount++;
+
+    pending[i] = *delivery;
+    while (i > 0 && isEarlier(&pending[i], &pending[(i - 1) / 2])) {
+        swapDeliveries(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void popDelivery() {
+    int i = 0;
+
+    pending[0] = pending[--pendingCount];
+    while (1) {
+        int earliest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < pendingCount && isEarlier(&pending[left], &pending[earliest])) {
+            earliest = left;
+        }
+        if (right < pendingCount && isEarlier(&pending[right], &pending[earliest])) {
+            earliest = right;
+        }
+        if (earliest == i) {
+            return;
+        }
+        swapDeliveries(i, earliest);
+        i = earliest;
+    }
+}
+
+// hold back a copy of the datagram msg received, due after delay
+static void holdDatagram(const struct msghdr* msg, int length, uint64_t now, uint64_t delay) {
+    Delivery delivery;
+
+    if (pendingCount == NETSIM_MAX_PENDING) {
+        overflowCount++;
+        return;
+    }
+
+    delivery.datagram = malloc(length > 0 ? length : 1);
+    if (delivery.datagram == NULL) {
+        fprintf(stderr, "networkSimulator: out of memory\n");
+        exit(-1);
+    }
+    memcpy(delivery.datagram, msg->msg_iov[0].iov_base, length);
+    delivery.length = length;
+    delivery.due = now + delay;
+    delivery.sequence = nextSequence++;
+
+    delivery.addrLen = msg->msg_namelen <= sizeof(delivery.addr) ? msg->msg_namelen : sizeof(delivery.addr);
+    memcpy(&delivery.addr, msg->msg_name, delivery.addrLen);
+    delivery.controlLen = msg->msg_controllen <= sizeof(delivery.control) ? msg->msg_controllen : 0;
+    memcpy(delivery.control, msg->msg_control, delivery.controlLen);
+
+    pushDelivery(&delivery);
+}
+
+// what the link does to a datagram that was just received
+static void simulateLink(const struct msghdr* msg, int length, uint64_t now) {
+    Fate fate;
+
+    receivedCount++;
+    fate.stream = streamOf(msg->msg_iov[0].iov_base, length);
+    fate.position = streamPosition[fate.stream]++;
+
+    if (chance(&fate, DECIDE_LOSS, lossPercent)) {
+        lostCount++;
+        return;
+    }
+
+    uint64_t delay = delayFor(&fate, DECIDE_DELAY);
+    if (chance(&fate, DECIDE_REORDER, reorderPercent)) {
+        reorderedCount++;
+        delay += NETSIM_REORDER_MS * 1000000ULL;
+    }
+    holdDatagram(msg, length, now, delay);
+
+    if (chance(&fate, DECIDE_DUPLICATE, duplicatePercent)) {
+        duplicatedCount++;
+        holdDatagram(msg, length, now, delayFor(&fate, DECIDE_DUPLICATE_DELAY));
+    }
+}
+
+// hand the first held-back datagram to the caller of receive, in the buffers of msg
+static int deliver(struct msghdr* msg) {
+    Delivery* delivery = &pending[0];
+    int length = delivery->length;
+
+    // like recvmsg, a datagram larger than the buffer is cut short
+    if ((size_t)length > msg->msg_iov[0].iov_len) {
+        length = msg->msg_iov[0].iov_len;
+    }
+    memcpy(msg->msg_iov[0].iov_base, delivery->datagram, length);
+
+    if (msg->msg_name != NULL) {
+        msg->msg_namelen = delivery->addrLen <= msg->msg_namelen ? delivery->addrLen : msg->msg_namelen;
+        memcpy(msg->msg_name, &delivery->addr, msg->msg_namelen);
+    }
+    msg->msg_controllen = (size_t)delivery->controlLen <= msg->msg_controllen ? (size_t)delivery->controlLen : 0;
+    memcpy(msg->msg_control, delivery->control, msg->msg_controllen);
+    msg->msg_flags = 0;
+
+    free(delivery->datagram);
+    popDelivery();
+    return length;
+}
+
+// the timer only wakes listenerThread, which takes the datagram with its next receive
+static void deliveryDue(void* arg, uint64_t now) {
+}
+
+// Transport receive: move every datagram waiting on the socket onto the link, then hand out the first one
+// that is due
+// the socket is drained even with NETSIM_MAX_PENDING held back (holdDatagram drops and counts the rest), or it
+// would stay readable and listenerThread's poll would never wait; a flood is taken NETSIM_MAX_PENDING at a time
+static ssize_t simulatedReceive(int fd, struct msghdr* msg) {
+    socklen_t nameLen = msg->msg_namelen;
+    size_t controlLen = msg->msg_controllen;
+    uint64_t now = linkClock();
+
+    for (int i = 0; i < NETSIM_MAX_PENDING; i++) {
+        msg->msg_namelen = nameLen;
+        msg->msg_controllen = controlLen;
+
+        int numbytes = socketTransport.receive(fd, msg);
+        if (numbytes == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            break;
+        }
+        simulateLink(msg, numbytes, now);
+    }
+    msg->msg_namelen = nameLen;
+    msg->msg_controllen = controlLen;
+
+    if (pendingCount > 0 && pending[0].due <= now) {
+        return deliver(msg);
+    }
+
+    // wake up when the next one is due
+    if (pendingCount > 0) {
+        cancelTimer(listenerTimers, &deliveryTimer);
+        addTimer(listenerTimers, &deliveryTimer, pending[0].due, deliveryDue, NULL);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// Transport sends: not simulated, the link is simulated where the datagrams are received
+static ssize_t simulatedSend(int fd, const void* datagram, size_t length, int flags, const struct sockaddr* addr, socklen_t addrLen) {
+    return socketTransport.send(fd, datagram, length, flags, addr, addrLen);
+}
+
+static ssize_t simulatedSendMsg(int fd, const struct msghdr* msg, int flags) {
+    return socketTransport.sendMsg(fd, msg, flags);
+}
+
+static int simulatedSendBatch(int fd, struct mmsghdr* msgs, unsigned int count, int flags) {
+    return socketTransport.sendBatch(fd, msgs, count, flags);
+}
+
+static const Transport simulatedTransport = {
+    .send = simulatedSend,
+    .sendMsg = simulatedSendMsg,
+    .sendBatch = simulatedSendBatch,
+    .receive = simulatedReceive
+};
+
+// parse a number after "name=" in settings, returns -1 if it is not one or is negative
+static int parseValue(const char* value, double* result) {
+    char* end;
+
+    *result = strtod(value, &end);
+    if (end == value || (*end != ',' && *end != '\0') || *result < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// settings: comma-separated name=value pairs, "latency=MS,jitter=MS,loss=PERCENT,reorder=PERCENT,duplicate=PERCENT,seed=N"
+// (any of them can be left out), returns -1 if they are not valid
+// call before the threads are started
+int initNetworkSimulator(const char* settings) {
+    const char* pos = settings;
+
+    latency = 0;
+    jitter = 0;
+    lossPercent = 0;
+    reorderPercent = 0;
+    duplicatePercent = 0;
+    seed = DEFAULT_SEED;
+
+    while (*pos != '\0') {
+        const char* equals = strchr(pos, '=');
+        double value;
+
+        if (equals == NULL || parseValue(equals + 1, &value) == -1) {
+            return -1;
+        }
+
+        int nameLen = equals - pos;
+        if (nameLen == 7 && strncmp(pos, "latency", nameLen) == 0 && value <= NETSIM_MAX_DELAY_MS) {
+            latency = value * 1000000;
+        } else if (nameLen == 6 && strncmp(pos, "jitter", nameLen) == 0 && value <= NETSIM_MAX_DELAY_MS) {
+            jitter = value * 1000000;
+        } else if (nameLen == 4 && strncmp(pos, "loss", nameLen) == 0 && value <= 100) {
+            lossPercent = value;
+        } else if (nameLen == 7 && strncmp(pos, "reorder", nameLen) == 0 && value <= 100) {
+            reorderPercent = value;
+        } else if (nameLen == 9 && strncmp(pos, "duplicate", nameLen) == 0 && value <= 100) {
+            duplicatePercent = value;
+        } else if (nameLen == 4 && strncmp(pos, "seed", nameLen) == 0) {
+            seed = strtoull(equals + 1, NULL, 10);
+        } else {
+            return -1;
+        }
+
+        pos = strchr(equals, ',');
+        pos = pos == NULL ? equals + strlen(equals) : pos + 1;
+    }
+
+    memset(streamPosition, 0, sizeof(streamPosition));
+    nextSequence = 0;
+    receivedCount = 0;
+    lostCount = 0;
+    duplicatedCount = 0;
+    reorderedCount = 0;
+    overflowCount = 0;
+
+    simulatorEnabled = 1;
+    setTransport(&simulatedTransport);
+    return 0;
+}
+
+int isNetworkSimulatorEnabled() {
+    return simulatorEnabled;
+}
+
+// listenerThread, before its first receive: timers is its timer wheel
+void startNetworkSimulator(TimerWheel* timers) {
+    listenerTimers = timers;
+}
+
+// replace the time source of the link (timerNow, CLOCK_MONOTONIC in ns), for tests that move time forward
+// themselves
+void setNetworkSimulatorClock(uint64_t (*now)()) {
+    linkClock = now;
+}
+
+// at the end of the session (on stderr, like the other reports)
+void printNetworkSimulatorReport() {
+    if (!simulatorEnabled) {
+        return;
+    }
+
+    fprintf(stderr, "simulate: %llu datagrams received, %llu lost, %llu duplicated, %llu reordered, %llu dropped (too many held back)\n",
+        (unsigned long long)receivedCount, (unsigned long long)lostCount, (unsigned long long)duplicatedCount,
+        (unsigned long long)reorderedCount, (unsigned long long)overflowCount);
+}
+
+// free the datagrams still on their way, after listenerThread has been joined
+void closeNetworkSimulator() {
+    for (int i = 0; i < pendingCount; i++) {
+        free(pending[i].datagram);
+    }
+    pendingCount = 0;
+
+    if (listenerTimers != NULL) {
+        cancelTimer(listenerTimers, &deliveryTimer);
+        listenerTimers = NULL;
+    }
+}
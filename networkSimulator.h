@@ -0,0 +1,22 @@
+#ifndef _NETWORK_SIMULATOR_H
+#define _NETWORK_SIMULATOR_H
+
+#include "timerWheel.h"
+
+// most datagrams held back at a time (more are dropped, like a full queue of a router)
+#define NETSIM_MAX_PENDING 4096
+// longest latency and jitter (also keeps them inside the range of the ns arithmetic)
+#define NETSIM_MAX_DELAY_MS (60 * 1000)
+// a reordered datagram is held back this much longer than the others
+#define NETSIM_REORDER_MS 10
+// room for the control messages (kernel timestamp) kept with a held-back datagram
+#define NETSIM_CONTROL_SPACE 64
+
+int initNetworkSimulator(const char* settings);
+int isNetworkSimulatorEnabled();
+void startNetworkSimulator(TimerWheel* timers);
+void setNetworkSimulatorClock(uint64_t (*now)());
+void printNetworkSimulatorReport();
+void closeNetworkSimulator();
+
+#endif
@@ -0,0 +1,92 @@
+// References:
+// udp(7) - UDP_SEGMENT, UDP_GRO
+// Willem de Bruijn, Eric Dumazet - Optimizing UDP for content delivery: GSO, pacing and zerocopy (Linux Plumbers 2018)
+
+// OFFLOAD
+// UDP segmentation offload for bulk traffic over UDP:
+// - send (GSO): senderThread packs queued datagrams of the same length (the last one may be shorter) into one
+//   buffer and sends it with a single sendmsg(), the kernel (or the NIC) splits it into the datagrams
+// - receive (GRO): the kernel may hand listenerThread several datagrams of one flow in one buffer, with their
+//   length in a UDP_GRO control message, listenerThread splits the buffer again
+// the datagrams on the wire are exactly the ones that would have been sent one by one, so the remote client
+// does not need to support offload
+// a kernel or device without GSO makes sendSegments fail: it is then not used again (EIO, ENOPROTOOPT: not
+// supported at all) or not for segments of that size (EINVAL: segment larger than the path MTU allows)
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "offload.h"
+#include "transport.h"
+
+static int offloadEnabled = 1;
+static int maxSegmentSize = GSO_MAX_BYTES; // largest segment GSO has not refused (senderThread only)
+
+// --no-offload: send and receive every datagram with its own syscall
+void disableOffload() {
+    offloadEnabled = 0;
+}
+
+// 1 if a batch of segments of segmentSize bytes can be sent with sendSegments
+int isSegmentOffloadUsable(int segmentSize) {
+    return offloadEnabled && segmentSize > 0 && segmentSize <= maxSegmentSize;
+}
+
+// send length bytes of segments of segmentSize bytes (the last one may be shorter) to addr in one sendmsg()
+// returns length, or -1 if the kernel refused the batch (errno is set, and the batch should be sent one
+// datagram at a time) or on a send error
+int sendSegments(int sockfd, const char* buffer, int length, int segmentSize, const struct sockaddr* addr, socklen_t addrLen) {
+    char control[OFFLOAD_CONTROL_SPACE];
+    struct iovec iov = { .iov_base = (char*)buffer, .iov_len = length };
+    struct msghdr msg = {
+        .msg_name = (struct sockaddr*)addr,
+        .msg_namelen = addrLen,
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    memset(control, 0, sizeof(control));
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t size = segmentSize;
+    memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+
+    int numbytes = getTransport()->sendMsg(sockfd, &msg, 0);
+    if (numbytes == -1) {
+        if (errno == EINVAL) {
+            maxSegmentSize = segmentSize - 1;
+        } else if (errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+            fprintf(stderr, "offload: UDP segmentation offload is not supported, sending datagrams one by one\n");
+            offloadEnabled = 0;
+        }
+    }
+    return numbytes;
+}
+
+// listenerThread: accept coalesced datagrams (kernels without UDP_GRO keep delivering them one by one)
+void enableReceiveOffload(int sockfd) {
+    int enable = 1;
+
+    if (offloadEnabled) {
+        setsockopt(sockfd, SOL_UDP, UDP_GRO, &enable, sizeof(enable));
+    }
+}
+
+// length of each datagram in a received buffer from its UDP_GRO control message, 0 if it holds one datagram
+int getReceivedSegmentSize(struct msghdr* msg) {
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segmentSize;
+            memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+            return segmentSize;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef _OFFLOAD_H
+#define _OFFLOAD_H
+
+#include <sys/socket.h>
+
+// most segments in one UDP_SEGMENT send (the kernel's UDP_MAX_SEGMENTS)
+#define GSO_MAX_SEGMENTS 64
+
+// most bytes in one UDP_SEGMENT send: the segments share one IPv4 packet's length limit
+#define GSO_MAX_BYTES 65507
+
+// control message space for the segment size (UDP_SEGMENT on send, UDP_GRO on receive)
+#define OFFLOAD_CONTROL_SPACE CMSG_SPACE(sizeof(int))
+
+void disableOffload();
+int isSegmentOffloadUsable(int segmentSize);
+
+int sendSegments(int sockfd, const char* buffer, int length, int segmentSize, const struct sockaddr* addr, socklen_t addrLen);
+void enableReceiveOffload(int sockfd);
+int getReceivedSegmentSize(struct msghdr* msg);
+
+#endif
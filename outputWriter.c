@@ -4,79 +4,248 @@
 
 // OUTPUT WRITER
 // runs writerThread
-// get message from outputList and print on screen
+// get message from outputQueue and print on screen (or write it length-prefixed to stdout in pipe mode)
+// on shutdown, prints whatever is left in outputQueue before returning
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
-#include "list.h"
 #include "threadManager.h"
 #include "outputWriter.h"
 #include "freeManager.h"
+#include "pipeMode.h"
+#include "threadOptions.h"
+#include "latencyReport.h"
+#include "timerWheel.h"
+#include "config.h"
+#include "echo.h"
+#include "tui.h"
 
-// limit for UDP datagram under IPv4 is 65507
-#define MAX_LEN_BUFFER 65491  // 65507 - 15 (for header) - 1 (for '\0')
-
-static List* outputList;
+static MessageQueue* outputQueue;
 static char* message;
 static pthread_t writerThread;
 
+// pipe mode output, written when the queue runs empty or (with a flush delay) by flushTimer
+static char* pipeBuffer;
+static int pipeBufferLen;
+static uint64_t flushDelay = 0;
+
+// writerThread's timers (output flush deadline, next TUI frame), run whenever it wakes up
+static TimerWheel writerTimers;
+static Timer flushTimer;
+static Timer frameTimer;
+
+// --tui: draw the messages added to the screen, or try again when the next frame is due
+static void drawTuiFrame(void* arg, uint64_t now) {
+    uint64_t next = refreshTui(now);
+    if (next != 0 && !isTimerPending(&frameTimer)) {
+        addTimer(&writerTimers, &frameTimer, next, drawTuiFrame, NULL);
+    }
+}
+
 void* writeMessages() {
+    initTimerWheel(&writerTimers, TIMER_TICK_NS);
+
     while (1) {
-        // wait for messages to print
-        waitOutputWriter();
+        // wait for messages to print (or for the next frame with --tui)
+        waitOutputWriter(outputQueue, &writerTimers);
+        runTimers(&writerTimers, timerNow());
+
+        if (countOutputMessages(outputQueue) == 0) {
+            // case: session is ending and every message has been printed
+            if (isShuttingDown()) {
+                return NULL;
+            }
+            continue;
+        }
         
         do {
-            // get message from outputList
-            message = getMessage(outputList);
+            // get message from outputQueue (or, with --echo, the older of it and the next sent message)
+            int echoed;
+            message = nextOutputMessage(outputQueue, &echoed);
 
             if(message == NULL) {
                 fprintf(stderr, "outputWriter: failed to get message, message is NULL\n");
                 break;
             }
 
+            // --tui: the message is drawn with the next frame (see tui.c)
+            if (isTuiEnabled() && echoed) {
+                addTuiLine(ECHO_HEADER, message);
+                releaseMessage(message);
+                continue;
+            }
+
+            // echoed message: printed behind its header straight from the buffer UDPClient sends
+            if (echoed) {
+                struct iovec iov[2] = {
+                    { .iov_base = ECHO_HEADER, .iov_len = strlen(ECHO_HEADER) },
+                    { .iov_base = message, .iov_len = getMessageInfo(message)->length }
+                };
+                if (writev(1, iov, 2) == -1) {
+                    perror("outputWriter: failed to print message\n");
+                    exit(-1);
+                }
+                releaseMessage(message);
+                continue;
+            }
+            uint64_t dequeueTime = isLatencyReportEnabled() ? realtimeNanoseconds() : 0;
+
             // write/print message to screen
-            int res = write(1, message, strlen(message)); 
-            if(res == -1) {
+            if (isTuiEnabled()) {
+                addTuiLine("", message);
+            } else if (write(1, message, getMessageInfo(message)->length) == -1) {
                 perror("outputWriter: failed to print message\n");
                 exit(-1);
             }
 
-            // if message is "!\n" (local) or Remote Client: !\n" (remote) then stop the writing
-            if(!strcmp(message, "!\n") || !strcmp(message, "Remote Client: !\n")) {
-                // free message and stop writing
-                freeMessage(message);
+            if (isLatencyReportEnabled()) {
+                addLatencySample(getMessageInfo(message), dequeueTime);
+                completeLatencySamples(realtimeNanoseconds());
+            }
+
+            // if message is the remote client's "!\n" (shown as "Remote Client: !\n") then stop the writing
+            if(getMessageInfo(message)->endOfSession) {
+                // release message and stop writing
+                releaseMessage(message);
                 return NULL;
             }
 
-            // else continue writing and free message
-            freeMessage(message);
+            // else continue writing and release message
+            releaseMessage(message);
+
+            // continue writing if there are still messages in the outputQueue (or echo queue)
+        } while (countOutputMessages(outputQueue) != 0);
 
-            // continue writing if there are still messages in the outputList
-        } while (countList(outputList) != 0);
+        if (isTuiEnabled()) {
+            drawTuiFrame(NULL, timerNow());
+        }
     }
 
     return NULL;
 }
 
-void initOutputWriter(List* list) {
-    outputList = list;
+// write the whole pipe buffer to stdout
+static void flushPipeOutput() {
+    const char* buffer = pipeBuffer;
+    int length = pipeBufferLen;
 
-    // create writerThread - prints character to the screen
-    int res =  pthread_create(&writerThread, NULL, writeMessages, NULL);
-    if(res != 0){
-        perror("write thread failed");
+    // a scheduled flush is not needed any more
+    cancelTimer(&writerTimers, &flushTimer);
+
+    while (length > 0) {
+        int res = write(1, buffer, length);
+        if (res == -1) {
+            perror("outputWriter: failed to write pipe output\n");
+            exit(-1);
+        }
+        buffer += res;
+        length -= res;
+    }
+    pipeBufferLen = 0;
+
+    // every message collected so far has been written
+    if (isLatencyReportEnabled()) {
+        completeLatencySamples(realtimeNanoseconds());
+    }
+}
+
+static void flushPipeTimer(void* arg, uint64_t now) {
+    flushPipeOutput();
+}
+
+// pipe mode: collect every available message into one buffer, then write it with a single write()
+// (with a flush delay, messages arriving within the delay are collected into the same write())
+void* writePipeMessages() {
+    pipeBuffer = malloc(getConfig()->pipeBufferSize);
+    pipeBufferLen = 0;
+
+    if (pipeBuffer == NULL) {
+        fprintf(stderr, "outputWriter: could not allocate pipe buffer\n");
         exit(-1);
     }
+    initTimerWheel(&writerTimers, TIMER_TICK_NS);
+
+    while (1) {
+        // wait for messages to write (or for the flush deadline)
+        waitOutputWriter(outputQueue, &writerTimers);
+        runTimers(&writerTimers, timerNow());
+
+        if (countMessages(outputQueue) == 0) {
+            // case: session is ending and every message has been written
+            if (isShuttingDown()) {
+                flushPipeOutput();
+                free(pipeBuffer);
+                return NULL;
+            }
+            continue;
+        }
+
+        do {
+            // get message from outputQueue
+            message = getMessage(outputQueue);
+
+            if(message == NULL) {
+                fprintf(stderr, "outputWriter: failed to get message, message is NULL\n");
+                break;
+            }
+
+            // if message is "!\n" then write what is left and stop the writing
+            // (the end of the session is not a message, the script sees the end of stdout)
+            if (getMessageInfo(message)->endOfSession) {
+                flushPipeOutput();
+                releaseMessage(message);
+                free(pipeBuffer);
+                return NULL;
+            }
+
+            uint64_t dequeueTime = isLatencyReportEnabled() ? realtimeNanoseconds() : 0;
+            int length = getMessageInfo(message)->length;
+            if (pipeBufferLen + PIPE_LENGTH_PREFIX + length > getConfig()->pipeBufferSize) {
+                flushPipeOutput();
+            }
+
+            writePipeLength(pipeBuffer + pipeBufferLen, length);
+            memcpy(pipeBuffer + pipeBufferLen + PIPE_LENGTH_PREFIX, message, length);
+            pipeBufferLen += PIPE_LENGTH_PREFIX + length;
+
+            if (isLatencyReportEnabled()) {
+                addLatencySample(getMessageInfo(message), dequeueTime);
+            }
+
+            releaseMessage(message);
+
+            // continue collecting if there are still messages in the outputQueue
+        } while (countMessages(outputQueue) != 0);
+
+        // write now, or by the flush deadline of the oldest message not written yet
+        if (flushDelay == 0) {
+            flushPipeOutput();
+        } else if (!isTimerPending(&flushTimer)) {
+            addTimer(&writerTimers, &flushTimer, timerNow() + flushDelay, flushPipeTimer, NULL);
+        }
+    }
+
+    return NULL;
 }
 
-void cancelOutputWriter() {
-    int res = pthread_cancel(writerThread);
-    if (res != 0) {
-        perror("outputWriter: thread could not be cancelled\n");
+// pipe mode: wait up to micros for more messages before writing (0 = write as soon as the queue is empty),
+// call before initOutputWriter
+void setOutputFlushDelay(int micros) {
+    flushDelay = (uint64_t)micros * 1000;
+}
+
+void initOutputWriter(MessageQueue* queue) {
+    outputQueue = queue;
+
+    // create writerThread - prints character to the screen (or writes messages to the pipe)
+    int res =  createPipelineThread(THREAD_WRITER, &writerThread, isPipeMode() ? writePipeMessages : writeMessages);
+    if(res != 0){
+        perror("write thread failed");
         exit(-1);
     }
 }
@@ -1,11 +1,12 @@
 #ifndef _OUTPUT_WRITER_H
 #define _OUTPUT_WRITER_H
 
-#include "list.h"
+#include "freeManager.h"
 
 void* writeMessages();
-void initOutputWriter(List* l);
-void cancelOutputWriter();
+void* writePipeMessages();
+void setOutputFlushDelay(int micros);
+void initOutputWriter(MessageQueue* queue);
 void closeOutputWriter();
 
 #endif
\ No newline at end of file
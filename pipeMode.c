@@ -0,0 +1,31 @@
+// PIPE MODE
+// headless mode for scripts: messages on stdin/stdout are length-prefixed instead of typed lines,
+// received messages are written without the "Remote Client: " header
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pipeMode.h"
+
+static int pipeMode = 0;
+
+void initPipeMode() {
+    pipeMode = 1;
+}
+
+int isPipeMode() {
+    return pipeMode;
+}
+
+uint32_t readPipeLength(const char* buffer) {
+    uint32_t length;
+    memcpy(&length, buffer, PIPE_LENGTH_PREFIX);
+    return ntohl(length);
+}
+
+void writePipeLength(char* buffer, uint32_t length) {
+    length = htonl(length);
+    memcpy(buffer, &length, PIPE_LENGTH_PREFIX);
+}
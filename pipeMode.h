@@ -0,0 +1,18 @@
+#ifndef _PIPE_MODE_H
+#define _PIPE_MODE_H
+
+#include <stdint.h>
+
+// default size of the stdin/stdout buffers used in pipe mode (--pipe-buffer)
+#define DEFAULT_PIPE_BUFFER_SIZE (256 * 1024)
+
+// each message on stdin/stdout is a 4 byte big endian length followed by the message bytes
+#define PIPE_LENGTH_PREFIX 4
+
+void initPipeMode();
+int isPipeMode();
+
+uint32_t readPipeLength(const char* buffer);
+void writePipeLength(char* buffer, uint32_t length);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef _QUEUE_H
+#define _QUEUE_H
+
+#include <stddef.h>
+
+// QUEUE
+// intrusive FIFO queue specialized for one element type: each element embeds the pointer that links it to the
+// next one, so adding and removing an element only touches the element and the queue (no separate node,
+// no shared pool of nodes)
+// an element can be in one queue at a time, the queue does not lock: callers that share a queue hold their own mutex
+//
+// DEFINE_QUEUE(Name, Type, link) defines the queue type Name for elements of type Type, linked through
+// their Type* member link, and its functions:
+// - void Name_init(Name* queue, int capacity)    capacity = most elements the queue holds (0 = no limit)
+// - int Name_push(Name* queue, Type* element)    add element at the back, returns -1 (and does not add it) if full
+// - Type* Name_pop(Name* queue)                  remove and return the front element, NULL if the queue is empty
+// - Type* Name_peek(const Name* queue)           front element, NULL if the queue is empty
+// - int Name_count(const Name* queue)
+// - int Name_isFull(const Name* queue)
+
+#define DEFINE_QUEUE(Name, Type, link) \
+    typedef struct Name##_s Name; \
+    struct Name##_s { \
+        Type* head; \
+        Type* tail; \
+        int count; \
+        int capacity; \
+    }; \
+    \
+    static inline void Name##_init(Name* queue, int capacity) { \
+        queue->head = NULL; \
+        queue->tail = NULL; \
+        queue->count = 0; \
+        queue->capacity = capacity; \
+    } \
+    \
+    static inline int Name##_isFull(const Name* queue) { \
+        return queue->capacity != 0 && queue->count >= queue->capacity; \
+    } \
+    \
+    static inline int Name##_push(Name* queue, Type* element) { \
+        if (Name##_isFull(queue)) { \
+            return -1; \
+        } \
+        element->link = NULL; \
+        if (queue->tail == NULL) { \
+            queue->head = element; \
+        } else { \
+            queue->tail->link = element; \
+        } \
+        queue->tail = element; \
+        queue->count++; \
+        return 0; \
+    } \
+    \
+    static inline Type* Name##_pop(Name* queue) { \
+        Type* element = queue->head; \
+        if (element == NULL) { \
+            return NULL; \
+        } \
+        queue->head = element->link; \
+        if (queue->head == NULL) { \
+            queue->tail = NULL; \
+        } \
+        element->link = NULL; \
+        queue->count--; \
+        return element; \
+    } \
+    \
+    static inline Type* Name##_peek(const Name* queue) { \
+        return queue->head; \
+    } \
+    \
+    static inline int Name##_count(const Name* queue) { \
+        return queue->count; \
+    }
+
+#endif
@@ -0,0 +1,269 @@
+// References:
+// RFC 2697 - A Single Rate Three Color Marker (token bucket)
+
+// RATE LIMIT
+// token bucket limits for inbound datagrams, checked by listenerThread before a datagram is decoded or copied
+// into a message, so a flooding sender costs a recvmsg() per datagram and nothing else
+// - every source address has a message bucket and a byte bucket, each refilled at its limit per second and holding
+//   up to one second's worth (the port is left out: a sender could pick a new one for every datagram)
+// - all sources together also share a pair of buckets, RATE_LIMIT_AGGREGATE times the size, which bounds a flood
+//   from more addresses than the table holds
+// - the configured peers (the remote client and every --peer) are reserved: their buckets are kept apart from the
+//   table and the shared buckets, so a flood from other (or spoofed) addresses cannot use up their capacity, and
+//   their heartbeats, receipts and hellos pass without taking tokens (dropped behind a burst of messages, they
+//   would end the session by the peer timeout or report delivered messages as lost)
+// - a datagram passes while its source's and the shared buckets have tokens left, its bytes may take the byte
+//   buckets below zero so datagrams larger than the byte limit still get through (at the configured average)
+// - sources are kept in a small table, a new source replaces the one that was heard from least recently and takes
+//   over its tokens (only a source in a free entry starts with full buckets), so going through addresses to get
+//   new entries gains nothing
+// everything except the report (printed after listenerThread has been joined) belongs to listenerThread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "rateLimit.h"
+#include "timerWheel.h"
+#include "frame.h"
+
+typedef struct Source_s Source;
+struct Source_s {
+    uint32_t addr;        // network byte order
+    int inUse;
+    int reserved;         // a configured peer, never replaced and not counted in the shared buckets
+    int limited;          // has been told about (the first drop is reported)
+    uint64_t lastSeen;    // CLOCK_MONOTONIC in ns, also when the buckets were last refilled
+    double messageTokens;
+    double byteTokens;
+    uint64_t droppedMessages;
+    uint64_t droppedBytes;
+};
+
+static int rateLimitEnabled = 0;
+static double messageRate; // per second, 0 = no limit
+static double byteRate;    // per second, 0 = no limit
+static Source sources[RATE_LIMIT_SOURCES];
+static Source reservedSources[RATE_LIMIT_RESERVED];
+static int reservedCount = 0;
+static Source* lastSource; // usually the remote client, checked first
+
+// buckets shared by all sources
+static double aggregateMessageTokens;
+static double aggregateByteTokens;
+static uint64_t aggregateLastRefill;
+static int aggregateLimited;
+
+// drops of sources that have been replaced since
+static uint64_t evictedMessages;
+static uint64_t evictedBytes;
+
+// keep buckets of their own for addr, a configured peer (once per address, further ones share it)
+// called for each --peer while the options are read, and by initRateLimit for the remote client
+void reserveRateLimit(const struct sockaddr_in* addr) {
+    for (int i = 0; i < reservedCount; i++) {
+        if (reservedSources[i].addr == addr->sin_addr.s_addr) {
+            return;
+        }
+    }
+    if (reservedCount == RATE_LIMIT_RESERVED) {
+        return;
+    }
+
+    Source* s = &reservedSources[reservedCount++];
+    memset(s, 0, sizeof(Source));
+    s->addr = addr->sin_addr.s_addr;
+    s->inUse = 1;
+    s->reserved = 1;
+}
+
+// start up: limit every source to messagesPerSecond datagrams and bytesPerSecond bytes (0 = no limit),
+// and reserve capacity for the remote client
+void initRateLimit(int messagesPerSecond, int bytesPerSecond, char* remoteName, char* remotePort) {
+    struct addrinfo hints, *servinfo;
+    uint64_t now = timerNow();
+
+    messageRate = messagesPerSecond;
+    byteRate = bytesPerSecond;
+    rateLimitEnabled = messagesPerSecond > 0 || bytesPerSecond > 0;
+    if (!rateLimitEnabled) {
+        return;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int gaiVal = getaddrinfo(remoteName, remotePort, &hints, &servinfo);
+    if (gaiVal != 0) {
+        fprintf(stderr, "rateLimit: getaddrinfo error: %s\n", gai_strerror(gaiVal));
+        exit(-1);
+    }
+    reserveRateLimit((const struct sockaddr_in*)servinfo->ai_addr);
+    freeaddrinfo(servinfo);
+
+    // reserved sources start with full buckets
+    for (int i = 0; i < reservedCount; i++) {
+        reservedSources[i].lastSeen = now;
+        reservedSources[i].messageTokens = messageRate;
+        reservedSources[i].byteTokens = byteRate;
+    }
+
+    aggregateMessageTokens = messageRate * RATE_LIMIT_AGGREGATE;
+    aggregateByteTokens = byteRate * RATE_LIMIT_AGGREGATE;
+    aggregateLastRefill = now;
+}
+
+static void refill(double* tokens, double rate, uint64_t elapsed) {
+    *tokens += rate * elapsed / 1e9;
+    if (*tokens > rate) {
+        *tokens = rate;
+    }
+}
+
+int isRateLimitEnabled() {
+    return rateLimitEnabled;
+}
+
+// find from's entry, or replace the least recently seen one (a free entry starts with full buckets, a replaced
+// one keeps the tokens it has by now)
+static Source* lookupSource(const struct sockaddr_in* from, uint64_t now) {
+    Source* oldest = &sources[0];
+    double messageTokens = messageRate;
+    double byteTokens = byteRate;
+
+    if (lastSource != NULL && lastSource->addr == from->sin_addr.s_addr) {
+        return lastSource;
+    }
+
+    for (int i = 0; i < reservedCount; i++) {
+        if (reservedSources[i].addr == from->sin_addr.s_addr) {
+            lastSource = &reservedSources[i];
+            return lastSource;
+        }
+    }
+
+    for (int i = 0; i < RATE_LIMIT_SOURCES; i++) {
+        Source* s = &sources[i];
+
+        if (s->inUse && s->addr == from->sin_addr.s_addr) {
+            lastSource = s;
+            return s;
+        }
+        if (!s->inUse || (oldest->inUse && s->lastSeen < oldest->lastSeen)) {
+            oldest = s;
+        }
+    }
+
+    if (oldest->inUse) {
+        refill(&oldest->messageTokens, messageRate, now - oldest->lastSeen);
+        refill(&oldest->byteTokens, byteRate, now - oldest->lastSeen);
+        messageTokens = oldest->messageTokens;
+        byteTokens = oldest->byteTokens;
+    }
+
+    evictedMessages += oldest->droppedMessages;
+    evictedBytes += oldest->droppedBytes;
+
+    memset(oldest, 0, sizeof(Source));
+    oldest->addr = from->sin_addr.s_addr;
+    oldest->inUse = 1;
+    oldest->lastSeen = now;
+    oldest->messageTokens = messageTokens;
+    oldest->byteTokens = byteTokens;
+    lastSource = oldest;
+    return oldest;
+}
+
+// 1 if the buckets are out of tokens for another datagram
+static int isOverLimit(double messageTokens, double byteTokens) {
+    return (messageRate > 0 && messageTokens < 1) || (byteRate > 0 && byteTokens <= 0);
+}
+
+// listenerThread: take the numbytes of datagram from from's buckets
+// returns 1 if the datagram is within the limits, 0 if it should be dropped
+int acceptDatagram(const struct sockaddr_in* from, const char* datagram, int numbytes) {
+    uint64_t now = timerNow();
+    Source* s = lookupSource(from, now);
+
+    // a configured peer's heartbeats, receipts and hellos (forged ones are still dropped when they are decoded)
+    if (s->reserved && isControlFrame(datagram, numbytes)) {
+        return 1;
+    }
+
+    refill(&s->messageTokens, messageRate, now - s->lastSeen);
+    refill(&s->byteTokens, byteRate, now - s->lastSeen);
+    s->lastSeen = now;
+
+    refill(&aggregateMessageTokens, messageRate * RATE_LIMIT_AGGREGATE, now - aggregateLastRefill);
+    refill(&aggregateByteTokens, byteRate * RATE_LIMIT_AGGREGATE, now - aggregateLastRefill);
+    aggregateLastRefill = now;
+
+    if (isOverLimit(s->messageTokens, s->byteTokens)) {
+        s->droppedMessages++;
+        s->droppedBytes += numbytes;
+
+        // report once per source, a flood would flood stderr too
+        if (!s->limited) {
+            char name[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &from->sin_addr, name, sizeof(name));
+            fprintf(stderr, "UDPServer: %s is over the rate limit, dropping its datagrams\n", name);
+            s->limited = 1;
+        }
+        return 0;
+    }
+
+    if (!s->reserved && isOverLimit(aggregateMessageTokens, aggregateByteTokens)) {
+        s->droppedMessages++;
+        s->droppedBytes += numbytes;
+
+        if (!aggregateLimited) {
+            fprintf(stderr, "UDPServer: all sources together are over the rate limit, dropping datagrams\n");
+            aggregateLimited = 1;
+        }
+        return 0;
+    }
+
+    s->messageTokens -= 1;
+    s->byteTokens -= numbytes;
+    if (!s->reserved) {
+        aggregateMessageTokens -= 1;
+        aggregateByteTokens -= numbytes;
+    }
+    return 1;
+}
+
+// add s's drops to the totals, and print them if there are any
+static void reportSource(const Source* s, uint64_t* messages, uint64_t* bytes) {
+    char name[INET_ADDRSTRLEN];
+
+    if (!s->inUse || s->droppedMessages == 0) {
+        return;
+    }
+    inet_ntop(AF_INET, &s->addr, name, sizeof(name));
+    fprintf(stderr, "rate limit: dropped %llu datagrams (%llu bytes) from %s%s\n", (unsigned long long)s->droppedMessages,
+        (unsigned long long)s->droppedBytes, name, s->reserved ? " (configured peer)" : "");
+    *messages += s->droppedMessages;
+    *bytes += s->droppedBytes;
+}
+
+// print the drop counters to stderr (stdout may be a pipe mode stream)
+void printRateLimitReport() {
+    uint64_t messages = evictedMessages;
+    uint64_t bytes = evictedBytes;
+
+    if (!rateLimitEnabled) {
+        return;
+    }
+
+    for (int i = 0; i < reservedCount; i++) {
+        reportSource(&reservedSources[i], &messages, &bytes);
+    }
+    for (int i = 0; i < RATE_LIMIT_SOURCES; i++) {
+        reportSource(&sources[i], &messages, &bytes);
+    }
+
+    fprintf(stderr, "rate limit: dropped %llu datagrams (%llu bytes) in total\n", (unsigned long long)messages, (unsigned long long)bytes);
+}
@@ -0,0 +1,21 @@
+#ifndef _RATE_LIMIT_H
+#define _RATE_LIMIT_H
+
+#include <netinet/in.h>
+
+#include "rooms.h"
+
+// source addresses that have their own buckets at a time
+#define RATE_LIMIT_SOURCES 64
+// the buckets shared by all sources hold this many sources' worth
+#define RATE_LIMIT_AGGREGATE 4
+// configured peer addresses with buckets of their own (the remote client and --peer addresses, see rooms.h)
+#define RATE_LIMIT_RESERVED (MAX_PEERS + 1)
+
+void reserveRateLimit(const struct sockaddr_in* addr);
+void initRateLimit(int messagesPerSecond, int bytesPerSecond, char* remoteName, char* remotePort);
+int isRateLimitEnabled();
+int acceptDatagram(const struct sockaddr_in* from, const char* datagram, int numbytes);
+void printRateLimitReport();
+
+#endif
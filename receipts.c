@@ -0,0 +1,309 @@
+// DELIVERY RECEIPTS
+// with --receipts, the remote client acknowledges every message it received and the terminal shows which of the
+// sent messages were delivered and which were not
+// - senderThread gives every message to the remote client the next message id (0, 1, 2, ...) and sends it in the
+//   frame, the id's slot in a ring of RECEIPT_RING_SIZE keeps its send time and the start of the message
+// - the receiving listenerThread collects the ids of the messages it queued as ranges of consecutive ids, and sends
+//   them in one FRAME_RECEIPTS datagram per interval (sooner if RECEIPT_FLUSH_IDS are waiting or the ranges run out),
+//   so a receipt costs no datagram of its own
+// - the sending listenerThread marks the acknowledged slots delivered, and once per interval gives up on the messages
+//   that have waited longer than the receipt timeout
+// - status lines ("Delivered: ...", "Not delivered: ...") go to outputQueue, one per receipts datagram or check
+//   (in pipe mode stdout only carries messages, so there is only the report)
+// the ring is shared by senderThread and listenerThread (receiptsMutex), the receiver state belongs to listenerThread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "receipts.h"
+#include "frame.h"
+#include "threadManager.h"
+#include "pipeMode.h"
+#include "echo.h"
+#include "latencyReport.h"
+#include "transport.h"
+
+#define RECEIPT_RING_MASK (RECEIPT_RING_SIZE - 1)
+
+// a sent message in the ring
+typedef struct Receipt_s Receipt;
+struct Receipt_s {
+    uint64_t sentAt;  // CLOCK_MONOTONIC in ns
+    uint8_t waiting;  // no receipt yet
+    uint8_t previewLen;
+    uint8_t truncated; // the message is longer than its preview
+    char preview[RECEIPT_PREVIEW_LEN];
+};
+
+static int receiptsEnabled = 0;
+static uint64_t interval;
+static uint64_t timeout;
+static struct sockaddr_in peerAddr;
+
+// sender: ids in [firstId, nextId) are in the ring, ids before firstId are settled
+static Receipt ring[RECEIPT_RING_SIZE];
+static uint32_t firstId = 0;
+static uint32_t nextId = 0;
+static uint64_t sentCount = 0;
+static uint64_t deliveredCount = 0;
+static uint64_t undeliveredCount = 0;
+static pthread_mutex_t receiptsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// listenerThread
+static int receiptsSockfd = -1;
+static TimerWheel* wheel;
+static Timer sendTimer;  // receiver: acknowledged ids are due to be sent
+static Timer checkTimer; // sender: look for messages that timed out
+static MessageQueue* statusQueue;
+static ReceiptRange ranges[RECEIPT_MAX_RANGES]; // host byte order until sent
+static int rangeCount = 0;
+static int pendingIds = 0;
+
+// start up: resolve the remote client's listening address, where receipts are sent
+void initReceipts(int intervalMs, char* remoteName, char* remotePort) {
+    struct addrinfo hints, *servinfo;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET; // using IPv4
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int gaiVal = getaddrinfo(remoteName, remotePort, &hints, &servinfo);
+    if (gaiVal != 0) {
+        fprintf(stderr, "receipts: getaddrinfo error: %s\n", gai_strerror(gaiVal));
+        exit(-1);
+    }
+    memcpy(&peerAddr, servinfo->ai_addr, sizeof(peerAddr));
+    freeaddrinfo(servinfo);
+
+    interval = (uint64_t)intervalMs * 1000000;
+    timeout = RECEIPT_TIMEOUT_INTERVALS * interval;
+    if (timeout < RECEIPT_MIN_TIMEOUT_MS * 1000000ULL) {
+        timeout = RECEIPT_MIN_TIMEOUT_MS * 1000000ULL;
+    }
+    receiptsEnabled = 1;
+}
+
+int isReceiptsEnabled() {
+    return receiptsEnabled;
+}
+
+// move firstId past the settled slots (receiptsMutex held)
+static void settleFront() {
+    while (firstId != nextId && !ring[firstId & RECEIPT_RING_MASK].waiting) {
+        firstId++;
+    }
+}
+
+// senderThread: message (length bytes) is about to be sent to the remote client, returns its id for the frame
+uint32_t trackMessage(const char* message, int length) {
+    pthread_mutex_lock(&receiptsMutex);
+
+    // case: the ring is full, give up on the oldest message
+    if (nextId - firstId == RECEIPT_RING_SIZE) {
+        ring[firstId & RECEIPT_RING_MASK].waiting = 0;
+        undeliveredCount++;
+        firstId++;
+        settleFront();
+    }
+
+    uint32_t id = nextId++;
+    Receipt* receipt = &ring[id & RECEIPT_RING_MASK];
+    const char* end = memchr(message, '\n', length);
+    int textLen = end != NULL ? end - message : length;
+
+    receipt->sentAt = timerNow();
+    receipt->waiting = 1;
+    receipt->previewLen = textLen < RECEIPT_PREVIEW_LEN ? textLen : RECEIPT_PREVIEW_LEN;
+    receipt->truncated = textLen > RECEIPT_PREVIEW_LEN;
+    memcpy(receipt->preview, message, receipt->previewLen);
+    sentCount++;
+
+    pthread_mutex_unlock(&receiptsMutex);
+    return id;
+}
+
+// status line for count messages, the last of them is last
+static void queueStatus(const char* status, int count, const Receipt* last) {
+    char line[128];
+    const char* more = last->truncated ? "..." : "";
+
+    if (count == 0 || isPipeMode()) {
+        return;
+    }
+
+    if (count == 1) {
+        snprintf(line, sizeof(line), "%s: %.*s%s\n", status, last->previewLen, last->preview, more);
+    } else {
+        snprintf(line, sizeof(line), "%s: %d messages, the last \"%.*s%s\"\n", status, count, last->previewLen, last->preview, more);
+    }
+
+    char* message = allocMessage(strlen(line));
+    strcpy(message, line);
+    if (isEchoEnabled()) {
+        getMessageInfo(message)->enqueueTime = realtimeNanoseconds(); // merged with echoed messages by time
+    }
+    if (addMessage(statusQueue, message) == MESSAGE_QUEUE_FAIL) {
+        releaseMessage(message);
+        return;
+    }
+    signalOutputWriter();
+}
+
+// sender: give up on the messages that have waited for their receipt longer than the timeout
+static void checkReceipts(void* arg, uint64_t now) {
+    Receipt last = { 0 };
+    int count = 0;
+
+    pthread_mutex_lock(&receiptsMutex);
+    while (firstId != nextId) {
+        Receipt* receipt = &ring[firstId & RECEIPT_RING_MASK];
+
+        // messages are in send order, the rest are younger
+        if (receipt->waiting && now - receipt->sentAt < timeout) {
+            break;
+        }
+        if (receipt->waiting) {
+            receipt->waiting = 0;
+            undeliveredCount++;
+            last = *receipt;
+            count++;
+        }
+        firstId++;
+    }
+    pthread_mutex_unlock(&receiptsMutex);
+
+    if (count > 0) {
+        queueStatus("Not delivered", count, &last);
+    }
+    addTimer(wheel, &checkTimer, now + interval, checkReceipts, NULL);
+}
+
+// receiver: send the acknowledged ids to the remote client in one datagram
+static void sendReceipts() {
+    char frame[sizeof(FrameHeader) + FRAME_TIMESTAMP_LEN + sizeof(ranges) + CIPHER_TAG_LEN];
+    ReceiptRange payload[RECEIPT_MAX_RANGES];
+
+    cancelTimer(wheel, &sendTimer);
+    if (rangeCount == 0) {
+        return;
+    }
+
+    for (int i = 0; i < rangeCount; i++) {
+        payload[i].first = htonl(ranges[i].first);
+        payload[i].count = htonl(ranges[i].count);
+    }
+
+    int frameLen = encodeReceiptsFrame((const char*)payload, rangeCount * sizeof(ReceiptRange), frame, sizeof(frame));
+    rangeCount = 0;
+    pendingIds = 0;
+    if (frameLen == -1) {
+        fprintf(stderr, "receipts: could not frame receipts\n");
+        return;
+    }
+
+    // a lost receipt is not an error, the message shows as not delivered
+    getTransport()->send(receiptsSockfd, frame, frameLen, 0, (const struct sockaddr*)&peerAddr, sizeof(peerAddr));
+}
+
+static void sendReceiptsTimer(void* arg, uint64_t now) {
+    sendReceipts();
+}
+
+// listenerThread: receipts are sent from the listening socket to the remote client's, where they are handled
+// statusQueue = outputQueue, for the status lines
+void startReceipts(int sockfd, TimerWheel* timers, MessageQueue* queue) {
+    receiptsSockfd = sockfd;
+    wheel = timers;
+    statusQueue = queue;
+    addTimer(wheel, &checkTimer, timerNow() + interval, checkReceipts, NULL);
+}
+
+// listenerThread: the message with id receiptId was added to outputQueue
+void acknowledgeMessage(uint32_t receiptId) {
+    // case: continues the last range (messages mostly arrive in order)
+    if (rangeCount > 0 && receiptId == ranges[rangeCount - 1].first + ranges[rangeCount - 1].count) {
+        ranges[rangeCount - 1].count++;
+    } else {
+        if (rangeCount == RECEIPT_MAX_RANGES) {
+            sendReceipts();
+        }
+        ranges[rangeCount].first = receiptId;
+        ranges[rangeCount].count = 1;
+        rangeCount++;
+    }
+    pendingIds++;
+
+    if (pendingIds >= RECEIPT_FLUSH_IDS) {
+        sendReceipts();
+    } else if (!isTimerPending(&sendTimer)) {
+        addTimer(wheel, &sendTimer, timerNow() + interval, sendReceiptsTimer, NULL);
+    }
+}
+
+// listenerThread: send the ids acknowledged so far without waiting for the interval (the session is ending)
+void flushReceipts() {
+    if (receiptsEnabled && rangeCount > 0) {
+        sendReceipts();
+    }
+}
+
+// listenerThread: the remote client acknowledged the ranges of ids in payload
+void handleReceipts(const char* payload, int length) {
+    ReceiptRange range;
+    Receipt last = { 0 };
+    int count = 0;
+
+    pthread_mutex_lock(&receiptsMutex);
+    for (int pos = 0; pos + (int)sizeof(range) <= length; pos += sizeof(range)) {
+        memcpy(&range, payload + pos, sizeof(range));
+        uint32_t first = ntohl(range.first);
+        int64_t rangeLen = ntohl(range.count);
+
+        // keep the part of the range that is in the ring
+        int64_t skip = (int32_t)(firstId - first);
+        if (skip > 0) {
+            first += skip;
+            rangeLen -= skip;
+        }
+        int64_t inRing = (int32_t)(nextId - first);
+        if (rangeLen > inRing) {
+            rangeLen = inRing;
+        }
+
+        for (int64_t i = 0; i < rangeLen; i++) {
+            Receipt* receipt = &ring[(first + i) & RECEIPT_RING_MASK];
+            if (receipt->waiting) {
+                receipt->waiting = 0;
+                deliveredCount++;
+                last = *receipt;
+                count++;
+            }
+        }
+    }
+    settleFront();
+    pthread_mutex_unlock(&receiptsMutex);
+
+    if (count > 0) {
+        queueStatus("Delivered", count, &last);
+    }
+}
+
+// print the totals to stderr (stdout may be a pipe mode stream)
+void printReceiptsReport() {
+    if (!receiptsEnabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&receiptsMutex);
+    uint64_t waiting = sentCount - deliveredCount - undeliveredCount;
+    fprintf(stderr, "receipts: %llu messages sent, %llu delivered, %llu not delivered, %llu still waiting\n",
+        (unsigned long long)sentCount, (unsigned long long)deliveredCount, (unsigned long long)undeliveredCount,
+        (unsigned long long)waiting);
+    pthread_mutex_unlock(&receiptsMutex);
+}
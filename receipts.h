@@ -0,0 +1,41 @@
+#ifndef _RECEIPTS_H
+#define _RECEIPTS_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "freeManager.h"
+#include "timerWheel.h"
+
+// sent messages waiting for a receipt, the oldest is given up on when a message is sent with the ring full
+// (power of two)
+#define RECEIPT_RING_SIZE 4096
+// a message not acknowledged within this many receipt intervals (and at least RECEIPT_MIN_TIMEOUT_MS) was not delivered
+#define RECEIPT_TIMEOUT_INTERVALS 10
+#define RECEIPT_MIN_TIMEOUT_MS 1000
+// receiver: most id ranges per receipts datagram, and most ids acknowledged before the interval is up
+#define RECEIPT_MAX_RANGES 32
+#define RECEIPT_FLUSH_IDS (RECEIPT_RING_SIZE / 4)
+// start of a sent message kept to show in its status line
+#define RECEIPT_PREVIEW_LEN 24
+
+// one range of acknowledged message ids in a FRAME_RECEIPTS payload (network byte order)
+typedef struct ReceiptRange_s ReceiptRange;
+struct __attribute__((packed)) ReceiptRange_s {
+    uint32_t first;
+    uint32_t count;
+};
+
+void initReceipts(int intervalMs, char* remoteName, char* remotePort);
+int isReceiptsEnabled();
+
+uint32_t trackMessage(const char* message, int length);
+
+void startReceipts(int sockfd, TimerWheel* timers, MessageQueue* statusQueue);
+void acknowledgeMessage(uint32_t receiptId);
+void flushReceipts();
+void handleReceipts(const char* payload, int length);
+
+void printReceiptsReport();
+
+#endif
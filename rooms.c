@@ -0,0 +1,316 @@
+// ROOMS
+// named rooms: a message that starts with "#room " is sent to the peers subscribed to room instead of the
+// remote client (other messages, including ones starting with '#' for a room that does not exist, are sent as usual)
+// - peers are named addresses (--peer NAME=HOST:PORT), "remote" is the remote client of the arguments
+// - rooms and their subscribers come from --room ROOM:NAME,NAME... and the /join, /leave commands
+// - fan-out: the message is framed once, and that one buffer is sent to every subscriber by sendmmsg() calls of up
+//   to ROOM_SEND_BATCH addresses each, so a message to a room of 200 costs one buffer and 4 syscalls
+// the receivers see the "#room " prefix, so their output shows which room a message was sent to
+// the registry is changed by keyboardThread (commands) and read by senderThread, roomsMutex guards it
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "rooms.h"
+#include "pipeMode.h"
+#include "rateLimit.h"
+#include "transport.h"
+
+typedef struct Peer_s Peer;
+struct Peer_s {
+    char name[MAX_NAME_LEN + 1];
+    struct sockaddr_in addr;
+    int known; // addr is set (the remote client's is set by senderThread once it is resolved)
+};
+
+struct Room_s {
+    char name[MAX_NAME_LEN + 1];
+    unsigned char members[MAX_PEERS]; // per peer: subscribed
+    int memberCount;
+};
+
+static Peer peers[MAX_PEERS];
+static int peerCount = 1; // peers[0] is the remote client
+static Room rooms[MAX_ROOMS];
+static int roomCount = 0;
+static int roomsEnabled = 0;
+static pthread_mutex_t roomsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// room specs from --room, resolved by initRooms once every --peer has been seen
+static char* roomSpecs[MAX_ROOMS];
+static int roomSpecCount = 0;
+
+static int isValidName(const char* name, int length) {
+    if (length <= 0 || length > MAX_NAME_LEN) {
+        return 0;
+    }
+    for (int i = 0; i < length; i++) {
+        if (name[i] == ' ' || name[i] == '\n' || name[i] == ',' || name[i] == '=' || name[i] == '#') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int findPeer(const char* name, int length) {
+    for (int i = 0; i < peerCount; i++) {
+        if ((int)strlen(peers[i].name) == length && memcmp(peers[i].name, name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Room* findRoom(const char* name, int length) {
+    for (int i = 0; i < roomCount; i++) {
+        if ((int)strlen(rooms[i].name) == length && memcmp(rooms[i].name, name, length) == 0) {
+            return &rooms[i];
+        }
+    }
+    return NULL;
+}
+
+static Room* createRoom(const char* name, int length) {
+    Room* room = findRoom(name, length);
+
+    if (room == NULL && roomCount < MAX_ROOMS) {
+        room = &rooms[roomCount++];
+        memset(room, 0, sizeof(*room));
+        memcpy(room->name, name, length);
+    }
+    return room;
+}
+
+static void subscribe(Room* room, int peer) {
+    if (!room->members[peer]) {
+        room->members[peer] = 1;
+        room->memberCount++;
+    }
+}
+
+static void unsubscribe(Room* room, int peer) {
+    if (room->members[peer]) {
+        room->members[peer] = 0;
+        room->memberCount--;
+    }
+}
+
+// --peer NAME=HOST:PORT, returns -1 if it is malformed or HOST:PORT can not be resolved
+int addPeer(const char* spec) {
+    struct addrinfo hints, *servinfo;
+    char host[256];
+    const char* equals = strchr(spec, '=');
+    const char* colon = strrchr(spec, ':');
+
+    if (equals == NULL || colon == NULL || colon < equals || colon - equals - 1 >= (int)sizeof(host)
+        || !isValidName(spec, equals - spec) || findPeer(spec, equals - spec) != -1 || peerCount == MAX_PEERS) {
+        return -1;
+    }
+
+    memcpy(host, equals + 1, colon - equals - 1);
+    host[colon - equals - 1] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int gaiVal = getaddrinfo(host, colon + 1, &hints, &servinfo);
+    if (gaiVal != 0) {
+        fprintf(stderr, "rooms: could not resolve %s: %s\n", spec, gai_strerror(gaiVal));
+        return -1;
+    }
+
+    Peer* peer = &peers[peerCount++];
+    memcpy(peer->name, spec, equals - spec);
+    memcpy(&peer->addr, servinfo->ai_addr, sizeof(peer->addr));
+    peer->known = 1;
+    freeaddrinfo(servinfo);
+
+    // with --rate-limit, a configured peer keeps its own capacity
+    reserveRateLimit(&peer->addr);
+
+    roomsEnabled = 1;
+    return 0;
+}
+
+// --room ROOM:NAME[,NAME...], the names are looked up by initRooms (so --peer may come after it)
+int addRoom(const char* spec) {
+    const char* colon = strchr(spec, ':');
+
+    if (colon == NULL || !isValidName(spec, colon - spec) || roomSpecCount == MAX_ROOMS) {
+        return -1;
+    }
+    roomSpecs[roomSpecCount++] = strdup(spec);
+    roomsEnabled = 1;
+    return 0;
+}
+
+// start up: create the rooms given with --room, returns -1 (after printing the problem) if one names an unknown peer
+int initRooms() {
+    strcpy(peers[0].name, REMOTE_PEER_NAME);
+
+    for (int i = 0; i < roomSpecCount; i++) {
+        char* spec = roomSpecs[i];
+        char* colon = strchr(spec, ':');
+        Room* room = createRoom(spec, colon - spec);
+
+        for (char* name = colon + 1; *name != '\0'; ) {
+            int length = strcspn(name, ",");
+            int peer = findPeer(name, length);
+            if (peer == -1) {
+                fprintf(stderr, "rooms: --room %s names an unknown peer (add it with --peer NAME=HOST:PORT)\n", spec);
+                return -1;
+            }
+            subscribe(room, peer);
+            name += length + (name[length] == ',');
+        }
+        free(spec);
+    }
+    roomSpecCount = 0;
+
+    return 0;
+}
+
+int isRoomsEnabled() {
+    return roomsEnabled;
+}
+
+// senderThread: address of the remote client, once it is resolved
+void setRemotePeer(const struct sockaddr* addr, socklen_t addrLen) {
+    pthread_mutex_lock(&roomsMutex);
+    memcpy(&peers[0].addr, addr, addrLen < sizeof(peers[0].addr) ? addrLen : sizeof(peers[0].addr));
+    peers[0].known = 1;
+    pthread_mutex_unlock(&roomsMutex);
+}
+
+// the room message is addressed to ("#room text"), NULL if it is not a room message
+Room* findMessageRoom(const char* message) {
+    if (!roomsEnabled || message[0] != '#') {
+        return NULL;
+    }
+
+    int length = strcspn(message + 1, " \n");
+    if (message[1 + length] != ' ') {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&roomsMutex);
+    Room* room = findRoom(message + 1, length);
+    pthread_mutex_unlock(&roomsMutex);
+    return room;
+}
+
+// senderThread: send datagram to every subscriber of room from sockfd
+// returns the number of peers it was sent to
+int sendToRoom(int sockfd, Room* room, const char* datagram, int length) {
+    struct iovec iov = { .iov_base = (char*)datagram, .iov_len = length };
+    struct mmsghdr msgs[ROOM_SEND_BATCH];
+    int batchCount = 0;
+    int sent = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    pthread_mutex_lock(&roomsMutex);
+
+    for (int i = 0; i < peerCount; i++) {
+        if (room->members[i] && peers[i].known) {
+            // every message of the batch points at the same buffer
+            msgs[batchCount].msg_hdr.msg_name = &peers[i].addr;
+            msgs[batchCount].msg_hdr.msg_namelen = sizeof(peers[i].addr);
+            msgs[batchCount].msg_hdr.msg_iov = &iov;
+            msgs[batchCount].msg_hdr.msg_iovlen = 1;
+            batchCount++;
+        }
+
+        if (batchCount == ROOM_SEND_BATCH || (i == peerCount - 1 && batchCount > 0)) {
+            int pos = 0;
+            while (pos < batchCount) {
+                int res = getTransport()->sendBatch(sockfd, msgs + pos, batchCount - pos, 0);
+                if (res == -1) {
+                    // case: this peer's datagram failed (e.g. unreachable network), go on with the next one
+                    perror("rooms: could not send to a peer");
+                    pos++;
+                    continue;
+                }
+                pos += res;
+                sent += res;
+            }
+            batchCount = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&roomsMutex);
+    return sent;
+}
+
+// longest "/rooms" line: the room name and the largest subscriber count an int holds
+#define ROOM_LINE_LEN (MAX_NAME_LEN + sizeof("#: -2147483648 subscribers\n") - 1)
+
+static void printLine(const char* line) {
+    if (write(1, line, strlen(line)) == -1) {
+        perror("rooms: failed to print");
+    }
+}
+
+// keyboardThread: /join #room NAME, /leave #room NAME and /rooms, returns 1 if line was one of them
+int runRoomCommand(const char* line) {
+    char room[MAX_NAME_LEN + 1], name[MAX_NAME_LEN + 1];
+    char output[MAX_ROOMS * ROOM_LINE_LEN + 1];
+    int join;
+
+    if (!roomsEnabled || isPipeMode() || line[0] != '/') {
+        return 0;
+    }
+
+    if (strcmp(line, "/rooms\n") == 0) {
+        int pos = 0;
+        pthread_mutex_lock(&roomsMutex);
+        // (output holds every room, but a cut short list is better than writing past it)
+        for (int i = 0; i < roomCount && pos < (int)sizeof(output); i++) {
+            pos += snprintf(output + pos, sizeof(output) - pos, "#%s: %d subscribers\n", rooms[i].name, rooms[i].memberCount);
+        }
+        pthread_mutex_unlock(&roomsMutex);
+        printLine(pos == 0 ? "No rooms\n" : output);
+        return 1;
+    }
+
+    if (sscanf(line, "/join #%31s %31s", room, name) == 2) {
+        join = 1;
+    } else if (sscanf(line, "/leave #%31s %31s", room, name) == 2) {
+        join = 0;
+    } else if (strncmp(line, "/join", 5) == 0 || strncmp(line, "/leave", 6) == 0) {
+        printLine("Usage: /join #room peer, /leave #room peer\n");
+        return 1;
+    } else {
+        return 0;
+    }
+
+    if (!isValidName(room, strlen(room))) {
+        printLine("Usage: /join #room peer, /leave #room peer\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&roomsMutex);
+    int peer = findPeer(name, strlen(name));
+    Room* target = join ? createRoom(room, strlen(room)) : findRoom(room, strlen(room));
+    if (peer != -1 && target != NULL) {
+        if (join) {
+            subscribe(target, peer);
+        } else {
+            unsubscribe(target, peer);
+        }
+    }
+    pthread_mutex_unlock(&roomsMutex);
+
+    if (peer == -1) {
+        printLine("Unknown peer\n");
+    } else if (target == NULL) {
+        printLine(join ? "Too many rooms\n" : "Unknown room\n");
+    }
+    return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef _ROOMS_H
+#define _ROOMS_H
+
+#include <sys/socket.h>
+
+#define MAX_PEERS 256
+#define MAX_ROOMS 32
+#define MAX_NAME_LEN 31
+
+// name of the peer given by the [remote machine name] [remote port number] arguments
+#define REMOTE_PEER_NAME "remote"
+
+// peers a room message is sent to with one sendmmsg()
+#define ROOM_SEND_BATCH 64
+
+typedef struct Room_s Room;
+
+int addPeer(const char* spec);
+int addRoom(const char* spec);
+int initRooms();
+int isRoomsEnabled();
+
+void setRemotePeer(const struct sockaddr* addr, socklen_t addrLen);
+Room* findMessageRoom(const char* message);
+int sendToRoom(int sockfd, Room* room, const char* datagram, int length);
+
+int runRoomCommand(const char* line);
+
+#endif
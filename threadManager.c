@@ -1,13 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/eventfd.h>
 
 #include "threadManager.h"
-#include"list.h"
 
-// listMutex = mutex that handles shared list access
-static pthread_mutex_t listMutex = PTHREAD_MUTEX_INITIALIZER;
+// queueMutex = mutex that handles shared queue access
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
 
 // writeMessageMutex = mutex that handles writing access
 static pthread_mutex_t writeMessageMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -21,83 +26,354 @@ static pthread_mutex_t sendMessageMutex = PTHREAD_MUTEX_INITIALIZER;
 // sendMessageFlag = condition variable that manages thread synchonization for sending messages
 static pthread_cond_t sendMessageFlag = PTHREAD_COND_INITIALIZER;
 
-int addMessage(List* list, char* message) {
+// queueSpaceFlag = condition variable that signals a full queue has room again
+static pthread_cond_t queueSpaceFlag = PTHREAD_COND_INITIALIZER;
+
+// busy polling: waiting threads spin for up to spinTime ns before sleeping (0 = always sleep right away)
+static uint64_t spinTime = 0;
+
+// outputSignals/inputSignals = count every signal, so a spinning thread sees new messages without taking queueMutex
+// writerParked/senderParked = set while the thread sleeps on its condition variable, signals skip the
+// condition variable (and its mutex) while the thread is spinning or busy
+static atomic_uint outputSignals = 0;
+static atomic_uint inputSignals = 0;
+static atomic_int writerParked = 0;
+static atomic_int senderParked = 0;
+
+// shutdownFd = eventfd that becomes (and stays) readable once the session is ending,
+// threads blocked in poll() watch it alongside their own file descriptor
+static int shutdownFd = -1;
+
+// shuttingDown = set once by requestShutdown, checked by threads waiting on condition variables
+static atomic_int shuttingDown = 0;
+
+// writerEchoes = echo queue (--echo) that writerThread empties along with outputQueue, NULL without --echo
+static EchoQueue* writerEchoes = NULL;
+
+// messages are linked through their MessageInfo header, so adding and getting one touches only that
+// header and the queue
+// returns 0, or MESSAGE_QUEUE_FAIL if queue is full
+int addMessage(MessageQueue* queue, char* message) {
     int success;
 
-    pthread_mutex_lock(&listMutex);
-    success = List_prepend(list, message); // critical section - list access
-    pthread_mutex_unlock(&listMutex);
+    pthread_mutex_lock(&queueMutex);
+    success = MessageQueue_push(queue, getMessageInfo(message)); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
 
     return success;
 }
-char* getMessage(List* list) {
-    char* message;
 
-    pthread_mutex_lock(&listMutex); 
-    message = List_trim(list); // critical section - list access
-    pthread_mutex_unlock(&listMutex);
+// like addMessage, but waits for room instead of failing when queue is full
+// returns the number of messages in queue after adding message, or MESSAGE_QUEUE_FAIL if the session ended while waiting
+int addMessageWait(MessageQueue* queue, char* message) {
+    int count;
+
+    pthread_mutex_lock(&queueMutex);
+    while (MessageQueue_push(queue, getMessageInfo(message)) == MESSAGE_QUEUE_FAIL) { // critical section - queue access
+        if (isShuttingDown()) {
+            pthread_mutex_unlock(&queueMutex);
+            return MESSAGE_QUEUE_FAIL;
+        }
+        pthread_cond_wait(&queueSpaceFlag, &queueMutex);
+    }
+    count = MessageQueue_count(queue);
+    pthread_mutex_unlock(&queueMutex);
 
-    return message;
+    return count;
 }
 
-int countList(List* list) {
+// returns the oldest message in queue, or NULL if it is empty
+char* getMessage(MessageQueue* queue) {
+    MessageInfo* info;
+
+    pthread_mutex_lock(&queueMutex);
+    int wasFull = MessageQueue_isFull(queue);
+    info = MessageQueue_pop(queue); // critical section - queue access
+    if (wasFull) {
+        pthread_cond_broadcast(&queueSpaceFlag); // the queue has room again
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return info != NULL ? getMessageText(info) : NULL;
+}
+
+int countMessages(MessageQueue* queue) {
     int count;
 
-    pthread_mutex_lock(&listMutex);
-    count = List_count(list); // critical section - list access
-    pthread_mutex_unlock(&listMutex);
+    pthread_mutex_lock(&queueMutex);
+    count = MessageQueue_count(queue); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
 
     return count;
 }
 
+// oldest message in queue without removing it (only its consumer may call this), NULL if it is empty
+char* peekMessage(MessageQueue* queue) {
+    MessageInfo* info;
+
+    pthread_mutex_lock(&queueMutex);
+    info = MessageQueue_peek(queue); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return info != NULL ? getMessageText(info) : NULL;
+}
+
+// echo queue (--echo): same as the message queue functions, for messages that are in inputQueue at the same time
+// returns 0, or MESSAGE_QUEUE_FAIL if queue is full
+int addEcho(EchoQueue* queue, char* message) {
+    int success;
+
+    pthread_mutex_lock(&queueMutex);
+    success = EchoQueue_push(queue, getMessageInfo(message)); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return success;
+}
+
+char* getEcho(EchoQueue* queue) {
+    MessageInfo* info;
+
+    pthread_mutex_lock(&queueMutex);
+    info = EchoQueue_pop(queue); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return info != NULL ? getMessageText(info) : NULL;
+}
+
+char* peekEcho(EchoQueue* queue) {
+    MessageInfo* info;
+
+    pthread_mutex_lock(&queueMutex);
+    info = EchoQueue_peek(queue); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return info != NULL ? getMessageText(info) : NULL;
+}
+
+int countEchoes(EchoQueue* queue) {
+    int count;
+
+    pthread_mutex_lock(&queueMutex);
+    count = EchoQueue_count(queue); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return count;
+}
+
+// writerThread also waits for messages in queue (the echo queue, once --echo is set up)
+void watchEchoQueue(EchoQueue* queue) {
+    writerEchoes = queue;
+}
+
+// queue holds a message, or echoes (the echo queue writerThread watches, or NULL) does
+static int hasMessages(MessageQueue* queue, EchoQueue* echoes) {
+    int count;
+
+    pthread_mutex_lock(&queueMutex);
+    count = MessageQueue_count(queue) + (echoes != NULL ? EchoQueue_count(echoes) : 0); // critical section - queue access
+    pthread_mutex_unlock(&queueMutex);
+
+    return count != 0;
+}
+
+static uint64_t nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// spin until signals changes, queue (or echoes) holds a message, the session is ending or spinTime has passed
+static void spinForSignal(atomic_uint* signals, MessageQueue* queue, EchoQueue* echoes) {
+    unsigned int seen = atomic_load(signals);
+    if (hasMessages(queue, echoes)) {
+        return;
+    }
+
+    uint64_t deadline = nowNanoseconds() + spinTime;
+    while (atomic_load(signals) == seen && !isShuttingDown()) {
+        if (nowNanoseconds() >= deadline) {
+            return;
+        }
+        cpuRelax();
+    }
+}
+
+// sleep on flag until queue (or echoes) holds a message, the session is ending or the next timer of timers (if any)
+// is due
+// parked is set first so a signaller that adds a message after the check below cannot skip the wakeup
+static void park(pthread_mutex_t* mutex, pthread_cond_t* flag, atomic_int* parked, MessageQueue* queue, EchoQueue* echoes,
+    const TimerWheel* timers) {
+    struct timespec deadline;
+    int timed = timers != NULL && getTimerDeadline(timers, &deadline);
+
+    pthread_mutex_lock(mutex);
+    atomic_store(parked, 1);
+    while (!hasMessages(queue, echoes) && !isShuttingDown()) {
+        if (!timed) {
+            pthread_cond_wait(flag, mutex);
+        } else if (pthread_cond_timedwait(flag, mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    atomic_store(parked, 0);
+    pthread_mutex_unlock(mutex);
+}
+
+static void wake(pthread_mutex_t* mutex, pthread_cond_t* flag, atomic_uint* signals, atomic_int* parked) {
+    atomic_fetch_add(signals, 1);
+
+    // case: the thread is spinning or still working through its queue, it will see the message without a wakeup
+    if (spinTime != 0 && !atomic_load(parked)) {
+        return;
+    }
+
+    pthread_mutex_lock(mutex);
+    pthread_cond_signal(flag);
+    pthread_mutex_unlock(mutex);
+}
+
 // outputWriter Mutexes
 void signalOutputWriter() {
-    pthread_mutex_lock(&writeMessageMutex);
-    pthread_cond_signal(&writeMessageFlag); // critical section - signal outputWriter to write messages
-    pthread_mutex_unlock(&writeMessageMutex);
+    wake(&writeMessageMutex, &writeMessageFlag, &outputSignals, &writerParked); // signal outputWriter to write messages
 }
 
-void waitOutputWriter() {
-    pthread_mutex_lock(&writeMessageMutex);
-    pthread_cond_wait(&writeMessageFlag, &writeMessageMutex); // critical section - wait outputWriter until messages are available to write
-    pthread_mutex_unlock(&writeMessageMutex);
+// queue = outputQueue, the wait ends as soon as it (or the echo queue) holds a message (so a signal sent before
+// waiting is not lost), the session is ending or the next of timers (the writer's timer wheel, or NULL) is due
+void waitOutputWriter(MessageQueue* queue, const TimerWheel* timers) {
+    if (spinTime != 0) {
+        spinForSignal(&outputSignals, queue, writerEchoes);
+    }
+    park(&writeMessageMutex, &writeMessageFlag, &writerParked, queue, writerEchoes, timers); // wait outputWriter until messages are available to write
 }
 
 // UDPClient Mutexes 
 void signalUDPClient(){
-    pthread_mutex_lock(&sendMessageMutex);
-    pthread_cond_signal(&sendMessageFlag); // critical section - signal UDPClient to send messages
-    pthread_mutex_unlock(&sendMessageMutex);
+    wake(&sendMessageMutex, &sendMessageFlag, &inputSignals, &senderParked); // signal UDPClient to send messages
+}
+
+// queue = inputQueue, the wait ends as soon as it holds a message (so a signal sent before waiting is not lost),
+// the session is ending or the next of timers (the sender's timer wheel, or NULL) is due
+void waitUDPClient(MessageQueue* queue, const TimerWheel* timers) {
+    if (spinTime != 0) {
+        spinForSignal(&inputSignals, queue, NULL);
+    }
+    park(&sendMessageMutex, &sendMessageFlag, &senderParked, queue, NULL, timers); // wait UDPClient until messages are available to send
+}
+
+// busy polling: spinMicros = how long waiting threads spin before sleeping
+void initBusyPoll(int spinMicros) {
+    spinTime = (uint64_t)spinMicros * 1000;
+}
+
+int getBusyPollMicros() {
+    return spinTime / 1000;
+}
+
+// spin on a non-blocking operation: returns 1 while the caller should retry, 0 once spinTime has passed
+// since the first call with *deadline == 0 (or the session is ending)
+int keepSpinning(uint64_t* deadline) {
+    uint64_t now = nowNanoseconds();
+
+    if (*deadline == 0) {
+        *deadline = now + spinTime;
+    }
+    if (now >= *deadline || isShuttingDown()) {
+        return 0;
+    }
+    cpuRelax();
+    return 1;
 }
 
-void waitUDPClient() {
+// shutdown: every thread finishes the messages already in its queue, then returns
+void requestShutdown() {
+    uint64_t one = 1;
+
+    // case: shutdown was already requested
+    if (atomic_exchange(&shuttingDown, 1)) {
+        return;
+    }
+
+    // wake threads blocked in poll()
+    if (write(shutdownFd, &one, sizeof(one)) != sizeof(one)) {
+        perror("threadManager: could not signal shutdown");
+    }
+
+    // wake threads blocked on condition variables - locking the mutex first means the wakeup
+    // cannot fall between a thread checking isShuttingDown() and starting to wait
+    pthread_mutex_lock(&writeMessageMutex);
+    pthread_cond_broadcast(&writeMessageFlag);
+    pthread_mutex_unlock(&writeMessageMutex);
+
     pthread_mutex_lock(&sendMessageMutex);
-    pthread_cond_wait(&sendMessageFlag, &sendMessageMutex); // critical section - wait UDPClient until messages are available to send
+    pthread_cond_broadcast(&sendMessageFlag);
     pthread_mutex_unlock(&sendMessageMutex);
+
+    pthread_mutex_lock(&queueMutex);
+    pthread_cond_broadcast(&queueSpaceFlag);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+int isShuttingDown() {
+    return atomic_load(&shuttingDown);
+}
+
+int getShutdownFd() {
+    return shutdownFd;
+}
+
+// start up: create the shutdown channel
+void initShutdown() {
+    shutdownFd = eventfd(0, EFD_CLOEXEC);
+    if (shutdownFd == -1) {
+        perror("threadManager: eventfd() error");
+        exit(-1);
+    }
+}
+
+// clean up: close the shutdown channel before ending program
+void destroyShutdown() {
+    close(shutdownFd);
+    shutdownFd = -1;
 }
 
 // start up: create the condition variables
 void initMutexes() {
-    pthread_mutex_init(&listMutex, NULL);
+    pthread_mutex_init(&queueMutex, NULL);
     pthread_mutex_init(&writeMessageMutex, NULL);
     pthread_mutex_init(&sendMessageMutex, NULL);
 }
 
 // clean up: destroy mutexes before ending program
 void destroyMutexes() {
-    pthread_mutex_destroy(&listMutex);
+    pthread_mutex_destroy(&queueMutex);
     pthread_mutex_destroy(&writeMessageMutex);
     pthread_mutex_destroy(&sendMessageMutex);
 }
 
 // start up: create the condition variables
+// timed waits use CLOCK_MONOTONIC deadlines (like the timer wheels), so wall clock changes do not affect them
 void initConditionVars() {
-    pthread_cond_init(&writeMessageFlag, NULL);
-    pthread_cond_init(&sendMessageFlag, NULL);
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&writeMessageFlag, &attr);
+    pthread_cond_init(&sendMessageFlag, &attr);
+    pthread_cond_init(&queueSpaceFlag, NULL);
+    pthread_condattr_destroy(&attr);
 }
 
 // clean up: destroy condition variables before ending program
 void destroyConditionVars() {
     pthread_cond_destroy(&writeMessageFlag);
     pthread_cond_destroy(&sendMessageFlag);
+    pthread_cond_destroy(&queueSpaceFlag);
 }
\ No newline at end of file
@@ -1,17 +1,48 @@
 #ifndef _THREAD_MANAGER_H
 #define _THREAD_MANAGER_H
 
-#include "list.h"
+#include <stdint.h>
 
-int addMessage(List* list, char* message);
-char* getMessage(List* list);
-int countList(List* list);
+#include "freeManager.h"
+#include "timerWheel.h"
+
+// default for the most messages each queue holds (--input-queue, --output-queue): addMessage fails (listenerThread drops the message) and addMessageWait waits
+// (keyboardThread stops reading) while a queue is full
+// inputQueue stays short so keyboardThread cannot run far ahead of the socket: UDPClient sends what it holds
+// in one burst, and a long burst overflows the remote client's socket receive buffer
+#define DEFAULT_INPUT_QUEUE_CAPACITY 100
+#define DEFAULT_OUTPUT_QUEUE_CAPACITY 4096
+
+#define MESSAGE_QUEUE_FAIL -1
+
+int addMessage(MessageQueue* queue, char* message);
+int addMessageWait(MessageQueue* queue, char* message);
+char* getMessage(MessageQueue* queue);
+int countMessages(MessageQueue* queue);
+char* peekMessage(MessageQueue* queue);
+
+int addEcho(EchoQueue* queue, char* message);
+char* getEcho(EchoQueue* queue);
+char* peekEcho(EchoQueue* queue);
+int countEchoes(EchoQueue* queue);
+void watchEchoQueue(EchoQueue* queue);
 
 void signalOutputWriter();
-void waitOutputWriter();
+void waitOutputWriter(MessageQueue* queue, const TimerWheel* timers);
 
 void signalUDPClient();
-void waitUDPClient();
+void waitUDPClient(MessageQueue* queue, const TimerWheel* timers);
+
+void initBusyPoll(int spinMicros);
+int getBusyPollMicros();
+int keepSpinning(uint64_t* deadline);
+
+void requestShutdown();
+int isShuttingDown();
+int getShutdownFd();
+
+void initShutdown();
+void destroyShutdown();
 
 void initMutexes();
 void destroyMutexes();
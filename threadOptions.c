@@ -0,0 +1,193 @@
+// THREAD OPTIONS
+// per thread CPU affinity, SCHED_FIFO priority and stack size for the four pipeline threads
+// options are given as [thread]:[option]=[value],... e.g. listener:cpu=2,priority=50,stack=256k
+// - thread: keyboard, sender, listener or writer
+// - cpu: a CPU number or range (e.g. 2 or 2-3) the thread is pinned to
+// - priority: runs the thread with SCHED_FIFO at this priority (needs CAP_SYS_NICE or an RLIMIT_RTPRIO limit)
+// - stack: stack size in bytes, with an optional k or m suffix, at least THREAD_MIN_STACK_SIZE
+// threads without options are created with the default attributes
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "threadOptions.h"
+
+typedef struct ThreadOptions_s ThreadOptions;
+struct ThreadOptions_s {
+    int firstCpu;    // -1 = not pinned
+    int lastCpu;
+    int priority;    // 0 = default scheduling policy
+    size_t stackSize; // 0 = default stack size
+};
+
+static const char* threadNames[NUM_PIPELINE_THREADS] = { "keyboard", "sender", "listener", "writer" };
+
+static ThreadOptions threadOptions[NUM_PIPELINE_THREADS] = {
+    { -1, -1, 0, 0 },
+    { -1, -1, 0, 0 },
+    { -1, -1, 0, 0 },
+    { -1, -1, 0, 0 }
+};
+
+static int parseNumber(const char* text, long min, long max, long* value) {
+    char* end;
+    *value = strtol(text, &end, 10);
+    return end != text && *end == '\0' && *value >= min && *value <= max ? 0 : -1;
+}
+
+static int parseCpus(const char* text, ThreadOptions* options) {
+    char first[16];
+    const char* dash = strchr(text, '-');
+    long firstCpu, lastCpu;
+
+    if (dash == NULL) {
+        if (parseNumber(text, 0, CPU_SETSIZE - 1, &firstCpu) == -1) {
+            return -1;
+        }
+        lastCpu = firstCpu;
+    } else {
+        if (dash - text >= (long)sizeof(first)) {
+            return -1;
+        }
+        memcpy(first, text, dash - text);
+        first[dash - text] = '\0';
+
+        if (parseNumber(first, 0, CPU_SETSIZE - 1, &firstCpu) == -1
+            || parseNumber(dash + 1, firstCpu, CPU_SETSIZE - 1, &lastCpu) == -1) {
+            return -1;
+        }
+    }
+
+    options->firstCpu = firstCpu;
+    options->lastCpu = lastCpu;
+    return 0;
+}
+
+static int parseStackSize(const char* text, ThreadOptions* options) {
+    char* end;
+    unsigned long long size = strtoull(text, &end, 10);
+
+    if (end == text) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        end++;
+    }
+
+    if (*end != '\0' || size < THREAD_MIN_STACK_SIZE || size < PTHREAD_STACK_MIN) {
+        return -1;
+    }
+    options->stackSize = size;
+    return 0;
+}
+
+// parse one --thread option, returns -1 (after printing the problem) if it is invalid
+int setThreadOptions(const char* spec) {
+    const char* colon = strchr(spec, ':');
+    int thread = -1;
+
+    for (int i = 0; colon != NULL && i < NUM_PIPELINE_THREADS; i++) {
+        if (strlen(threadNames[i]) == (size_t)(colon - spec) && !strncmp(spec, threadNames[i], colon - spec)) {
+            thread = i;
+        }
+    }
+    if (thread == -1) {
+        fprintf(stderr, "threadOptions: '%s' does not start with keyboard:, sender:, listener: or writer:\n", spec);
+        return -1;
+    }
+
+    char* options = strdup(colon + 1);
+    char* savePtr;
+    int res = 0;
+
+    for (char* option = strtok_r(options, ",", &savePtr); option != NULL && res == 0; option = strtok_r(NULL, ",", &savePtr)) {
+        char* value = strchr(option, '=');
+        long priority;
+
+        if (value == NULL) {
+            res = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(option, "cpu")) {
+            res = parseCpus(value, &threadOptions[thread]);
+        } else if (!strcmp(option, "priority")) {
+            res = parseNumber(value, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), &priority);
+            threadOptions[thread].priority = priority;
+        } else if (!strcmp(option, "stack")) {
+            res = parseStackSize(value, &threadOptions[thread]);
+        } else {
+            res = -1;
+        }
+    }
+
+    if (res == -1) {
+        fprintf(stderr, "threadOptions: invalid options '%s' (expected cpu=N[-M], priority=%d-%d and/or stack=BYTES[k|m], stack >= %d)\n",
+            colon + 1, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO),
+            (int)(THREAD_MIN_STACK_SIZE > PTHREAD_STACK_MIN ? THREAD_MIN_STACK_SIZE : PTHREAD_STACK_MIN));
+    }
+    free(options);
+    return res;
+}
+
+// like pthread_create, but applies the thread's options
+// returns 0 on success, or the error number (after printing which option could not be applied)
+int createPipelineThread(PipelineThread thread, pthread_t* handle, void* (*start)(void*)) {
+    ThreadOptions* options = &threadOptions[thread];
+    pthread_attr_t attr;
+    int res;
+
+    // case: no options, keep the default attributes
+    if (options->firstCpu == -1 && options->priority == 0 && options->stackSize == 0) {
+        return pthread_create(handle, NULL, start, NULL);
+    }
+
+    pthread_attr_init(&attr);
+
+    if (options->firstCpu != -1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = options->firstCpu; cpu <= options->lastCpu; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    if (options->priority != 0) {
+        struct sched_param param = { .sched_priority = options->priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    if (options->stackSize != 0) {
+        res = pthread_attr_setstacksize(&attr, options->stackSize);
+        if (res != 0) {
+            fprintf(stderr, "threadOptions: invalid stack size for the %s thread: %s\n", threadNames[thread], strerror(res));
+            pthread_attr_destroy(&attr);
+            return res;
+        }
+    }
+
+    res = pthread_create(handle, &attr, start, NULL);
+    if (res != 0) {
+        fprintf(stderr, "threadOptions: could not create the %s thread with its options: %s%s\n", threadNames[thread], strerror(res),
+            res == EPERM ? " (SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO limit)"
+            : res == EINVAL && options->firstCpu != -1 ? " (check that its CPUs exist and are online)" : "");
+    }
+
+    pthread_attr_destroy(&attr);
+    return res;
+}
@@ -0,0 +1,22 @@
+#ifndef _THREAD_OPTIONS_H
+#define _THREAD_OPTIONS_H
+
+#include <pthread.h>
+
+// smallest stack a pipeline thread is given: the large buffers are on the heap, but getaddrinfo, OpenSSL and the
+// sanitizers still need room (every thread runs with 16k, this leaves a margin)
+#define THREAD_MIN_STACK_SIZE (64 * 1024)
+
+// the four pipeline threads that can be given their own attributes
+typedef enum {
+    THREAD_KEYBOARD,
+    THREAD_SENDER,
+    THREAD_LISTENER,
+    THREAD_WRITER,
+    NUM_PIPELINE_THREADS
+} PipelineThread;
+
+int setThreadOptions(const char* spec);
+int createPipelineThread(PipelineThread thread, pthread_t* handle, void* (*start)(void*));
+
+#endif
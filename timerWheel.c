@@ -0,0 +1,266 @@
+// References:
+// George Varghese, Tony Lauck - Hashed and Hierarchical Timing Wheels
+
+// TIMER WHEEL
+// hierarchical timing wheel: level 0 has a slot per tick for the next 64 ticks, each higher level has a slot
+// per 64 slots of the level below, timers are moved (cascaded) down a level as their time comes closer
+// adding and cancelling are O(1), running only touches the slots that are due
+// a wheel belongs to the thread that runs it: the thread sleeps in poll() or pthread_cond_timedwait() no longer
+// than getTimerTimeoutMs/getTimerDeadline allow, then calls runTimers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timerWheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// ticks that fit on the wheel, later timers are parked on the last level until they come closer
+#define MAX_TICKS ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+uint64_t timerNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void unlinkTimer(TimerWheel* wheel, Timer* timer) {
+    Timer* head = &wheel->slots[timer->slot];
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+
+    // case: slot is empty now
+    if (head->next == head) {
+        wheel->occupied[timer->slot / TIMER_WHEEL_SLOTS] &= ~(1ULL << (timer->slot & SLOT_MASK));
+    }
+}
+
+static void linkTimer(TimerWheel* wheel, Timer* timer) {
+    uint64_t tick = timer->expires / wheel->tickNs;
+    int level = 0;
+
+    // case: already expired, it fires on the next run
+    if (tick < wheel->currentTick) {
+        tick = wheel->currentTick;
+    }
+    if (tick - wheel->currentTick > MAX_TICKS) {
+        tick = wheel->currentTick + MAX_TICKS;
+    }
+
+    // the level is picked by how far away the timer is, the slot by the tick's bits for that level
+    uint64_t delta = tick - wheel->currentTick;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+
+    Timer* head = &wheel->slots[level * TIMER_WHEEL_SLOTS + slot];
+    timer->slot = level * TIMER_WHEEL_SLOTS + slot;
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+// entering tick: move the timers of every higher level slot that starts at tick down, highest level first
+// so timers cascaded from the top can be cascaded again from the level below
+static void cascade(TimerWheel* wheel, uint64_t tick) {
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((tick & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+            continue;
+        }
+
+        int slot = level * TIMER_WHEEL_SLOTS + ((tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+        Timer* head = &wheel->slots[slot];
+
+        while (head->next != head) {
+            Timer* timer = head->next;
+            unlinkTimer(wheel, timer);
+            linkTimer(wheel, timer);
+        }
+    }
+}
+
+void initTimerWheel(TimerWheel* wheel, uint64_t tickNs) {
+    for (int i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+        wheel->slots[i].next = wheel->slots[i].prev = &wheel->slots[i];
+    }
+    memset(wheel->occupied, 0, sizeof(wheel->occupied));
+    wheel->tickNs = tickNs;
+    wheel->currentTick = timerNow() / tickNs;
+    wheel->cascadedTick = wheel->currentTick;
+    wheel->count = 0;
+}
+
+// (re)schedule timer to call fn(arg) at expires, a pending timer is moved
+void addTimer(TimerWheel* wheel, Timer* timer, uint64_t expires, TIMER_FN fn, void* arg) {
+    if (isTimerPending(timer)) {
+        cancelTimer(wheel, timer);
+    }
+
+    // case: wheel was empty, it does not have to walk through the ticks it was not run for
+    if (wheel->count == 0) {
+        uint64_t nowTick = timerNow() / wheel->tickNs;
+        if (nowTick > wheel->currentTick) {
+            wheel->currentTick = wheel->cascadedTick = nowTick;
+        }
+    }
+
+    timer->expires = expires;
+    timer->fn = fn;
+    timer->arg = arg;
+    linkTimer(wheel, timer);
+    wheel->count++;
+}
+
+void cancelTimer(TimerWheel* wheel, Timer* timer) {
+    if (!isTimerPending(timer)) {
+        return;
+    }
+    unlinkTimer(wheel, timer);
+    wheel->count--;
+}
+
+int isTimerPending(const Timer* timer) {
+    return timer->next != NULL;
+}
+
+// fire every timer that expired at or before now, returns the number of timers fired
+int runTimers(TimerWheel* wheel, uint64_t now) {
+    uint64_t nowTick = now / wheel->tickNs;
+    Timer expired = { .next = &expired, .prev = &expired };
+    int fired = 0;
+
+    while (wheel->currentTick <= nowTick) {
+        uint64_t tick = wheel->currentTick;
+
+        // case: no timers at all, nothing to walk through
+        if (wheel->count == 0) {
+            wheel->currentTick = wheel->cascadedTick = nowTick;
+            break;
+        }
+
+        if (wheel->cascadedTick != tick) {
+            cascade(wheel, tick);
+            wheel->cascadedTick = tick;
+        }
+
+        // move the expired timers out first, so callbacks can add timers to any slot
+        Timer* head = &wheel->slots[tick & SLOT_MASK];
+        Timer* timer = head->next;
+        while (timer != head) {
+            Timer* next = timer->next;
+            if (timer->expires <= now) {
+                unlinkTimer(wheel, timer);
+                wheel->count--;
+                timer->next = &expired;
+                timer->prev = expired.prev;
+                expired.prev->next = timer;
+                expired.prev = timer;
+            }
+            timer = next;
+        }
+
+        // the current tick is visited again next time, it can still hold timers due later in this tick
+        if (tick == nowTick) {
+            break;
+        }
+
+        // case: nothing else on level 0, skip ahead to its next rotation (where the next cascade happens)
+        if (wheel->occupied[0] == 0) {
+            uint64_t nextRotation = (tick | SLOT_MASK) + 1;
+            wheel->currentTick = nextRotation < nowTick ? nextRotation : nowTick;
+        } else {
+            wheel->currentTick++;
+        }
+    }
+
+    while (expired.next != &expired) {
+        Timer* timer = expired.next;
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->next = timer->prev = NULL;
+        timer->fn(timer->arg, now);
+        fired++;
+    }
+
+    return fired;
+}
+
+// first occupied slot of level at or after index start (in rotation order), -1 if the level is empty
+static int firstOccupied(uint64_t occupied, int start) {
+    if (occupied == 0) {
+        return -1;
+    }
+
+    uint64_t rotated = (occupied >> start) | (start == 0 ? 0 : occupied << (TIMER_WHEEL_SLOTS - start));
+    return (start + __builtin_ctzll(rotated)) & SLOT_MASK;
+}
+
+// ns until the next timer expires (0 if one already has), or -1 if there are no timers
+// for timers on higher levels this is the time their slot is cascaded, the wheel is run then and asked again
+int64_t nextTimerDelay(const TimerWheel* wheel, uint64_t now) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+
+    uint64_t nextTick = UINT64_MAX;
+    uint64_t earliest = UINT64_MAX;
+
+    // level 0 only holds timers of the next 64 ticks, so its first occupied slot holds the next timer
+    int slot = firstOccupied(wheel->occupied[0], wheel->currentTick & SLOT_MASK);
+    if (slot != -1) {
+        const Timer* head = &wheel->slots[slot];
+        for (const Timer* timer = head->next; timer != head; timer = timer->next) {
+            if (timer->expires < earliest) {
+                earliest = timer->expires;
+            }
+        }
+    }
+
+    // a higher level slot is due when its first tick comes around
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_BITS * level;
+        int current = (wheel->currentTick >> shift) & SLOT_MASK;
+
+        slot = firstOccupied(wheel->occupied[level], (current + 1) & SLOT_MASK);
+        if (slot != -1) {
+            uint64_t distance = ((slot - current - 1) & SLOT_MASK) + 1;
+            uint64_t tick = ((wheel->currentTick >> shift) + distance) << shift;
+            if (tick < nextTick) {
+                nextTick = tick;
+            }
+        }
+    }
+
+    if (nextTick != UINT64_MAX && nextTick * wheel->tickNs < earliest) {
+        earliest = nextTick * wheel->tickNs;
+    }
+    return earliest > now ? (int64_t)(earliest - now) : 0;
+}
+
+// poll() timeout until the next timer (rounded up to whole ms), -1 if there are no timers
+int getTimerTimeoutMs(const TimerWheel* wheel) {
+    int64_t delay = nextTimerDelay(wheel, timerNow());
+    return delay < 0 ? -1 : (int)((delay + 999999) / 1000000);
+}
+
+// CLOCK_MONOTONIC deadline for pthread_cond_timedwait(), returns 0 if there are no timers
+int getTimerDeadline(const TimerWheel* wheel, struct timespec* deadline) {
+    uint64_t now = timerNow();
+    int64_t delay = nextTimerDelay(wheel, now);
+
+    if (delay < 0) {
+        return 0;
+    }
+
+    uint64_t when = now + delay;
+    deadline->tv_sec = when / 1000000000ULL;
+    deadline->tv_nsec = when % 1000000000ULL;
+    return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <time.h>
+
+// each level of a wheel has 64 slots, a slot on level n covers 64^n ticks
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// default resolution, a wheel with 1 ms ticks reaches 64^4 ms (about 4.6 hours) ahead
+#define TIMER_TICK_NS 1000000ULL
+
+// called when the timer expires, now = time the wheel was run at (the timer may be added again from here)
+typedef void (*TIMER_FN)(void* arg, uint64_t now);
+
+// timers are embedded in their owner's state (zero initialized), the wheel only links them
+typedef struct Timer_s Timer;
+struct Timer_s {
+    uint64_t expires; // CLOCK_MONOTONIC in ns
+    TIMER_FN fn;
+    void* arg;
+    Timer* next;
+    Timer* prev;
+    int slot;         // level * TIMER_WHEEL_SLOTS + slot of the list the timer is in
+};
+
+// a wheel belongs to one thread: only that thread adds, cancels and runs its timers
+typedef struct TimerWheel_s TimerWheel;
+struct TimerWheel_s {
+    Timer slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS]; // list heads
+    uint64_t occupied[TIMER_WHEEL_LEVELS];               // bit n set = slot n of the level holds timers
+    uint64_t tickNs;
+    uint64_t currentTick;  // every tick before this one has been run
+    uint64_t cascadedTick; // last tick whose higher level slots were moved down
+    int count;
+};
+
+uint64_t timerNow();
+
+void initTimerWheel(TimerWheel* wheel, uint64_t tickNs);
+void addTimer(TimerWheel* wheel, Timer* timer, uint64_t expires, TIMER_FN fn, void* arg);
+void cancelTimer(TimerWheel* wheel, Timer* timer);
+int isTimerPending(const Timer* timer);
+
+int runTimers(TimerWheel* wheel, uint64_t now);
+int64_t nextTimerDelay(const TimerWheel* wheel, uint64_t now);
+
+// helpers for threads that block in poll() or pthread_cond_timedwait()
+int getTimerTimeoutMs(const TimerWheel* wheel);
+int getTimerDeadline(const TimerWheel* wheel, struct timespec* deadline);
+
+#endif
@@ -0,0 +1,43 @@
+// TRANSPORT
+// the sends and receives of datagrams go through a Transport, so something other than the socket can carry them:
+// socketTransport (the socket calls themselves) or the simulated network (see networkSimulator.c)
+// that covers UDPClient's plain, batched (offload.c), zerocopy and local socket sends, the room fan-out, heartbeats,
+// receipts and UDPServer's receives; only the zerocopy completions (read from the socket's error queue) bypass it
+
+#define _GNU_SOURCE
+
+#include "transport.h"
+
+static ssize_t socketSend(int fd, const void* datagram, size_t length, int flags, const struct sockaddr* addr, socklen_t addrLen) {
+    return sendto(fd, datagram, length, flags, addr, addrLen);
+}
+
+static ssize_t socketSendMsg(int fd, const struct msghdr* msg, int flags) {
+    return sendmsg(fd, msg, flags);
+}
+
+static int socketSendBatch(int fd, struct mmsghdr* msgs, unsigned int count, int flags) {
+    return sendmmsg(fd, msgs, count, flags);
+}
+
+static ssize_t socketReceive(int fd, struct msghdr* msg) {
+    return recvmsg(fd, msg, MSG_DONTWAIT);
+}
+
+const Transport socketTransport = {
+    .send = socketSend,
+    .sendMsg = socketSendMsg,
+    .sendBatch = socketSendBatch,
+    .receive = socketReceive
+};
+
+static const Transport* transport = &socketTransport;
+
+// use transport instead of the socket calls, call before the threads are started
+void setTransport(const Transport* newTransport) {
+    transport = newTransport;
+}
+
+const Transport* getTransport() {
+    return transport;
+}
@@ -0,0 +1,30 @@
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// defined by <sys/socket.h> with _GNU_SOURCE, only passed through here
+struct mmsghdr;
+
+// the datagram socket calls of senderThread and listenerThread (see transport.c)
+typedef struct Transport_s Transport;
+struct Transport_s {
+    // send length bytes of datagram to addr with flags (e.g. MSG_ZEROCOPY), returns the number of bytes sent or -1
+    // (errno is set)
+    ssize_t (*send)(int fd, const void* datagram, size_t length, int flags, const struct sockaddr* addr, socklen_t addrLen);
+    // send msg (a datagram in several buffers or with control messages, e.g. UDP_SEGMENT), returns the number of
+    // bytes sent or -1 (errno is set)
+    ssize_t (*sendMsg)(int fd, const struct msghdr* msg, int flags);
+    // send count datagrams with one call, returns how many were sent or -1 (errno is set)
+    int (*sendBatch)(int fd, struct mmsghdr* msgs, unsigned int count, int flags);
+    // receive a datagram into msg without waiting, returns its length or -1 (errno is EAGAIN if there is none)
+    ssize_t (*receive)(int fd, struct msghdr* msg);
+};
+
+extern const Transport socketTransport;
+
+void setTransport(const Transport* transport);
+const Transport* getTransport();
+
+#endif
@@ -0,0 +1,576 @@
+// References:
+// ECMA-48 - Control Functions for Coded Character Sets (CUP, ED, EL, SGR)
+// XTerm Control Sequences - DECSTBM (scrolling region)
+
+// TERMINAL UI
+// --tui: the bottom line of the terminal is a fixed input line, received (and echoed) messages scroll in the region
+// above it, so incoming messages no longer garble the line being typed
+// - the terminal is in non-canonical mode without echo: keyboardThread edits the input line itself
+// - what changed since the last frame is tracked (damage): lines added to the scroll region, the input line, or
+//   everything (start, resize, Ctrl-L), and a frame only draws that
+// - added lines are drawn at the bottom of the scroll region and the terminal scrolls the rest up, so a frame costs
+//   the new lines, never the whole screen; when more lines were added than fit, the region is redrawn once instead
+// - every frame is built in one buffer (escape sequences and text) and written with a single write(), and received
+//   messages are drawn at most once per TUI_FRAME_MS however fast they arrive
+// - the lines in the scroll region are the messages themselves, held by reference (see freeManager.c), not copies
+// - output of local commands (/search, /rtt, ...) is written into the scroll region as it is printed: it scrolls
+//   like the messages, but is not redrawn by a full redraw
+// state is shared by keyboardThread and writerThread (tuiMutex)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "tui.h"
+#include "freeManager.h"
+#include "timerWheel.h"
+
+#define DEFAULT_ROWS 24
+#define DEFAULT_COLS 80
+
+// a line of the scroll region: header (e.g. "You: ") and the message it shows
+typedef struct Line_s Line;
+struct Line_s {
+    const char* header;
+    char* message;
+};
+
+static int tuiEnabled = 0;
+static struct termios savedTermios;
+static pthread_mutex_t tuiMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t resized = 0;
+static int rows;
+static int cols;
+
+// lines that can still be on screen, oldest first
+static Line lines[TUI_MAX_LINES];
+static int firstLine = 0;
+static int lineCount = 0;
+
+// damage since the last frame
+static int fullRedraw = 0;
+static int newLines = 0;     // lines added to the end of lines
+static int inputDirty = 0;
+static int bottomBlank = 0;  // the cursor's row at the bottom of the scroll region is empty (nothing to scroll up)
+static uint64_t lastFrame = 0;
+
+// input line (keyboardThread edits it, every frame draws it)
+static char* input = NULL;
+static int inputLen = 0;
+static int inputCapacity = 0;
+static int escapeState = 0; // 1 after ESC, 2 inside a control sequence (arrow keys etc. are ignored)
+
+// frame being built
+static char* frame = NULL;
+static int frameLen = 0;
+static int frameCapacity = 0;
+
+static void appendFrame(const char* data, int length) {
+    if (length == 0) {
+        return;
+    }
+    if (frameLen + length > frameCapacity) {
+        while (frameLen + length > frameCapacity) {
+            frameCapacity = frameCapacity == 0 ? 4096 : frameCapacity * 2;
+        }
+        frame = realloc(frame, frameCapacity);
+        if (frame == NULL) {
+            fprintf(stderr, "tui: could not grow frame buffer\n");
+            exit(-1);
+        }
+    }
+    memcpy(frame + frameLen, data, length);
+    frameLen += length;
+}
+
+static void appendFormat(const char* format, ...) {
+    char buffer[64];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    appendFrame(buffer, length);
+}
+
+// text as it is shown: control characters other than '\n' (a remote client could send escape sequences) become '?'
+static void appendText(const char* text, int length) {
+    int start = 0;
+
+    for (int i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if ((c < 32 && c != '\n') || c == 127) {
+            appendFrame(text + start, i - start);
+            appendFrame("?", 1);
+            start = i + 1;
+        }
+    }
+    appendFrame(text + start, length - start);
+}
+
+static void writeFrame() {
+    const char* data = frame;
+    int length = frameLen;
+
+    while (length > 0) {
+        int res = write(1, data, length);
+        if (res == -1) {
+            perror("tui: failed to draw");
+            exit(-1);
+        }
+        data += res;
+        length -= res;
+    }
+    frameLen = 0;
+}
+
+// columns taken by text (UTF-8 continuation bytes take none)
+static int textColumns(const char* text, int length) {
+    int columns = 0;
+
+    for (int i = 0; i < length; i++) {
+        columns += ((unsigned char)text[i] & 0xC0) != 0x80;
+    }
+    return columns;
+}
+
+// bytes of text that fill the first columns columns
+static int skipColumns(const char* text, int length, int columns) {
+    int i = 0;
+
+    while (i < length && columns > 0) {
+        i++;
+        while (i < length && ((unsigned char)text[i] & 0xC0) == 0x80) {
+            i++;
+        }
+        columns--;
+    }
+    return i;
+}
+
+static Line* getLine(int i) {
+    return &lines[(firstLine + i) % TUI_MAX_LINES];
+}
+
+static int messageLength(const Line* line) {
+    int length = strlen(line->message);
+    return length > 0 && line->message[length - 1] == '\n' ? length - 1 : length;
+}
+
+static int regionRows() {
+    return rows - 2;
+}
+
+// rows text starts after the one it starts on (it wraps at the last column and breaks at '\n'),
+// *column = columns used on the row it ends on
+static int textRows(const char* text, int length, int* column) {
+    int rows = 0;
+
+    for (int i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            rows++;
+            *column = 0;
+        } else if (((unsigned char)text[i] & 0xC0) != 0x80) {
+            if (*column == cols) {
+                rows++;
+                *column = 0;
+            }
+            (*column)++;
+        }
+    }
+    return rows;
+}
+
+// rows line takes in the scroll region (a message can hold several lines, long lines wrap)
+static int lineRows(const Line* line) {
+    int column = 0;
+    int rows = 1 + textRows(line->header, strlen(line->header), &column);
+    return rows + textRows(line->message, messageLength(line), &column);
+}
+
+// draw line from the cursor on, only its last maxRows rows if it is longer
+static void drawLine(const Line* line, int maxRows) {
+    int length = messageLength(line);
+    int skipRows = lineRows(line) - maxRows;
+
+    if (skipRows <= 0) {
+        appendText(line->header, strlen(line->header));
+        appendText(line->message, length);
+        return;
+    }
+
+    // case: a message taller than the scroll region, the header and the first rows are left out
+    int column = textColumns(line->header, strlen(line->header));
+    int skip = 0;
+    while (skip < length && skipRows > 0) {
+        skipRows -= textRows(line->message + skip, 1, &column);
+        skip++;
+    }
+    // case: the first row shown was started by wrapping, the character that wrapped is on it
+    if (skip > 0 && line->message[skip - 1] != '\n') {
+        skip--;
+    }
+    appendText(line->message + skip, length - skip);
+}
+
+static void querySize() {
+    struct winsize size;
+
+    rows = DEFAULT_ROWS;
+    cols = DEFAULT_COLS;
+    if (ioctl(1, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+        rows = size.ws_row;
+        cols = size.ws_col;
+    }
+    if (rows < 3) {
+        rows = 3;
+    }
+}
+
+// scroll region with the newest lines at its bottom, the separator line and the input line
+static void drawScreen() {
+    int used = 0;
+    int first = lineCount;
+
+    appendFormat("\x1b[1;%dr\x1b[H\x1b[2J", regionRows());
+
+    while (first > 0 && used + lineRows(getLine(first - 1)) <= regionRows()) {
+        used += lineRows(getLine(first - 1));
+        first--;
+    }
+    // case: the newest line alone is taller than the region, its end is shown
+    if (first == lineCount && lineCount > 0) {
+        first--;
+        used = regionRows();
+    }
+
+    appendFormat("\x1b[%d;1H", regionRows() - (used > 0 ? used : 1) + 1);
+    for (int i = first; i < lineCount; i++) {
+        if (i > first) {
+            appendFrame("\n", 1);
+        }
+        drawLine(getLine(i), regionRows());
+    }
+    bottomBlank = lineCount == 0;
+
+    appendFormat("\x1b[%d;1H\x1b[2m", rows - 1);
+    for (int i = 0; i < cols; i++) {
+        appendFrame("-", 1);
+    }
+    appendFrame("\x1b[0m", 4);
+}
+
+// the lines added since the last frame, at the bottom of the scroll region (which scrolls up to make room)
+static void drawNewLines() {
+    appendFormat("\x1b[%d;1H", regionRows());
+    for (int i = lineCount - newLines; i < lineCount; i++) {
+        if (bottomBlank) {
+            bottomBlank = 0;
+        } else {
+            appendFrame("\n", 1);
+        }
+        drawLine(getLine(i), regionRows());
+    }
+}
+
+// prompt and the end of the input that fits, the cursor is left where the next key goes
+static void drawInput() {
+    int visible = cols - strlen(TUI_PROMPT) - 1;
+    int columns = textColumns(input, inputLen);
+    int skip = columns > visible ? skipColumns(input, inputLen, columns - visible) : 0;
+
+    appendFormat("\x1b[%d;1H", rows);
+    appendFrame(TUI_PROMPT, strlen(TUI_PROMPT));
+    appendText(input + skip, inputLen - skip);
+    appendFrame("\x1b[K", 3);
+}
+
+// draw the damage since the last frame (tuiMutex held)
+static void drawFrame(uint64_t now) {
+    if (resized) {
+        resized = 0;
+        querySize();
+        fullRedraw = 1;
+    }
+
+    // case: more lines were added than fit, drawing them one after the other would scroll most of them away
+    if (newLines > lineCount) {
+        fullRedraw = 1;
+    }
+    int added = 0;
+    for (int i = lineCount - newLines; i < lineCount && !fullRedraw; i++) {
+        added += lineRows(getLine(i));
+        fullRedraw = added > regionRows();
+    }
+
+    if (fullRedraw) {
+        drawScreen();
+    } else if (newLines > 0) {
+        drawNewLines();
+    }
+
+    if (fullRedraw || newLines > 0 || inputDirty) {
+        drawInput();
+        writeFrame();
+    }
+
+    fullRedraw = 0;
+    newLines = 0;
+    inputDirty = 0;
+    lastFrame = now;
+}
+
+// put the terminal back the way it was (async-signal-safe)
+static void restoreTerminal() {
+    const char reset[] = "\x1b[r\x1b[999;1H\n";
+
+    tcsetattr(0, TCSANOW, &savedTermios);
+    if (write(1, reset, sizeof(reset) - 1) == -1) {
+        // nothing left to do about it
+    }
+}
+
+static void signalHandler(int sig) {
+    restoreTerminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void resizeHandler(int sig) {
+    resized = 1;
+}
+
+// start up (before the threads): take over the terminal and draw the empty screen
+void initTui() {
+    struct termios raw;
+    struct sigaction action;
+    sigset_t resize;
+
+    if (!isatty(0) || !isatty(1) || tcgetattr(0, &savedTermios) == -1) {
+        fprintf(stderr, "tui: --tui needs a terminal\n");
+        exit(-1);
+    }
+
+    raw = savedTermios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(0, TCSANOW, &raw) == -1) {
+        perror("tui: could not set up the terminal");
+        exit(-1);
+    }
+
+    // leave the terminal usable if the program is killed
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+    sigaction(SIGQUIT, &action, NULL);
+
+    // resizes are only taken by keyboardThread (see startTuiInput), whose poll() they interrupt
+    action.sa_handler = resizeHandler;
+    sigaction(SIGWINCH, &action, NULL);
+    sigemptyset(&resize);
+    sigaddset(&resize, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &resize, NULL);
+
+    querySize();
+    tuiEnabled = 1;
+
+    pthread_mutex_lock(&tuiMutex);
+    fullRedraw = 1;
+    drawFrame(timerNow());
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+int isTuiEnabled() {
+    return tuiEnabled;
+}
+
+// clean up (after the threads have been joined): draw what is left, give the terminal back below the last line
+void closeTui() {
+    if (!tuiEnabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&tuiMutex);
+    drawFrame(timerNow());
+    restoreTerminal();
+
+    for (int i = 0; i < lineCount; i++) {
+        releaseMessage(getLine(i)->message);
+    }
+    lineCount = 0;
+    free(frame);
+    free(input);
+    frame = NULL;
+    input = NULL;
+    tuiEnabled = 0;
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+// keyboardThread: lines of up to capacity bytes can be typed, resizes interrupt this thread from now on
+void startTuiInput(int capacity) {
+    sigset_t resize;
+
+    pthread_mutex_lock(&tuiMutex);
+    input = malloc(capacity > 0 ? capacity : 1);
+    if (input == NULL) {
+        fprintf(stderr, "tui: could not allocate input line\n");
+        exit(-1);
+    }
+    inputCapacity = capacity;
+    inputLen = 0;
+    pthread_mutex_unlock(&tuiMutex);
+
+    sigemptyset(&resize);
+    sigaddset(&resize, SIGWINCH);
+    pthread_sigmask(SIG_UNBLOCK, &resize, NULL);
+}
+
+// keyboardThread: apply the keys to the input line, stopping after Enter (then *lineDone is set)
+// returns the number of keys used
+int editTuiInput(const char* keys, int length, int* lineDone) {
+    int i = 0;
+
+    *lineDone = 0;
+    pthread_mutex_lock(&tuiMutex);
+    while (i < length && !*lineDone) {
+        unsigned char c = keys[i++];
+
+        if (escapeState == 1) {
+            escapeState = (c == '[' || c == 'O') ? 2 : 0;
+            continue;
+        }
+        if (escapeState == 2) {
+            escapeState = (c >= 0x40 && c <= 0x7E) ? 0 : 2;
+            continue;
+        }
+
+        switch (c) {
+            case 27: // ESC
+                escapeState = 1;
+                break;
+            case '\r':
+            case '\n':
+                *lineDone = 1;
+                break;
+            case 127: // backspace, removes a whole UTF-8 character
+            case 8:
+                while (inputLen > 0 && ((unsigned char)input[--inputLen] & 0xC0) == 0x80) {
+                }
+                break;
+            case 21: // Ctrl-U
+                inputLen = 0;
+                break;
+            case 12: // Ctrl-L
+                fullRedraw = 1;
+                break;
+            default:
+                if (c >= 32 && inputLen < inputCapacity) {
+                    input[inputLen++] = c;
+                }
+                break;
+        }
+    }
+    inputDirty = 1;
+    pthread_mutex_unlock(&tuiMutex);
+
+    return i;
+}
+
+int getTuiInputLength() {
+    pthread_mutex_lock(&tuiMutex);
+    int length = inputLen;
+    pthread_mutex_unlock(&tuiMutex);
+    return length;
+}
+
+// keyboardThread: copy the typed line into line (getTuiInputLength() + 2 bytes: '\n' and '\0' are added)
+// and clear the input line
+void takeTuiInput(char* line) {
+    pthread_mutex_lock(&tuiMutex);
+    memcpy(line, input, inputLen);
+    line[inputLen] = '\n';
+    line[inputLen + 1] = '\0';
+    inputLen = 0;
+    inputDirty = 1;
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+// keyboardThread: draw the input line now (and any other damage, e.g. after a resize)
+void refreshTuiInput() {
+    pthread_mutex_lock(&tuiMutex);
+    drawFrame(timerNow());
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+// keyboardThread: a local command is about to print to stdout, its output goes below the last line
+// (writerThread waits until endTuiOutput)
+void beginTuiOutput() {
+    if (!tuiEnabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&tuiMutex);
+    drawFrame(timerNow());
+    appendFormat("\x1b[%d;1H", regionRows());
+    if (!bottomBlank) {
+        appendFrame("\n", 1);
+    }
+    writeFrame();
+}
+
+void endTuiOutput() {
+    if (!tuiEnabled) {
+        return;
+    }
+
+    // the output ended with a newline, which left the bottom row empty
+    bottomBlank = 1;
+    inputDirty = 1;
+    drawFrame(timerNow());
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+// writerThread: show message behind header with the next frame (a reference is held while it can be on screen)
+void addTuiLine(const char* header, char* message) {
+    pthread_mutex_lock(&tuiMutex);
+    if (lineCount == TUI_MAX_LINES) {
+        releaseMessage(getLine(0)->message);
+        firstLine = (firstLine + 1) % TUI_MAX_LINES;
+        lineCount--;
+    }
+
+    Line* line = getLine(lineCount);
+    line->header = header;
+    line->message = holdMessage(message);
+    lineCount++;
+    newLines++;
+    pthread_mutex_unlock(&tuiMutex);
+}
+
+// writerThread: draw the lines added so far, unless the last frame was less than TUI_FRAME_MS ago
+// returns 0 if there is nothing left to draw, else when to call again
+uint64_t refreshTui(uint64_t now) {
+    uint64_t next = 0;
+
+    pthread_mutex_lock(&tuiMutex);
+    if (newLines > 0 || fullRedraw || resized) {
+        if (now - lastFrame >= TUI_FRAME_MS * 1000000ULL) {
+            drawFrame(now);
+        } else {
+            next = lastFrame + TUI_FRAME_MS * 1000000ULL;
+        }
+    }
+    pthread_mutex_unlock(&tuiMutex);
+
+    return next;
+}
@@ -0,0 +1,28 @@
+#ifndef _TUI_H
+#define _TUI_H
+
+#include <stdint.h>
+
+// most output lines kept for redrawing the scroll region (taller terminals show the last TUI_MAX_LINES)
+#define TUI_MAX_LINES 256
+// shortest time between two frames of received messages
+#define TUI_FRAME_MS 16
+// prompt in front of the input line
+#define TUI_PROMPT "> "
+
+void initTui();
+int isTuiEnabled();
+void closeTui();
+
+void startTuiInput(int capacity);
+int editTuiInput(const char* keys, int length, int* lineDone);
+int getTuiInputLength();
+void takeTuiInput(char* line);
+void refreshTuiInput();
+void beginTuiOutput();
+void endTuiOutput();
+
+void addTuiLine(const char* header, char* message);
+uint64_t refreshTui(uint64_t now);
+
+#endif
@@ -0,0 +1,183 @@
+// References:
+// Linux kernel documentation - MSG_ZEROCOPY (Documentation/networking/msg_zerocopy.rst)
+
+// ZEROCOPY
+// large messages are sent with MSG_ZEROCOPY: the kernel sends from the message's pages instead of copying them
+// into socket buffers, so the message must not be released (or changed) until the kernel reports the send completed
+// - each zerocopy send the kernel accepts gets the next id (0, 1, 2, ...), a completion on the socket's error queue
+//   covers a range of ids [ee_info, ee_data]; ranges usually come in order, but that is not guaranteed
+// - a message whose send has not completed waits in pending (in send order) with a reference held on it, and the
+//   ids its range covered are marked in completed: reapZerocopy releases the messages at the front of pending
+//   while their sends are marked, so a message is only released once its own send has completed
+// - the kernel may copy anyway (loopback, devices without scatter-gather), zerocopy then only adds work and
+//   is turned off for the rest of the session
+// everything except the report (printed after senderThread has been joined) belongs to senderThread
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "zerocopy.h"
+#include "freeManager.h"
+#include "timerWheel.h"
+#include "transport.h"
+
+static int zerocopyEnabled = 0;
+static int threshold;
+static MessageQueue pending;
+static uint32_t nextId = 0;    // id of the next zerocopy send
+static uint32_t pendingId = 0; // id of the send of the first message in pending
+static unsigned char completed[ZEROCOPY_MAX_PENDING]; // by id % ZEROCOPY_MAX_PENDING, for the sends in pending
+
+// report
+static uint64_t zerocopySends = 0;
+static uint64_t copiedSends = 0;
+
+// --zerocopy: send messages of at least bytes bytes with MSG_ZEROCOPY
+void initZerocopy(int bytes) {
+    zerocopyEnabled = 1;
+    threshold = bytes;
+    MessageQueue_init(&pending, 0);
+}
+
+// senderThread: allow zerocopy sends on its socket (kernels before 4.14 and other sockets do not have it)
+void startZerocopy(int sockfd) {
+    int enable = 1;
+
+    if (zerocopyEnabled && setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1) {
+        perror("zerocopy: could not enable SO_ZEROCOPY, sending with copies");
+        zerocopyEnabled = 0;
+    }
+}
+
+int useZerocopy(int length) {
+    return zerocopyEnabled && length >= threshold;
+}
+
+// send the first length bytes of message (from allocMessage) with MSG_ZEROCOPY
+// returns length, or -1 (errno is set) if it was not sent
+// once sent, a reference is held on message until reapZerocopy or drainZerocopy sees the kernel is done with it
+// (message must not be in another MessageQueue meanwhile)
+int sendZerocopy(int sockfd, char* message, int length, const struct sockaddr* addr, socklen_t addrLen) {
+    // case: as many sends as completed has room for are waiting, send a copy if none of them is done
+    if (MessageQueue_count(&pending) == ZEROCOPY_MAX_PENDING) {
+        reapZerocopy(sockfd);
+        if (MessageQueue_count(&pending) == ZEROCOPY_MAX_PENDING) {
+            errno = ENOBUFS;
+            return -1;
+        }
+    }
+
+    int numbytes = getTransport()->send(sockfd, message, length, MSG_ZEROCOPY, addr, addrLen);
+
+    // case: too many sends are waiting for completions (optmem_max), release some for the next message
+    if (numbytes == -1) {
+        if (errno == ENOBUFS) {
+            reapZerocopy(sockfd);
+            errno = ENOBUFS;
+        }
+        return -1;
+    }
+
+    MessageQueue_push(&pending, getMessageInfo(holdMessage(message)));
+    completed[nextId % ZEROCOPY_MAX_PENDING] = 0;
+    nextId++;
+    zerocopySends++;
+    return numbytes;
+}
+
+// mark the sends low..high as completed, then release the messages at the front of pending that are
+// (ids outside of pending, e.g. a range reported twice, are reported and ignored)
+static void completeSends(uint32_t low, uint32_t high) {
+    if ((int32_t)(high - low) < 0 || (int32_t)(high - pendingId) < 0 || (int32_t)(nextId - low) <= 0) {
+        fprintf(stderr, "zerocopy: completion for sends %u-%u, which are not waiting\n", low, high);
+        return;
+    }
+
+    // only the part of the range that is in pending (pendingId..nextId - 1)
+    if ((int32_t)(low - pendingId) < 0) {
+        low = pendingId;
+    }
+    if ((int32_t)(high - nextId) >= 0) {
+        high = nextId - 1;
+    }
+    for (uint32_t id = low; id != high + 1; id++) {
+        completed[id % ZEROCOPY_MAX_PENDING] = 1;
+    }
+
+    while (MessageQueue_count(&pending) > 0 && completed[pendingId % ZEROCOPY_MAX_PENDING]) {
+        releaseMessage(getMessageText(MessageQueue_pop(&pending)));
+        completed[pendingId % ZEROCOPY_MAX_PENDING] = 0;
+        pendingId++;
+    }
+}
+
+// read the completions that are waiting on sockfd's error queue and release the messages they cover
+void reapZerocopy(int sockfd) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+    struct msghdr msg;
+
+    while (MessageQueue_count(&pending) > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("zerocopy: could not read completions");
+            }
+            return;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // case: the kernel copied the data anyway, stop paying for completions
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copiedSends += err.ee_data - err.ee_info + 1;
+                if (zerocopyEnabled) {
+                    fprintf(stderr, "zerocopy: the kernel copies messages to this destination, sending with copies\n");
+                    zerocopyEnabled = 0;
+                }
+            }
+            completeSends(err.ee_info, err.ee_data);
+        }
+    }
+}
+
+// senderThread is done: wait (up to ZEROCOPY_DRAIN_MS) for the outstanding completions, then release every
+// message left (a send that has still not completed was most likely dropped)
+void drainZerocopy(int sockfd) {
+    struct pollfd fds = { .fd = sockfd, .events = 0 }; // POLLERR is always reported
+    uint64_t deadline = timerNow() + ZEROCOPY_DRAIN_MS * 1000000ULL;
+
+    reapZerocopy(sockfd);
+    while (MessageQueue_count(&pending) > 0 && timerNow() < deadline) {
+        if (poll(&fds, 1, ZEROCOPY_DRAIN_MS) <= 0) {
+            break;
+        }
+        reapZerocopy(sockfd);
+    }
+
+    releaseMessages(&pending);
+}
+
+void printZerocopyReport() {
+    if (zerocopySends == 0) {
+        return;
+    }
+    fprintf(stderr, "zerocopy: %llu messages sent with MSG_ZEROCOPY, %llu of them copied by the kernel\n",
+        (unsigned long long)zerocopySends, (unsigned long long)copiedSends);
+}
@@ -0,0 +1,24 @@
+#ifndef _ZEROCOPY_H
+#define _ZEROCOPY_H
+
+#include <sys/socket.h>
+
+// a message that is not sent yet is not worth the completion handling below this size
+#define MIN_ZEROCOPY_THRESHOLD 4096
+
+// most sends waiting for their completions, more are sent with a copy
+#define ZEROCOPY_MAX_PENDING 1024
+
+// senderThread waits this long for outstanding completions when the session ends
+#define ZEROCOPY_DRAIN_MS 1000
+
+void initZerocopy(int threshold);
+void startZerocopy(int sockfd);
+int useZerocopy(int length);
+
+int sendZerocopy(int sockfd, char* message, int length, const struct sockaddr* addr, socklen_t addrLen);
+void reapZerocopy(int sockfd);
+void drainZerocopy(int sockfd);
+void printZerocopyReport();
+
+#endif